@@ -1,5 +1,13 @@
 #include "Shader.h"
 #include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+
+std::string Shader::cacheDirectory = "shader_cache";
+double Shader::buildMilliseconds = 0.0;
+int Shader::cachedPrograms = 0;
+int Shader::compiledPrograms = 0;
 
 //Shader::Shader(const char* vertexPath, const char* fragmentPath)
 //{
@@ -129,58 +137,206 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* tes
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
 
-    const char* vShaderCode = vertexCode.c_str();
-    const char* fShaderCode = fragmentCode.c_str();
-    const char* tcShaderCode = tessControlPath ? tessControlCode.c_str() : nullptr;
-    const char* teShaderCode = tessEvalPath ? tessEvalCode.c_str() : nullptr;
+    // 2. Load the linked program from the binary cache, or compile and link it and store it there
+    uint64_t key = hashProgramSources({ vertexCode, fragmentCode, tessControlCode, tessEvalCode });
+    loadOrCompile(key, vertexPath, [&]() {
+        compileProgram(vertexCode.c_str(), fragmentCode.c_str(),
+            tessControlPath ? tessControlCode.c_str() : nullptr, tessEvalPath ? tessEvalCode.c_str() : nullptr);
+    });
+}
 
-    // 2. Compile the shaders
-    unsigned int vertex, fragment, tessControl, tessEval;
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
+Shader::Shader(const char* vertexPath, const char* geometryPath, const std::vector<std::string>& feedbackVaryings,
+	const char* tessControlPath, const char* tessEvalPath)
+{
+	std::string vertexCode, geometryCode, tessControlCode, tessEvalCode;
+	bool tessellation = tessControlPath && tessEvalPath;
+	if (!readShaderFile(vertexPath, vertexCode) || !readShaderFile(geometryPath, geometryCode)
+		|| (tessellation && (!readShaderFile(tessControlPath, tessControlCode) || !readShaderFile(tessEvalPath, tessEvalCode))))
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+
+	// the captured outputs are part of the linked program, so they are part of the key as well
+	std::vector<std::string> stages = { vertexCode, geometryCode, tessControlCode, tessEvalCode };
+	stages.insert(stages.end(), feedbackVaryings.begin(), feedbackVaryings.end());
+
+	loadOrCompile(hashProgramSources(stages), vertexPath, [&]() {
+		compileProgram(vertexCode.c_str(), nullptr, tessellation ? tessControlCode.c_str() : nullptr,
+			tessellation ? tessEvalCode.c_str() : nullptr, geometryCode.c_str(), &feedbackVaryings);
+	});
+}
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
+bool Shader::readShaderFile(const char* path, std::string& code)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	code = stream.str();
+	return true;
+}
 
-    if (tessControlPath)
-    {
-        tessControl = glCreateShader(GL_TESS_CONTROL_SHADER);
-        glShaderSource(tessControl, 1, &tcShaderCode, NULL);
-        glCompileShader(tessControl);
-        checkCompileErrors(tessControl, "TESS_CONTROL");
-    }
+void Shader::loadOrCompile(uint64_t key, const char* name, const std::function<void()>& compile)
+{
+	auto start = std::chrono::high_resolution_clock::now();
 
-    if (tessEvalPath)
-    {
-        tessEval = glCreateShader(GL_TESS_EVALUATION_SHADER);
-        glShaderSource(tessEval, 1, &teShaderCode, NULL);
-        glCompileShader(tessEval);
-        checkCompileErrors(tessEval, "TESS_EVALUATION");
-    }
+	bool cached = loadProgramBinary(key);
+	if (!cached)
+	{
+		compile();
+		saveProgramBinary(key);
+	}
+	introspectUniforms();
+
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	buildMilliseconds += milliseconds;
+	++(cached ? cachedPrograms : compiledPrograms);
+	std::cout << "Shader program " << name << (cached ? " loaded from the binary cache in " : " compiled in ") << milliseconds << " ms" << std::endl;
+}
+
+void Shader::compileProgram(const char* vShaderCode, const char* fShaderCode, const char* tcShaderCode, const char* teShaderCode,
+	const char* gShaderCode, const std::vector<std::string>* feedbackVaryings)
+{
+	// every stage but the vertex shader is optional, transform feedback programs have no fragment shader
+	struct Stage { const char* code; GLenum type; const char* name; };
+	const Stage stages[] = {
+		{ vShaderCode, GL_VERTEX_SHADER, "VERTEX" },
+		{ tcShaderCode, GL_TESS_CONTROL_SHADER, "TESS_CONTROL" },
+		{ teShaderCode, GL_TESS_EVALUATION_SHADER, "TESS_EVALUATION" },
+		{ gShaderCode, GL_GEOMETRY_SHADER, "GEOMETRY" },
+		{ fShaderCode, GL_FRAGMENT_SHADER, "FRAGMENT" },
+	};
+
+	std::vector<unsigned int> shaders;
+	for (const Stage& stage : stages)
+	{
+		if (!stage.code)
+			continue;
+
+		unsigned int shader = glCreateShader(stage.type);
+		glShaderSource(shader, 1, &stage.code, NULL);
+		glCompileShader(shader);
+		checkCompileErrors(shader, stage.name);
+		shaders.push_back(shader);
+	}
+
+	// shader program, retrievable so it can be written to the binary cache
+	ID = glCreateProgram();
+	glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	for (unsigned int shader : shaders)
+		glAttachShader(ID, shader);
+
+	// captured outputs have to be declared before linking
+	if (feedbackVaryings && !feedbackVaryings->empty())
+	{
+		std::vector<const char*> names;
+		for (const std::string& name : *feedbackVaryings)
+			names.push_back(name.c_str());
+		glTransformFeedbackVaryings(ID, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+	}
 
-    // Shader program
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    if (tessControlPath)
-        glAttachShader(ID, tessControl);
-    if (tessEvalPath)
-        glAttachShader(ID, tessEval);
+	glLinkProgram(ID);
+	checkCompileErrors(ID, "PROGRAM");
 
-    glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
+	// delete shaders as they're linked into the program
+	for (unsigned int shader : shaders)
+		glDeleteShader(shader);
+}
 
-    // Delete shaders as they're linked into the program
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
-    if (tessControlPath)
-        glDeleteShader(tessControl);
-    if (tessEvalPath)
-        glDeleteShader(tessEval);
+void Shader::setCacheDirectory(const std::string& directory)
+{
+	cacheDirectory = directory;
+}
+
+// FNV-1a over every stage and the driver strings, a binary is only valid for the exact same driver
+uint64_t Shader::hashProgramSources(const std::vector<std::string>& stages)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const char* text) {
+		for (; text && *text; ++text)
+		{
+			hash ^= (unsigned char)*text;
+			hash *= 1099511628211ull;
+		}
+		// stage separator
+		hash ^= 0xFF;
+		hash *= 1099511628211ull;
+	};
+
+	for (const std::string& stage : stages)
+		add(stage.c_str());
+	add((const char*)glGetString(GL_VENDOR));
+	add((const char*)glGetString(GL_RENDERER));
+	add((const char*)glGetString(GL_VERSION));
+	return hash;
+}
+
+std::string Shader::getCachePath(uint64_t key)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return cacheDirectory + "/" + name;
+}
+
+bool Shader::loadProgramBinary(uint64_t key)
+{
+	if (cacheDirectory.empty())
+		return false;
+
+	std::ifstream file(getCachePath(key), std::ios::binary);
+	if (!file)
+		return false;
+
+	ProgramBinaryHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_BINARY_MAGIC || header.key != key
+		|| header.length == 0 || header.length > (64u << 20))
+		return false;
+
+	std::vector<char> binary(header.length);
+	if (!file.read(binary.data(), binary.size()))
+		return false;
+
+	// the driver may still reject it (e.g. after an update that kept the version string), compile then
+	ID = glCreateProgram();
+	glProgramBinary(ID, header.format, binary.data(), (GLsizei)binary.size());
+
+	int success = 0;
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		std::cout << "WARNING::SHADER::PROGRAM_BINARY_REJECTED: " << getCachePath(key) << std::endl;
+		glDeleteProgram(ID);
+		ID = 0;
+		return false;
+	}
+
+	return true;
+}
+
+void Shader::saveProgramBinary(uint64_t key)
+{
+	int success = 0, formats = 0, length = 0;
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (cacheDirectory.empty() || !success || formats == 0 || length <= 0)
+		return;
+
+	ProgramBinaryHeader header;
+	header.magic = PROGRAM_BINARY_MAGIC;
+	header.key = key;
+
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	glGetProgramBinary(ID, length, &written, &header.format, binary.data());
+	header.length = (uint32_t)written;
+
+	std::error_code error;
+	std::filesystem::create_directories(cacheDirectory, error);
+
+	std::ofstream file(getCachePath(key), std::ios::binary);
+	if (!file.write((const char*)&header, sizeof(header)) || !file.write(binary.data(), written))
+		std::cout << "WARNING::SHADER::PROGRAM_BINARY_NOT_WRITTEN: " << getCachePath(key) << std::endl;
 }
 
 void Shader::use()
@@ -190,62 +346,230 @@ void Shader::use()
 
 void Shader::setBool(const std::string& name, bool value) const
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+	glUniform1i(getUniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-	glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1i(getUniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-	glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+	glUniform1f(getUniformLocation(name), value);
 }
 
 void Shader::setVec2(const std::string& name, const glm::vec2& value) const
 {
-	glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform2fv(getUniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setVec2(const std::string& name, float x, float y) const
 {
-	glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+	glUniform2f(getUniformLocation(name), x, y);
 }
 
 void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 {
-	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform3fv(getUniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setVec3(const std::string& name, float x, float y, float z) const
 {
-	glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+	glUniform3f(getUniformLocation(name), x, y, z);
 }
 
 void Shader::setVec4(const std::string& name, const glm::vec4& value) const
 {
-	glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+	glUniform4fv(getUniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setVec4(const std::string& name, float x, float y, float z, float w) const
 {
-	glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+	glUniform4f(getUniformLocation(name), x, y, z, w);
 }
 
 void Shader::setMat2(const std::string& name, const glm::mat2& mat) const
 {
-	glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::setMat3(const std::string& name, const glm::mat3& mat) const
 {
-	glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::setMat4(const std::string& name, const glm::mat4& mat) const
 {
-	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+	glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+}
+
+int Shader::getUniformLocation(const std::string& name) const
+{
+	int index = findUniform(name.c_str(), hashUniformName(name.c_str()));
+	if (index >= 0)
+		return uniforms[index].location;
+
+	// set but not active: either a typo or optimized away by the compiler
+	++uniformMissCount;
+	for (size_t i = 0; i < missingUniforms.size(); ++i)
+	{
+		if (missingUniforms[i] == name)
+			return -1;
+	}
+	missingUniforms.push_back(name);
+	std::cout << "WARNING::SHADER::UNIFORM_NOT_ACTIVE: " << name << " (program " << ID << ")" << std::endl;
+
+	return -1;
+}
+
+void Shader::introspectUniforms()
+{
+	uniforms.clear();
+	uniformSlots.clear();
+
+	int count = 0, maxNameLength = 0;
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> nameBuffer(maxNameLength + 1);
+	for (int i = 0; i < count; ++i)
+	{
+		GLsizei length = 0;
+		UniformInfo info;
+		glGetActiveUniform(ID, i, (GLsizei)nameBuffer.size(), &length, &info.size, &info.type, nameBuffer.data());
+		info.name.assign(nameBuffer.data(), length);
+		info.location = glGetUniformLocation(ID, info.name.c_str());
+
+		// uniforms inside blocks have no location
+		if (info.location < 0)
+			continue;
+
+		// arrays are reported as "name[0]", register the plain name and every further element as well
+		if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+		{
+			UniformInfo base = info;
+			base.name.erase(base.name.size() - 3);
+			base.hash = hashUniformName(base.name.c_str());
+			uniforms.push_back(base);
+
+			for (int k = 1; k < info.size; ++k)
+			{
+				UniformInfo element = info;
+				element.name = base.name + "[" + std::to_string(k) + "]";
+				element.location = glGetUniformLocation(ID, element.name.c_str());
+				element.size = info.size - k;
+				element.hash = hashUniformName(element.name.c_str());
+				if (element.location >= 0)
+					uniforms.push_back(element);
+			}
+		}
+
+		info.hash = hashUniformName(info.name.c_str());
+		uniforms.push_back(info);
+	}
+
+	// power of two capacity with at most 50% load
+	size_t capacity = 8;
+	while (capacity < uniforms.size() * 2)
+		capacity *= 2;
+	uniformSlots.assign(capacity, -1);
+
+	for (size_t i = 0; i < uniforms.size(); ++i)
+	{
+		size_t slot = uniforms[i].hash & (capacity - 1);
+		while (uniformSlots[slot] >= 0)
+			slot = (slot + 1) & (capacity - 1);
+		uniformSlots[slot] = (int)i;
+	}
+}
+
+int Shader::findUniform(const char* name, uint32_t hash) const
+{
+	if (uniformSlots.empty())
+		return -1;
+
+	size_t mask = uniformSlots.size() - 1;
+	for (size_t slot = hash & mask; uniformSlots[slot] >= 0; slot = (slot + 1) & mask)
+	{
+		const UniformInfo& info = uniforms[uniformSlots[slot]];
+		if (info.hash == hash && info.name == name)
+			return uniformSlots[slot];
+	}
+
+	return -1;
+}
+
+// FNV-1a
+uint32_t Shader::hashUniformName(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name; ++name)
+	{
+		hash ^= (unsigned char)*name;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+template <>
+void UniformHandle<bool>::set(const bool& value) const
+{
+	glProgramUniform1i(program, location, (int)value);
+}
+
+template <>
+void UniformHandle<int>::set(const int& value) const
+{
+	glProgramUniform1i(program, location, value);
+}
+
+template <>
+void UniformHandle<float>::set(const float& value) const
+{
+	glProgramUniform1f(program, location, value);
+}
+
+template <>
+void UniformHandle<glm::vec2>::set(const glm::vec2& value) const
+{
+	glProgramUniform2fv(program, location, 1, &value[0]);
+}
+
+template <>
+void UniformHandle<glm::ivec2>::set(const glm::ivec2& value) const
+{
+	glProgramUniform2i(program, location, value.x, value.y);
+}
+
+template <>
+void UniformHandle<glm::vec3>::set(const glm::vec3& value) const
+{
+	glProgramUniform3fv(program, location, 1, &value[0]);
+}
+
+template <>
+void UniformHandle<glm::vec4>::set(const glm::vec4& value) const
+{
+	glProgramUniform4fv(program, location, 1, &value[0]);
+}
+
+template <>
+void UniformHandle<glm::mat2>::set(const glm::mat2& mat) const
+{
+	glProgramUniformMatrix2fv(program, location, 1, GL_FALSE, &mat[0][0]);
+}
+
+template <>
+void UniformHandle<glm::mat3>::set(const glm::mat3& mat) const
+{
+	glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, &mat[0][0]);
+}
+
+template <>
+void UniformHandle<glm::mat4>::set(const glm::mat4& mat) const
+{
+	glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::checkCompileErrors(unsigned int shader, std::string type)
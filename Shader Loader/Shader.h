@@ -7,20 +7,61 @@
 #include <fstream>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <cstdint>
+#include <functional>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// typed handle to an active uniform, resolved once through Shader::getUniform and reused every frame;
+// values are written with glProgramUniform* so the handle does not depend on the bound program
+template <typename T>
+struct UniformHandle
+{
+	unsigned int program = 0;
+	int location = -1;
+
+	bool isValid() const { return location >= 0; }
+	void set(const T& value) const;
+};
+
+template <> void UniformHandle<bool>::set(const bool& value) const;
+template <> void UniformHandle<int>::set(const int& value) const;
+template <> void UniformHandle<float>::set(const float& value) const;
+template <> void UniformHandle<glm::vec2>::set(const glm::vec2& value) const;
+template <> void UniformHandle<glm::ivec2>::set(const glm::ivec2& value) const;
+template <> void UniformHandle<glm::vec3>::set(const glm::vec3& value) const;
+template <> void UniformHandle<glm::vec4>::set(const glm::vec4& value) const;
+template <> void UniformHandle<glm::mat2>::set(const glm::mat2& mat) const;
+template <> void UniformHandle<glm::mat3>::set(const glm::mat3& mat) const;
+template <> void UniformHandle<glm::mat4>::set(const glm::mat4& mat) const;
+
 class Shader
 {
 public:
 	// the program ID
 	unsigned int ID;
 
+	// active uniform reported by the driver at link time
+	struct UniformInfo
+	{
+		std::string name;
+		uint32_t hash;
+		int location;
+		GLenum type;
+		int size;
+	};
+
 	// constructor that reads and builds the shader
 	Shader(const char* vertexPath, const char* fragmentPath, const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr);
 
+	// transform feedback program without a fragment stage, capturing the given geometry shader outputs;
+	// tessellation stages are optional
+	Shader(const char* vertexPath, const char* geometryPath, const std::vector<std::string>& feedbackVaryings,
+		const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr);
+
 	// use/activate the shader
 	void use();
 
@@ -40,9 +81,68 @@ public:
 	void setMat3(const std::string& name, const glm::mat3& mat) const;
 	void setMat4(const std::string& name, const glm::mat4& mat) const;
 
+	// program binary cache, an empty directory disables it
+	static void setCacheDirectory(const std::string& directory);
+	static double getBuildMilliseconds() { return buildMilliseconds; }
+	static int getCachedProgramCount() { return cachedPrograms; }
+	static int getCompiledProgramCount() { return compiledPrograms; }
+
+	// uniform introspection
+	int getUniformLocation(const std::string& name) const;
+	const std::vector<UniformInfo>& getActiveUniforms() const { return uniforms; }
+	unsigned int getUniformMissCount() const { return uniformMissCount; }
+
+	template <typename T>
+	UniformHandle<T> getUniform(const std::string& name) const
+	{
+		UniformHandle<T> handle;
+		handle.program = ID;
+		handle.location = getUniformLocation(name);
+		return handle;
+	}
+
 private:
+	// file layout of a cached program binary: header followed by the driver's binary blob
+	// written as is, so laid out without padding: every byte of the file is defined and the same on every ABI
+	struct ProgramBinaryHeader
+	{
+		uint64_t key = 0;
+		uint32_t magic = 0;
+		GLenum format = 0;
+		uint32_t length = 0;
+		uint32_t reserved = 0;
+	};
+	static_assert(sizeof(ProgramBinaryHeader) == 24, "program binary header has padding");
+	static const uint32_t PROGRAM_BINARY_MAGIC = 0x32425053;	// "SPB2"
+
+	static std::string cacheDirectory;
+	static double buildMilliseconds;
+	static int cachedPrograms;
+	static int compiledPrograms;
+
+	void compileProgram(const char* vShaderCode, const char* fShaderCode, const char* tcShaderCode, const char* teShaderCode,
+		const char* gShaderCode = nullptr, const std::vector<std::string>* feedbackVaryings = nullptr);
+	void loadOrCompile(uint64_t key, const char* name, const std::function<void()>& compile);
+	bool loadProgramBinary(uint64_t key);
+	void saveProgramBinary(uint64_t key);
+	static bool readShaderFile(const char* path, std::string& code);
+	static uint64_t hashProgramSources(const std::vector<std::string>& stages);
+	static std::string getCachePath(uint64_t key);
+
+	// flat open addressing table over the active uniforms, filled once after linking
+	std::vector<UniformInfo> uniforms;
+	std::vector<int> uniformSlots;
+
+	// names that were looked up but are not active, each one is reported once
+	mutable std::vector<std::string> missingUniforms;
+	mutable unsigned int uniformMissCount = 0;
+
 	// utility function for checking shader compilation/linking errors
 	void checkCompileErrors(unsigned int shader, std::string type);
+
+	void introspectUniforms();
+	int findUniform(const char* name, uint32_t hash) const;
+	static uint32_t hashUniformName(const char* name);
 };
 
 #endif
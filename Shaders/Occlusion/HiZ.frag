@@ -0,0 +1,36 @@
+// one level of the max depth pyramid: every texel keeps the farthest depth of the 2x2 source texels below it
+#version 410 core
+
+uniform sampler2D sourceDepth;	// the scene depth for level 0, the previous pyramid level after that
+uniform int sourceLevel;
+uniform ivec2 sourceSize;
+
+out float maxDepth;
+
+float fetchDepth(ivec2 texel)
+{
+	return texelFetch(sourceDepth, min(texel, sourceSize - 1), sourceLevel).r;
+}
+
+void main()
+{
+	ivec2 target = ivec2(gl_FragCoord.xy);
+	ivec2 source = target * 2;
+
+	float depth = max(max(fetchDepth(source), fetchDepth(source + ivec2(1, 0))),
+		max(fetchDepth(source + ivec2(0, 1)), fetchDepth(source + ivec2(1, 1))));
+
+	// odd sizes: the last column / row also takes the third source texel, so the bound stays conservative
+	ivec2 targetSize = max(sourceSize / 2, ivec2(1));
+	bool extraColumn = (sourceSize.x & 1) == 1 && target.x == targetSize.x - 1;
+	bool extraRow = (sourceSize.y & 1) == 1 && target.y == targetSize.y - 1;
+
+	if (extraColumn)
+		depth = max(depth, max(fetchDepth(source + ivec2(2, 0)), fetchDepth(source + ivec2(2, 1))));
+	if (extraRow)
+		depth = max(depth, max(fetchDepth(source + ivec2(0, 2)), fetchDepth(source + ivec2(1, 2))));
+	if (extraColumn && extraRow)
+		depth = max(depth, fetchDepth(source + ivec2(2, 2)));
+
+	maxDepth = depth;
+}
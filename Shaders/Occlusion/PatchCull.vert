@@ -0,0 +1,10 @@
+// patch occlusion culling: one point per candidate patch, the vertex ID is the patch index
+#version 410 core
+
+flat out int vPatch;
+
+void main()
+{
+	vPatch = gl_VertexID;
+	gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,95 @@
+// CDLOD vertex shader: the terrain without tessellation stages, feeding Shader.frag like Shader.TES does
+#version 410 core
+
+// one quadrant of a node grid: integer grid coordinates (0 .. gridQuads) of the shared quadrant mesh,
+// instanced per selected quadrant with its world corner (x, z), world size and LOD level
+layout (location = 0) in vec2 aGridPosition;
+layout (location = 1) in vec4 aQuadrant;
+
+uniform sampler2D heightMap;
+uniform sampler2D normalMap;	// Sobel normals of the height map, (x, z) only
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 clippingPlane;
+uniform float heightScale = 64.0;	// Height = value * heightScale + heightOffset, for R16 / R32F heightmaps alike
+uniform float heightOffset = -16.0;
+
+// tiled heightmap: tiles resident in the GPU tile cache, found through the page table
+uniform bool useTiledHeightmap;
+uniform usampler2D pageTable;		// (cache slot, mip level) of the finest resident tile per level 0 tile
+uniform sampler2DArray tileCache;
+uniform vec2 tiledMapSize;			// level 0 size in texels
+uniform float tileSize;
+uniform float tileBorder;
+
+// quads per quadrant side, the world rectangle of the map and the camera the LOD was selected for
+uniform float gridQuads;
+uniform vec4 mapBounds;				// x0, z0, x1, z1
+uniform vec3 cameraPosition;
+// per level distance range over which the vertices morph into the next coarser grid
+uniform vec2 morphRanges[16];
+
+out float Height;
+out vec2 FragTexCoord;
+out vec3 WorldPos;
+out vec3 Normal;
+out vec2 MapCoord;
+
+float sampleTiledHeight(vec2 uv)
+{
+	vec2 texel = fract(uv) * tiledMapSize;
+	ivec2 page = clamp(ivec2(texel / tileSize), ivec2(0), textureSize(pageTable, 0) - 1);
+	uvec2 entry = texelFetch(pageTable, page, 0).xy;
+
+	// position inside the resident tile of that level, skipping its border
+	vec2 levelTexel = texel * exp2(-float(entry.y));
+	vec2 local = levelTexel - floor(levelTexel / tileSize) * tileSize;
+	vec2 tileUV = (local + tileBorder) / (tileSize + 2.0 * tileBorder);
+
+	return texture(tileCache, vec3(tileUV, float(entry.x))).r;
+}
+
+vec2 mapCoord(vec2 position)
+{
+	return (position - mapBounds.xy) / (mapBounds.zw - mapBounds.xy);
+}
+
+float sampleHeight(vec2 position)
+{
+	vec2 uv = mapCoord(position);
+	float value = useTiledHeightmap ? sampleTiledHeight(uv) : textureLod(heightMap, uv, 0.0).r;
+	return value * heightScale + heightOffset;
+}
+
+void main()
+{
+	float spacing = aQuadrant.z / gridQuads;
+	vec2 position = aQuadrant.xy + aGridPosition * spacing;
+
+	// odd grid vertices slide onto their even neighbour as the camera distance reaches the end of the level's range,
+	// at which point the grid matches the next coarser level (nodes at the map edge are clamped to the map)
+	vec2 range = morphRanges[int(aQuadrant.w)];
+	float distance = length(cameraPosition - vec3(position.x, sampleHeight(position), position.y));
+	float morph = clamp((distance - range.x) / max(range.y - range.x, 0.0001), 0.0, 1.0);
+	vec2 morphed = position - fract(aGridPosition * 0.5) * 2.0 * spacing * morph;
+	morphed = clamp(morphed, mapBounds.xy, mapBounds.zw);
+
+	vec2 texCoord = mapCoord(morphed);
+	FragTexCoord = texCoord * 20;
+	MapCoord = texCoord;
+	Height = sampleHeight(morphed);
+
+	// surface normal for the lighting, y follows from the unit length
+	vec2 normalXZ = textureLod(normalMap, texCoord, 0.0).rg;
+	Normal = vec3(normalXZ.x, sqrt(max(0.0, 1.0 - dot(normalXZ, normalXZ))), normalXZ.y);
+
+	vec4 p = vec4(morphed.x, Height, morphed.y, 1.0);
+	vec4 worldPosition = model * p;
+	WorldPos = worldPosition.xyz;
+
+	// clipping according to the clipping plane
+	gl_ClipDistance[0] = dot(worldPosition, clippingPlane);
+
+	gl_Position = projection * view * worldPosition;
+}
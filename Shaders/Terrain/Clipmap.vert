@@ -0,0 +1,81 @@
+// geometry clipmap vertex shader: one camera centred level grid per draw, feeding Shader.frag like Shader.TES does
+#version 410 core
+
+// integer vertex coordinates (0 .. gridQuads) of the level grid
+layout (location = 0) in vec2 aGridPosition;
+
+// heights of the level and the next coarser one, world heights stored toroidally: grid sample g at texel g mod size
+uniform sampler2D fineHeights;
+uniform sampler2D coarseHeights;
+uniform sampler2D normalMap;	// Sobel normals of the height map, (x, z) only, mipmapped
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 clippingPlane;
+
+uniform vec2 mapMin;			// world corner of grid sample (0, 0)
+uniform vec2 mapMax;
+uniform float levelSpacing;		// world units between two samples of this level
+uniform vec2 levelOrigin;		// grid coordinates of the level's first vertex
+uniform float levelIndex;		// normal map lod, the normal map has the heightmap's resolution
+uniform float gridQuads;
+uniform float textureSize;
+uniform vec2 viewer;			// world x, z the levels are centred on
+uniform float transitionWidth;	// in level samples
+uniform bool hasCoarser;
+
+// the footprint of the next finer level is cut out of this one with the second clip distance
+uniform bool hasHole;
+uniform vec4 holeRect;			// x0, z0, x1, z1 in this level's grid coordinates
+
+out float gl_ClipDistance[2];
+
+out float Height;
+out vec2 FragTexCoord;
+out vec3 WorldPos;
+out vec3 Normal;
+out vec2 MapCoord;
+
+void main()
+{
+	vec2 grid = levelOrigin + aGridPosition;
+	vec2 gridPosition = mapMin + grid * levelSpacing;
+
+	float fineHeight = texelFetch(fineHeights, ivec2(mod(grid, textureSize)), 0).r;
+
+	// towards the outer border the level blends into the coarser one, whose grid it matches exactly at the border
+	// (odd vertices take the average of their two coarse neighbours, i.e. lie on the coarse edge)
+	float alpha = 0.0;
+	if (hasCoarser)
+	{
+		vec2 distance = abs(gridPosition - viewer) / levelSpacing;
+		float halfExtent = gridQuads * 0.5;
+		alpha = clamp((max(distance.x, distance.y) - (halfExtent - transitionWidth - 2.0)) / transitionWidth, 0.0, 1.0);
+	}
+	float coarseHeight = textureLod(coarseHeights, (grid * 0.5 + 0.5) / textureSize, 0.0).r;
+	Height = mix(fineHeight, coarseHeight, alpha);
+
+	// grids reaching past the map collapse onto its border
+	vec2 position = clamp(gridPosition, mapMin, mapMax);
+
+	vec2 texCoord = (position - mapMin) / (mapMax - mapMin);
+	FragTexCoord = texCoord * 20;
+	MapCoord = texCoord;
+
+	// surface normal for the lighting, y follows from the unit length
+	vec2 normalXZ = textureLod(normalMap, texCoord, levelIndex + alpha).rg;
+	Normal = vec3(normalXZ.x, sqrt(max(0.0, 1.0 - dot(normalXZ, normalXZ))), normalXZ.y);
+
+	vec4 worldPosition = model * vec4(position.x, Height, position.y, 1.0);
+	WorldPos = worldPosition.xyz;
+
+	// clipping according to the clipping plane
+	gl_ClipDistance[0] = dot(worldPosition, clippingPlane);
+
+	// negative inside the finer level's footprint; its border runs along this level's vertices, so every quad is
+	// either clipped away completely or kept completely
+	vec2 inside = max(holeRect.xy - grid, grid - holeRect.zw);
+	gl_ClipDistance[1] = hasHole ? max(inside.x, inside.y) : 1.0;
+
+	gl_Position = projection * view * worldPosition;
+}
@@ -3,62 +3,29 @@
 in float Height;
 in vec2 FragTexCoord;
 in vec3 WorldPos;
+in vec3 Normal;
+in vec2 MapCoord;
 
 out vec4 FragColor;
 
-// textures for the different height levels
-uniform sampler2D textureHeight0;
-uniform sampler2D textureHeight1;
-uniform sampler2D textureHeight2;
-uniform sampler2D textureHeight3;
+// material layers and their per texel blend weights, precomputed from the heightmap
+uniform sampler2DArray materials;
+uniform sampler2D splatMap;
 
-// thresholds for the texture heights
-uniform float tHeight0 = 64.0;
-uniform float tHeight1 = 128.0;
-uniform float tHeight2 = 193.0;
-uniform float tHeight3 = 256.0;
+// directional sun light
+uniform vec3 lightDirection = vec3(-0.4, 0.8, -0.45);	// towards the light
+uniform float ambientStrength = 0.35;
 
 vec4 CalcTexColor(vec2 texCoord)
 {
-	vec4 TexColor;
+	// always 4 layer samples, unused layers just have a weight of 0
+	vec4 weights = texture(splatMap, MapCoord);
+	weights /= max(dot(weights, vec4(1.0)), 0.0001);
 
-	// bring height values in the [0, 256] interval
-	float h = (Height + 16) * 4.0;
-
-	if(h < tHeight0)
-	{
-		TexColor = texture(textureHeight0, texCoord);
-	}
-	else if(h < tHeight1)
-	{
-		vec4 color0 = texture(textureHeight0, texCoord);
-		vec4 color1 = texture(textureHeight1, texCoord);
-		float delta = tHeight1 - tHeight0;
-		float factor = (h - tHeight0) / delta;
-		TexColor = mix(color0, color1, factor);
-	}
-	else if(h < tHeight2)
-	{
-		vec4 color0 = texture(textureHeight1, texCoord);
-		vec4 color1 = texture(textureHeight2, texCoord);
-		float delta = tHeight2 - tHeight1;
-		float factor = (h - tHeight1) / delta;
-		TexColor = mix(color0, color1, factor);
-	}
-	else if(h < tHeight3)
-	{
-		vec4 color0 = texture(textureHeight2, texCoord);
-		vec4 color1 = texture(textureHeight3, texCoord);
-		float delta = tHeight3 - tHeight2;
-		float factor = (h - tHeight2) / delta;
-		TexColor = mix(color0, color1, factor);
-	}
-	else
-	{
-		TexColor = texture(textureHeight3, texCoord);
-	}
-
-	return TexColor;
+	return weights.x * texture(materials, vec3(texCoord, 0.0))
+		+ weights.y * texture(materials, vec3(texCoord, 1.0))
+		+ weights.z * texture(materials, vec3(texCoord, 2.0))
+		+ weights.w * texture(materials, vec3(texCoord, 3.0));
 }
 
 void main()
@@ -74,6 +41,10 @@ void main()
 
 	vec4 TexColor = CalcTexColor(worldTexCoord);
 
+	// diffuse lighting from the interpolated normal map normal
+	float diffuse = max(dot(normalize(Normal), normalize(lightDirection)), 0.0);
+	TexColor.rgb *= ambientStrength + (1.0 - ambientStrength) * diffuse;
+
 	//if(gl_FrontFacing)
 	//{
 	//	FragColor = vec4(0.0, 0.0, 0.0, 0.0); // RGBA with 0 alpha
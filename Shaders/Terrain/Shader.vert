@@ -1,18 +1,32 @@
 // vertex shader
 #version 410 core
 
-// vertex position
-layout (location = 0) in vec3 aPos;
-// texture coord
-layout (location = 1) in vec2 aTex;
+// the patch grid has no vertex buffer: every patch is 4 consecutive vertex IDs,
+// patch (i, j) starts at vertex (i * gridRez + j) * 4 so the culled draw ranges address it directly
+uniform int gridRez;
+// world position of the grid corner (x, z) and the size of one patch
+uniform vec2 gridOrigin;
+uniform vec2 gridSpacing;
+
+// occlusion culled draws come from a transform feedback buffer holding the original vertex index of each control point
+layout (location = 0) in int aPatchVertex;
+uniform bool useFeedbackVertices;
 
 out vec2 TexCoord;
 
 void main()
 {
+	int vertexIndex = useFeedbackVertices ? aPatchVertex : gl_VertexID;
+	int patchIndex = vertexIndex / 4;
+	int corner = vertexIndex % 4;
+
+	// corners in the order (i, j), (i + 1, j), (i, j + 1), (i + 1, j + 1)
+	ivec2 cell = ivec2(patchIndex / gridRez, patchIndex % gridRez) + ivec2(corner & 1, corner >> 1);
+
 	// convert coords to homogenous -- add W coord
-	gl_Position = vec4(aPos, 1.0);
+	vec2 position = gridOrigin + vec2(cell) * gridSpacing;
+	gl_Position = vec4(position.x, 0.0, position.y, 1.0);
 
-	// pass texture coordinate through
-	TexCoord = aTex;
+	// texture coordinate of the corner
+	TexCoord = vec2(cell) / float(gridRez);
 }
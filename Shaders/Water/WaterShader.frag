@@ -13,13 +13,24 @@ uniform sampler2D dudvMap;
 
 uniform float moveFactor;
 
+// part of the reflection / refraction targets rendered at the current dynamic resolution
+uniform vec2 reflectionUVScale = vec2(1.0);
+uniform vec2 refractionUVScale = vec2(1.0);
+
 const float waveDistortionStrength = 0.02;
 
+// maps [0, 1] coordinates onto the rendered part of a target, staying half a texel inside it
+vec2 toTargetCoords(vec2 coords, vec2 uvScale, sampler2D target)
+{
+	vec2 halfTexel = 0.5 / vec2(textureSize(target, 0));
+	return clamp(coords * uvScale, halfTexel, uvScale - halfTexel);
+}
+
 void main()
 {
 	vec2 normalizedDeviceSpace = (clipSpace.xy / clipSpace.w) / 2.0 + 0.5;
 	vec2 refractTexCoords = vec2(normalizedDeviceSpace.x, normalizedDeviceSpace.y);
-	vec2 reflectTexCoords = vec2(normalizedDeviceSpace.x, -normalizedDeviceSpace.y);
+	vec2 reflectTexCoords = vec2(normalizedDeviceSpace.x, 1.0 - normalizedDeviceSpace.y);
 
 	vec2 distortion1 = texture(dudvMap, vec2(textureCoords.x + moveFactor, textureCoords.y)).rg * 2.0 - 1.0;
 	distortion1 *= waveDistortionStrength;
@@ -30,14 +41,10 @@ void main()
 	vec2 totalDistortion = distortion1 + distortion2;
 
 	reflectTexCoords += totalDistortion;
-	reflectTexCoords.x = clamp(reflectTexCoords.x, 0.001, 0.999);
-	reflectTexCoords.y = clamp(reflectTexCoords.y, -0.999, -0.001);
-
 	refractTexCoords += totalDistortion;
-	refractTexCoords = clamp(refractTexCoords, 0.001, 0.999);
 
-	vec4 reflectColor = texture(reflectionTexture, reflectTexCoords);
-	vec4 refractColor = texture(refractionTexture, refractTexCoords);
+	vec4 reflectColor = texture(reflectionTexture, toTargetCoords(reflectTexCoords, reflectionUVScale, reflectionTexture));
+	vec4 refractColor = texture(refractionTexture, toTargetCoords(refractTexCoords, refractionUVScale, refractionTexture));
 
 	vec3 viewVector = normalize(toCameraVector);
 	float refractiveFactor = dot(viewVector, vec3(0.0, 1.0, 0.0));
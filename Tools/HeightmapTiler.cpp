@@ -0,0 +1,203 @@
+// Offline converter from a heightmap image (or raw 16 bit grid) to the tiled, mip-chained .thm format
+// read by TiledHeightmap / TileCache. The output is written through a memory mapping, level by level,
+// so inputs far larger than RAM (raw DEMs) only need their pages touched once.
+//
+// Usage: HeightmapTiler input.(png|r16) output.thm [--size WxH] [--tile N] [--border N] [--scale S] [--offset O]
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <MappedFile.h>
+#include <TiledHeightmap.h>
+#include <ParallelFor.h>
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+
+// level 0 source: either decoded pixels or a mapped raw little endian 16 bit file
+struct SourceImage {
+    int width = 0;
+    int height = 0;
+    const uint16_t* texels = nullptr;       // raw file or single channel copy of the decoded image
+    std::vector<uint16_t> decoded;
+    MappedFile raw;
+
+    uint16_t texel(int x, int y) const
+    {
+        x = std::max(0, std::min(x, width - 1));
+        y = std::max(0, std::min(y, height - 1));
+        return texels[(size_t)y * width + x];
+    }
+};
+
+static bool endsWith(const std::string& value, const std::string& suffix)
+{
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool loadSource(const std::string& path, int rawWidth, int rawHeight, SourceImage& source)
+{
+    if (endsWith(path, ".r16") || endsWith(path, ".raw"))
+    {
+        if (rawWidth <= 0 || rawHeight <= 0)
+        {
+            std::cout << "Raw heightmaps need --size WxH" << std::endl;
+            return false;
+        }
+        if (!source.raw.openRead(path))
+            return false;
+        if (source.raw.getSize() < (uint64_t)rawWidth * rawHeight * sizeof(uint16_t))
+        {
+            std::cout << "Raw heightmap " << path << " is smaller than " << rawWidth << " x " << rawHeight << std::endl;
+            return false;
+        }
+
+        source.width = rawWidth;
+        source.height = rawHeight;
+        source.texels = (const uint16_t*)source.raw.getData();
+        return true;
+    }
+
+    // images keep the channel the terrain shader samples (green for RGB(A), the only one for grayscale)
+    int width, height, channels;
+    stbi_us* data = stbi_load_16(path.c_str(), &width, &height, &channels, 0);
+    if (!data)
+    {
+        std::cout << "Failed to load heightmap " << path << std::endl;
+        return false;
+    }
+
+    int channel = channels > 1 ? 1 : 0;
+    source.decoded.resize((size_t)width * height);
+    for (size_t i = 0; i < source.decoded.size(); ++i)
+        source.decoded[i] = data[i * channels + channel];
+    stbi_image_free(data);
+
+    source.width = width;
+    source.height = height;
+    source.texels = source.decoded.data();
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " input.(png|r16) output.thm [--size WxH] [--tile N] [--border N] [--scale S] [--offset O]" << std::endl;
+        return 0;
+    }
+
+    std::string inputPath = argv[1];
+    std::string outputPath = argv[2];
+    int rawWidth = 0, rawHeight = 0;
+
+    TiledHeightmapHeader header = {};
+    std::memcpy(header.magic, "THM1", 4);
+    header.version = TiledHeightmap::VERSION;
+    header.tileSize = 256;
+    header.border = 1;
+    header.heightScale = 64.0f;
+    header.heightOffset = -16.0f;
+
+    // every option takes a value
+    for (int i = 3; i < argc; i += 2)
+    {
+        if (i + 1 == argc)
+        {
+            std::cout << "Missing value for argument: " << argv[i] << std::endl;
+            return -1;
+        }
+
+        if (std::strcmp(argv[i], "--size") == 0)
+            std::sscanf(argv[i + 1], "%dx%d", &rawWidth, &rawHeight);
+        else if (std::strcmp(argv[i], "--tile") == 0)
+            header.tileSize = (uint32_t)std::max(16, std::atoi(argv[i + 1]));
+        else if (std::strcmp(argv[i], "--border") == 0)
+            header.border = (uint32_t)std::max(0, std::atoi(argv[i + 1]));
+        else if (std::strcmp(argv[i], "--scale") == 0)
+            header.heightScale = (float)std::atof(argv[i + 1]);
+        else if (std::strcmp(argv[i], "--offset") == 0)
+            header.heightOffset = (float)std::atof(argv[i + 1]);
+        else
+        {
+            std::cout << "Unknown argument: " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    // load the level 0 source
+    // -----------------------
+    SourceImage source;
+    if (!loadSource(inputPath, rawWidth, rawHeight, source))
+        return -1;
+
+    header.width = (uint32_t)source.width;
+    header.height = (uint32_t)source.height;
+
+    std::vector<TiledHeightmapLevel> levels;
+    uint64_t fileSize = TiledHeightmap::computeLayout(header, levels);
+
+    MappedFile output;
+    if (!output.create(outputPath, fileSize))
+        return -1;
+
+    unsigned char* data = output.getData();
+    std::memcpy(data, &header, sizeof(header));
+    std::memcpy(data + sizeof(header), levels.data(), levels.size() * sizeof(TiledHeightmapLevel));
+
+    std::cout << "Tiling " << source.width << " x " << source.height << " into " << levels.size() << " levels of "
+        << header.tileSize << " texel tiles (" << (fileSize >> 20) << " MB)" << std::endl;
+
+    // write every level, tile rows in parallel; level l + 1 is a 2x2 box filter of level l as already written
+    // ---------------------------------------------------------------------------------------------------------
+    int border = (int)header.border, tileSize = (int)header.tileSize;
+    int stride = tileSize + 2 * border;
+
+    for (size_t l = 0; l < levels.size(); ++l)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        const TiledHeightmapLevel& level = levels[l];
+        const TiledHeightmapLevel* previous = l > 0 ? &levels[l - 1] : nullptr;
+
+        auto previousTexel = [&](int x, int y) -> uint32_t {
+            return *(const uint16_t*)(data + TiledHeightmap::getTexelOffset(header, *previous, x, y));
+        };
+
+        parallelFor(0, (int)level.tilesY, [&](int rowBegin, int rowEnd) {
+            for (int ty = rowBegin; ty < rowEnd; ++ty)
+            {
+                for (int tx = 0; tx < (int)level.tilesX; ++tx)
+                {
+                    uint16_t* tile = (uint16_t*)(data + level.offset + ((uint64_t)ty * level.tilesX + tx) * TiledHeightmap::getTileBytes(header));
+
+                    for (int y = 0; y < stride; ++y)
+                    {
+                        // border texels are clamped to the level edge
+                        int sy = std::max(0, std::min(ty * tileSize + y - border, (int)level.height - 1));
+                        for (int x = 0; x < stride; ++x)
+                        {
+                            int sx = std::max(0, std::min(tx * tileSize + x - border, (int)level.width - 1));
+
+                            if (!previous)
+                                tile[y * stride + x] = source.texel(sx, sy);
+                            else
+                                tile[y * stride + x] = (uint16_t)((previousTexel(2 * sx, 2 * sy) + previousTexel(2 * sx + 1, 2 * sy)
+                                    + previousTexel(2 * sx, 2 * sy + 1) + previousTexel(2 * sx + 1, 2 * sy + 1) + 2) / 4);
+                        }
+                    }
+                }
+            }
+        });
+
+        std::cout << "  level " << l << ": " << level.width << " x " << level.height << ", " << level.tilesX * level.tilesY << " tiles in "
+            << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms" << std::endl;
+    }
+
+    output.close();
+    std::cout << "Wrote " << outputPath << std::endl;
+    return 0;
+}
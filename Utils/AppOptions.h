@@ -0,0 +1,215 @@
+#ifndef APPOPTIONS_H
+#define APPOPTIONS_H
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+
+// command line options
+struct AppOptions {
+	// headless benchmark run
+	bool benchmark = false;
+	int benchmarkFrames = 600;
+	int benchmarkWarmupFrames = 30;
+	std::string benchmarkOutput = "benchmark.json";
+	std::string cameraPathFile;			// recorded path, procedural flyover when empty
+
+	// reflection / refraction refresh, both 0 renders them every frame
+	int waterRefreshFrames = 0;			// refresh every N frames
+	float waterRefreshDistance = 0.0f;	// refresh once the camera moved this far (or turned)
+	bool waterCulling = true;			// skip the water passes while the water is off screen or occluded
+
+	// linked shader programs are cached here, empty disables the cache
+	std::string shaderCacheDirectory = "shader_cache";
+
+	// dynamic resolution target, 0 keeps the full resolution
+	float targetFrameMs = 0.0f;
+
+	// heightmap: 8/16 bit images, raw 16 bit (.r16, .raw) or float (.r32) files
+	std::string heightmapFile = "iceland_heightmap.png";
+	int heightmapWidth = 0;				// size of raw files, square when 0
+	int heightmapHeight = 0;
+	float heightScale = 64.0f;			// Height = value * heightScale + heightOffset, value normalized unless float
+	float heightOffset = -16.0f;
+
+	// procedural heightmap generated from the seed instead of the file, 0 x 0 loads the file
+	int proceduralWidth = 0;
+	int proceduralHeight = 0;
+	uint32_t seed = 1;
+
+	// terrain material layers, the built in height bands when empty
+	std::string materialsFile;
+
+	// GPU occlusion culling of the main pass patches against the previous frame's depth
+	bool occlusionCulling = true;
+
+	// per pass timings and the trace recording from the start (P toggles them, T writes the trace)
+	bool profile = false;
+	bool tessHistogram = false;			// capture the TCS levels of the main pass patches while timing
+
+	// fixed camera simulation steps per second, interpolated by the render loop
+	float simulationRate = 120.0f;
+
+	// screen space error tessellation: pixels per triangle edge, adjusted to hold the triangle budget when one is given
+	float pixelsPerEdge = 8.0f;
+	long long triangleBudget = 0;
+	float flatDeviation = 1.0f;			// patch deviation from its corner surface that still gets full detail, 0 disables
+
+	// CDLOD terrain (instanced grids selected on the CPU) instead of the tessellation shaders
+	bool cdlod = false;
+	float cdlodRange = 150.0f;			// farthest camera distance of the finest level, doubling per level
+
+	// geometry clipmap terrain (camera centred grids with toroidally updated height textures), 0 levels covers the map
+	bool clipmap = false;
+	int clipmapLevels = 0;
+
+	// patches per side of the terrain grid (8 to 512)
+	int patchGridRez = 20;
+
+	// tiled heightmap streamed through the GPU tile cache instead of the PNG heightmap
+	std::string tiledHeightmapFile;
+	int tileCacheSlots = 256;
+};
+
+// the finest level range has to exceed the diagonal of a level 0 node (32 units) for the selection to stay continuous
+static const float CDLOD_MIN_RANGE = 64.0f;
+
+inline void printUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		<< "  --benchmark                 run headless along a camera path and report timings as JSON\n"
+		<< "  --frames N                  number of measured benchmark frames (default 600)\n"
+		<< "  --warmup N                  number of warm-up frames excluded from the report (default 30)\n"
+		<< "  --output FILE               benchmark report file (default benchmark.json)\n"
+		<< "  --camera-path FILE          recorded camera path to fly instead of the procedural flyover\n"
+		<< "  --water-refresh-frames N    re-render reflection and refraction only every N frames\n"
+		<< "  --water-refresh-distance D  re-render them only after the camera moved D units or turned\n"
+		<< "  --no-water-culling          render reflection and refraction even when no water is visible\n"
+		<< "  --shader-cache DIR          directory of the shader program binary cache (default shader_cache)\n"
+		<< "  --no-shader-cache           always compile the shaders\n"
+		<< "  --target-frame-ms MS        scale the render resolution to hold this GPU frame time (e.g. 16.6)\n"
+		<< "  --heightmap FILE            heightmap image (8 or 16 bit) or raw .r16 / .r32 file\n"
+		<< "  --heightmap-size WxH        size of a raw heightmap that is not square\n"
+		<< "  --height-scale S            height of the full heightmap range (default 64)\n"
+		<< "  --height-offset O           height of the heightmap value 0 (default -16)\n"
+		<< "  --procedural WxH            generate the heightmap from the seed instead, up to 16384x16384 (N for NxN)\n"
+		<< "  --seed N                    seed of the procedural heightmap (default 1)\n"
+		<< "  --materials FILE            terrain material layers (texture, height and slope ranges)\n"
+		<< "  --no-occlusion-culling      draw every frustum visible patch in the main pass\n"
+		<< "  --profile                   time the render passes and record a trace from the start\n"
+		<< "  --tess-histogram            histogram of the main pass tessellation levels while profiling\n"
+		<< "  --sim-rate HZ               camera simulation steps per second, 30 to 1000 (default 120)\n"
+		<< "  --edge-pixels PX            target triangle edge length in pixels, 1 to 64 (default 8)\n"
+		<< "  --triangle-budget N         adjust the edge length to keep the terrain passes below N triangles\n"
+		<< "  --flat-deviation H          tessellate patches flatter than H height units less (default 1, 0 disables)\n"
+		<< "  --cdlod                     render the terrain as CDLOD grids without tessellation shaders\n"
+		<< "  --cdlod-range D             camera distance covered by the finest CDLOD level (default 150)\n"
+		<< "  --clipmap                   render the terrain as geometry clipmap levels around the camera\n"
+		<< "  --clipmap-levels N          number of clipmap levels, 1 to 12 (default: enough to cover the map)\n"
+		<< "  --rez N                     patches per side of the terrain grid, 8 to 512 (default 20)\n"
+		<< "  --tiled-heightmap FILE      stream a .thm heightmap written by HeightmapTiler\n"
+		<< "  --tile-cache N              GPU tile cache size in tiles (default 256)\n"
+		<< "  --help                      show this message\n";
+}
+
+// returns false when the program should exit (help requested or invalid arguments)
+inline bool parseArguments(int argc, char** argv, AppOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (std::strcmp(arg, "--benchmark") == 0)
+			options.benchmark = true;
+		else if (std::strcmp(arg, "--frames") == 0 && hasValue)
+			options.benchmarkFrames = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--warmup") == 0 && hasValue)
+			options.benchmarkWarmupFrames = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--output") == 0 && hasValue)
+			options.benchmarkOutput = argv[++i];
+		else if (std::strcmp(arg, "--camera-path") == 0 && hasValue)
+			options.cameraPathFile = argv[++i];
+		else if (std::strcmp(arg, "--water-refresh-frames") == 0 && hasValue)
+			options.waterRefreshFrames = std::max(0, std::atoi(argv[++i]));
+		else if (std::strcmp(arg, "--water-refresh-distance") == 0 && hasValue)
+			options.waterRefreshDistance = std::max(0.0f, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--no-water-culling") == 0)
+			options.waterCulling = false;
+		else if (std::strcmp(arg, "--shader-cache") == 0 && hasValue)
+			options.shaderCacheDirectory = argv[++i];
+		else if (std::strcmp(arg, "--no-shader-cache") == 0)
+			options.shaderCacheDirectory.clear();
+		else if (std::strcmp(arg, "--target-frame-ms") == 0 && hasValue)
+			options.targetFrameMs = std::max(0.0f, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--heightmap") == 0 && hasValue)
+			options.heightmapFile = argv[++i];
+		else if (std::strcmp(arg, "--heightmap-size") == 0 && hasValue)
+			std::sscanf(argv[++i], "%dx%d", &options.heightmapWidth, &options.heightmapHeight);
+		else if (std::strcmp(arg, "--height-scale") == 0 && hasValue)
+			options.heightScale = (float)std::atof(argv[++i]);
+		else if (std::strcmp(arg, "--height-offset") == 0 && hasValue)
+			options.heightOffset = (float)std::atof(argv[++i]);
+		else if (std::strcmp(arg, "--procedural") == 0 && hasValue)
+		{
+			int width = 0, height = 0;
+			int values = std::sscanf(argv[++i], "%dx%d", &width, &height);
+			if (values >= 1)
+			{
+				options.proceduralWidth = std::max(64, std::min(width, 16384));
+				options.proceduralHeight = std::max(64, std::min(values == 2 ? height : width, 16384));
+			}
+		}
+		else if (std::strcmp(arg, "--seed") == 0 && hasValue)
+			options.seed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		else if (std::strcmp(arg, "--materials") == 0 && hasValue)
+			options.materialsFile = argv[++i];
+		else if (std::strcmp(arg, "--no-occlusion-culling") == 0)
+			options.occlusionCulling = false;
+		else if (std::strcmp(arg, "--profile") == 0)
+			options.profile = true;
+		else if (std::strcmp(arg, "--tess-histogram") == 0)
+			options.tessHistogram = true;
+		else if (std::strcmp(arg, "--sim-rate") == 0 && hasValue)
+			options.simulationRate = std::max(30.0f, std::min((float)std::atof(argv[++i]), 1000.0f));
+		else if (std::strcmp(arg, "--edge-pixels") == 0 && hasValue)
+			options.pixelsPerEdge = std::max(1.0f, std::min((float)std::atof(argv[++i]), 64.0f));
+		else if (std::strcmp(arg, "--triangle-budget") == 0 && hasValue)
+			options.triangleBudget = std::max(0LL, std::atoll(argv[++i]));
+		else if (std::strcmp(arg, "--flat-deviation") == 0 && hasValue)
+			options.flatDeviation = std::max(0.0f, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--cdlod") == 0)
+			options.cdlod = true;
+		else if (std::strcmp(arg, "--cdlod-range") == 0 && hasValue)
+			options.cdlodRange = std::max(CDLOD_MIN_RANGE, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--clipmap") == 0)
+			options.clipmap = true;
+		else if (std::strcmp(arg, "--clipmap-levels") == 0 && hasValue)
+			options.clipmapLevels = std::max(1, std::min(std::atoi(argv[++i]), 12));
+		else if (std::strcmp(arg, "--rez") == 0 && hasValue)
+			options.patchGridRez = std::max(8, std::min(std::atoi(argv[++i]), 512));
+		else if (std::strcmp(arg, "--tiled-heightmap") == 0 && hasValue)
+			options.tiledHeightmapFile = argv[++i];
+		else if (std::strcmp(arg, "--tile-cache") == 0 && hasValue)
+			options.tileCacheSlots = std::max(16, std::atoi(argv[++i]));
+		else if (std::strcmp(arg, "--help") == 0)
+		{
+			printUsage(argv[0]);
+			return false;
+		}
+		else
+		{
+			std::cout << "Unknown or incomplete argument: " << arg << std::endl;
+			printUsage(argv[0]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#endif	// APPOPTIONS_H
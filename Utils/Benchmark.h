@@ -0,0 +1,191 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <Camera.h>
+#include <CameraPath.h>
+#include <PassTimer.h>
+#include <TessellationStats.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// Scripted benchmark run: flies the camera along a path for a fixed number of frames after a short warm-up,
+// then reports frame time percentiles, per pass CPU / GPU timings and the tessellation statistics as JSON
+class Benchmark {
+public:
+	// fixed simulation step so every run renders exactly the same frames
+	static constexpr float FRAME_STEP = 1.0f / 60.0f;
+
+	Benchmark() {}
+
+	void initialize(const CameraPath& cameraPath, int measuredFrames, int warmupFrameCount)
+	{
+		path = cameraPath;
+		frameCount = std::max(1, measuredFrames);
+		warmupFrames = std::max(0, warmupFrameCount);
+		frame = 0;
+		frameTimes.clear();
+		frameTimes.reserve(frameCount);
+	}
+
+	// the terrain the run measured, reported with a checksum so runs on different machines can be matched
+	void setHeightmap(const std::string& source, uint64_t checksum)
+	{
+		heightmapSource = source;
+		heightmapChecksum = checksum;
+	}
+
+	bool isRunning() const
+	{
+		return frame < warmupFrames + frameCount;
+	}
+
+	bool isMeasuring() const
+	{
+		return frame >= warmupFrames;
+	}
+
+	// places the camera for the current frame and returns the time step to simulate
+	float beginFrame(Camera& camera)
+	{
+		int measuredFrame = std::max(0, frame - warmupFrames);
+		path.apply(path.getDuration() * measuredFrame / (float)frameCount, camera);
+
+		frameStart = std::chrono::high_resolution_clock::now();
+		return FRAME_STEP;
+	}
+
+	// waits for the GPU so the frame time covers the whole frame, then advances
+	void endFrame(PassTimer& passTimer, TessellationStats& tessellationStats)
+	{
+		glFinish();
+		double frameMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+
+		if (isMeasuring())
+			frameTimes.push_back(frameMs);
+
+		++frame;
+
+		// drop everything recorded during the warm-up
+		if (frame == warmupFrames)
+		{
+			passTimer.flush();
+			passTimer.clearSamples();
+			tessellationStats.flush();
+			tessellationStats.clearSamples();
+		}
+	}
+
+	std::string buildReport(const PassTimer& passTimer, const TessellationStats& tessellationStats, int width, int height, int patchGridRez) const
+	{
+		std::ostringstream json;
+		json.setf(std::ios::fixed);
+		json.precision(4);
+
+		json << "{\n";
+		json << "  \"renderer\": \"" << glString(GL_RENDERER) << "\",\n";
+		json << "  \"version\": \"" << glString(GL_VERSION) << "\",\n";
+		json << "  \"width\": " << width << ",\n";
+		json << "  \"height\": " << height << ",\n";
+		json << "  \"patch_grid\": " << patchGridRez << ",\n";
+		json << "  \"heightmap\": \"" << heightmapSource << "\",\n";
+		json << "  \"heightmap_checksum\": \"" << std::hex << std::setw(16) << std::setfill('0') << heightmapChecksum << std::dec << std::setfill(' ') << "\",\n";
+		json << "  \"frames\": " << frameTimes.size() << ",\n";
+		json << "  \"warmup_frames\": " << warmupFrames << ",\n";
+		json << "  \"frame_ms\": " << statistics(frameTimes) << ",\n";
+		json << "  \"passes\": {\n";
+		for (int p = 0; p < PASS_COUNT; ++p)
+		{
+			json << "    \"" << RENDER_PASS_NAMES[p] << "\": { \"cpu_ms\": " << statistics(passTimer.getCpuSamples((RenderPass)p))
+				<< ", \"gpu_ms\": " << statistics(passTimer.getGpuSamples((RenderPass)p)) << " }" << (p + 1 < PASS_COUNT ? "," : "") << "\n";
+		}
+		json << "  },\n";
+		json << "  \"tessellation\": {\n";
+		json << tessellationStats.buildJson(statistics, "    ");
+		json << "  }\n";
+		json << "}\n";
+
+		return json.str();
+	}
+
+	void writeReport(const std::string& report, const std::string& outputPath) const
+	{
+		std::cout << report;
+
+		if (outputPath.empty())
+			return;
+
+		std::ofstream file(outputPath);
+		if (file)
+		{
+			file << report;
+			std::cout << "Benchmark report written to " << outputPath << std::endl;
+		}
+		else
+			std::cout << "Failed to write benchmark report to " << outputPath << std::endl;
+	}
+
+private:
+	CameraPath path;
+	std::string heightmapSource;
+	uint64_t heightmapChecksum = 0;
+	int frameCount = 0;
+	int warmupFrames = 0;
+	int frame = 0;
+
+	std::chrono::high_resolution_clock::time_point frameStart;
+	std::vector<double> frameTimes;
+
+	static std::string glString(GLenum name)
+	{
+		const GLubyte* value = glGetString(name);
+		std::string result = value ? (const char*)value : "unknown";
+		// keep the JSON valid
+		std::replace(result.begin(), result.end(), '"', '\'');
+		std::replace(result.begin(), result.end(), '\\', '/');
+		return result;
+	}
+
+	// nearest rank percentile of a sorted sample set
+	static double percentile(const std::vector<double>& sorted, double p)
+	{
+		if (sorted.empty())
+			return 0.0;
+		size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	static std::string statistics(const std::vector<double>& samples)
+	{
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+
+		double mean = 0.0;
+		for (size_t i = 0; i < sorted.size(); ++i)
+			mean += sorted[i];
+		if (!sorted.empty())
+			mean /= sorted.size();
+
+		std::ostringstream json;
+		json.setf(std::ios::fixed);
+		json.precision(4);
+		json << "{ \"mean\": " << mean
+			<< ", \"p50\": " << percentile(sorted, 50.0)
+			<< ", \"p95\": " << percentile(sorted, 95.0)
+			<< ", \"p99\": " << percentile(sorted, 99.0)
+			<< ", \"min\": " << (sorted.empty() ? 0.0 : sorted.front())
+			<< ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " }";
+		return json.str();
+	}
+};
+
+#endif	// BENCHMARK_H
@@ -0,0 +1,187 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+#include <glm/glm.hpp>
+
+#include <Camera.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cmath>
+
+// Timed camera keyframes (position + euler angles) sampled with Catmull-Rom interpolation.
+// Paths are either recorded from the interactive camera or generated procedurally, and are
+// stored as plain text, one "time x y z yaw pitch" keyframe per line.
+class CameraPath {
+public:
+	struct Keyframe {
+		float time;
+		glm::vec3 position;
+		float yaw;
+		float pitch;
+	};
+
+	CameraPath() {}
+
+	void clear()
+	{
+		keyframes.clear();
+	}
+
+	bool isEmpty() const
+	{
+		return keyframes.empty();
+	}
+
+	float getDuration() const
+	{
+		return keyframes.empty() ? 0.0f : keyframes.back().time;
+	}
+
+	void addKeyframe(float time, const glm::vec3& position, float yaw, float pitch)
+	{
+		Keyframe keyframe;
+		keyframe.time = time;
+		keyframe.position = position;
+		keyframe.yaw = yaw;
+		keyframe.pitch = pitch;
+		keyframes.push_back(keyframe);
+	}
+
+	// closed flight around a width x height map centred at the origin, alternating low and high passes
+	void buildFlyover(float width, float height, int keyframeCount = 64, float duration = 60.0f)
+	{
+		clear();
+
+		const float PI = 3.14159265f;
+		for (int k = 0; k <= keyframeCount; ++k)
+		{
+			float t = k / (float)keyframeCount;
+			float angle = 2.0f * PI * t;
+
+			glm::vec3 position(0.35f * width * std::cos(angle),
+				180.0f + 120.0f * std::sin(3.0f * angle),
+				0.35f * height * std::sin(angle));
+
+			// look along the direction of travel, slightly down
+			glm::vec3 tangent(-0.35f * width * std::sin(angle), 0.0f, 0.35f * height * std::cos(angle));
+			float yaw = glm::degrees(std::atan2(tangent.z, tangent.x));
+			float pitch = -20.0f + 10.0f * std::sin(2.0f * angle);
+
+			// keep yaw continuous so interpolation never spins the long way round
+			if (!keyframes.empty())
+			{
+				while (yaw - keyframes.back().yaw > 180.0f)
+					yaw -= 360.0f;
+				while (yaw - keyframes.back().yaw < -180.0f)
+					yaw += 360.0f;
+			}
+
+			addKeyframe(t * duration, position, yaw, pitch);
+		}
+	}
+
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "Failed to open camera path " << path << std::endl;
+			return false;
+		}
+
+		clear();
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			std::istringstream stream(line);
+			Keyframe keyframe;
+			if (stream >> keyframe.time >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.yaw >> keyframe.pitch)
+				keyframes.push_back(keyframe);
+		}
+
+		std::cout << "Loaded camera path " << path << " with " << keyframes.size() << " keyframes" << std::endl;
+		return !keyframes.empty();
+	}
+
+	bool save(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			std::cout << "Failed to write camera path " << path << std::endl;
+			return false;
+		}
+
+		file << "# time x y z yaw pitch\n";
+		for (size_t k = 0; k < keyframes.size(); ++k)
+		{
+			const Keyframe& keyframe = keyframes[k];
+			file << keyframe.time << " " << keyframe.position.x << " " << keyframe.position.y << " " << keyframe.position.z
+				<< " " << keyframe.yaw << " " << keyframe.pitch << "\n";
+		}
+
+		std::cout << "Saved camera path " << path << " with " << keyframes.size() << " keyframes" << std::endl;
+		return true;
+	}
+
+	// moves the camera to the interpolated keyframe at the given time
+	void apply(float time, Camera& camera) const
+	{
+		if (keyframes.empty())
+			return;
+
+		size_t next = 0;
+		while (next < keyframes.size() && keyframes[next].time < time)
+			++next;
+
+		if (next == 0 || next == keyframes.size())
+		{
+			const Keyframe& keyframe = next == 0 ? keyframes.front() : keyframes.back();
+			setCamera(camera, keyframe.position, keyframe.yaw, keyframe.pitch);
+			return;
+		}
+
+		const Keyframe& k1 = keyframes[next - 1];
+		const Keyframe& k2 = keyframes[next];
+		const Keyframe& k0 = keyframes[next >= 2 ? next - 2 : next - 1];
+		const Keyframe& k3 = keyframes[next + 1 < keyframes.size() ? next + 1 : next];
+
+		float span = k2.time - k1.time;
+		float t = span > 0.0f ? (time - k1.time) / span : 0.0f;
+
+		glm::vec3 position(catmullRom(k0.position.x, k1.position.x, k2.position.x, k3.position.x, t),
+			catmullRom(k0.position.y, k1.position.y, k2.position.y, k3.position.y, t),
+			catmullRom(k0.position.z, k1.position.z, k2.position.z, k3.position.z, t));
+		float yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, t);
+		float pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+
+		setCamera(camera, position, yaw, pitch);
+	}
+
+private:
+	std::vector<Keyframe> keyframes;
+
+	static float catmullRom(float p0, float p1, float p2, float p3, float t)
+	{
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+	}
+
+	static void setCamera(Camera& camera, const glm::vec3& position, float yaw, float pitch)
+	{
+		camera.Position = position;
+		camera.Yaw = yaw;
+		camera.Pitch = pitch;
+		camera.updateCameraVectors();
+	}
+};
+
+#endif	// CAMERAPATH_H
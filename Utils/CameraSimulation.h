@@ -0,0 +1,213 @@
+#ifndef CAMERASIMULATION_H
+#define CAMERASIMULATION_H
+
+#include <Camera.h>
+#include <TripleBuffer.h>
+#include <Profiler.h>
+
+#include <glm/glm.hpp>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+// camera state published by the simulation, everything the renderer reads from the camera
+struct CameraSnapshot {
+	glm::vec3 position = glm::vec3(0.0f);
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	float zoom = 45.0f;
+};
+
+// Moves the interactive camera on its own thread at a fixed timestep, independent of the render frame time.
+// The GLFW thread only forwards the input (held movement keys, accumulated mouse and scroll offsets) through atomics;
+// every step publishes the camera before and after the step, stamped with the step time, through a TripleBuffer.
+// The render thread interpolates between the two, so it sees motion at most one step behind the simulation and
+// never waits for it.
+class CameraSimulation {
+public:
+	enum MovementKey {
+		KEY_FORWARD = 1,
+		KEY_BACKWARD = 2,
+		KEY_LEFT = 4,
+		KEY_RIGHT = 8
+	};
+
+	CameraSimulation() {}
+
+	~CameraSimulation()
+	{
+		stop();
+	}
+
+	// groundHeight(x, z) returns the lowest allowed camera height, the camera is kept above it
+	void start(const Camera& camera, std::function<float(float, float)> groundHeight, float stepsPerSecond = 120.0f)
+	{
+		stop();
+
+		simulated = camera;
+		ground = groundHeight;
+		stepRate = stepsPerSecond;
+		step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / stepRate));
+
+		// the first frame is there before the thread runs, sample() always has a valid one
+		Frame& frame = frames.writeSlot();
+		frame.previous = frame.current = snapshot(simulated);
+		frame.time = std::chrono::steady_clock::now();
+		frames.publish();
+		frames.update();
+		latest = frames.readSlot();
+
+		stopRequested.store(false);
+		worker = std::thread(&CameraSimulation::run, this);
+	}
+
+	void stop()
+	{
+		if (!worker.joinable())
+			return;
+
+		stopRequested.store(true);
+		worker.join();
+	}
+
+	bool isRunning() const
+	{
+		return worker.joinable();
+	}
+
+	// input side, called from the GLFW thread
+	// -----------------------------------------
+	void setMovementKeys(unsigned int keys)
+	{
+		movementKeys.store(keys, std::memory_order_relaxed);
+	}
+
+	void addMouseMovement(float xoffset, float yoffset)
+	{
+		add(mouseX, xoffset);
+		add(mouseY, yoffset);
+	}
+
+	void addScroll(float yoffset)
+	{
+		add(scroll, yoffset);
+	}
+
+	// render side: writes the camera state interpolated to the current time into camera
+	// ---------------------------------------------------------------------------------
+	void sample(Camera& camera)
+	{
+		if (frames.update())
+			latest = frames.readSlot();
+
+		// the newest step is reached one step after its time stamp
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - latest.time).count();
+		float alpha = (float)std::max(0.0, std::min(elapsed * stepRate, 1.0));
+
+		camera.Position = glm::mix(latest.previous.position, latest.current.position, alpha);
+		camera.Yaw = latest.previous.yaw + (latest.current.yaw - latest.previous.yaw) * alpha;
+		camera.Pitch = latest.previous.pitch + (latest.current.pitch - latest.previous.pitch) * alpha;
+		camera.Zoom = latest.previous.zoom + (latest.current.zoom - latest.previous.zoom) * alpha;
+		camera.updateCameraVectors();
+	}
+
+private:
+	struct Frame {
+		CameraSnapshot previous;
+		CameraSnapshot current;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	// steps further behind than this are dropped instead of caught up, e.g. after a breakpoint
+	static const int MAX_CATCH_UP_STEPS = 8;
+
+	Camera simulated;					// simulation thread only
+	std::function<float(float, float)> ground;
+	float stepRate = 120.0f;
+	std::chrono::steady_clock::duration step;
+
+	TripleBuffer<Frame> frames;
+	Frame latest;						// render thread only
+
+	std::atomic<unsigned int> movementKeys{ 0 };
+	std::atomic<float> mouseX{ 0.0f };
+	std::atomic<float> mouseY{ 0.0f };
+	std::atomic<float> scroll{ 0.0f };
+
+	std::thread worker;
+	std::atomic<bool> stopRequested{ false };
+
+	static CameraSnapshot snapshot(const Camera& camera)
+	{
+		CameraSnapshot state;
+		state.position = camera.Position;
+		state.yaw = camera.Yaw;
+		state.pitch = camera.Pitch;
+		state.zoom = camera.Zoom;
+		return state;
+	}
+
+	static void add(std::atomic<float>& value, float offset)
+	{
+		float expected = value.load(std::memory_order_relaxed);
+		while (!value.compare_exchange_weak(expected, expected + offset, std::memory_order_relaxed))
+			;
+	}
+
+	void run()
+	{
+		float deltaTime = 1.0f / stepRate;
+		std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+		while (!stopRequested.load())
+		{
+			CameraSnapshot before = snapshot(simulated);
+			advance(deltaTime);
+
+			Frame& frame = frames.writeSlot();
+			frame.previous = before;
+			frame.current = snapshot(simulated);
+			frame.time = next;
+			frames.publish();
+
+			// late wake-ups run the missed steps back to back, the time stamps stay on the fixed grid
+			next += step;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now - next > step * MAX_CATCH_UP_STEPS)
+				next = now;
+			std::this_thread::sleep_until(next);
+		}
+	}
+
+	void advance(float deltaTime)
+	{
+		PROFILE_SCOPE("camera step");
+
+		unsigned int keys = movementKeys.load(std::memory_order_relaxed);
+		if (keys & KEY_FORWARD)
+			simulated.ProcessKeyboard(FORWARD, deltaTime);
+		if (keys & KEY_BACKWARD)
+			simulated.ProcessKeyboard(BACKWARD, deltaTime);
+		if (keys & KEY_LEFT)
+			simulated.ProcessKeyboard(LEFT, deltaTime);
+		if (keys & KEY_RIGHT)
+			simulated.ProcessKeyboard(RIGHT, deltaTime);
+
+		float xoffset = mouseX.exchange(0.0f), yoffset = mouseY.exchange(0.0f);
+		if (xoffset != 0.0f || yoffset != 0.0f)
+			simulated.ProcessMouseMovement(xoffset, yoffset);
+
+		float scrollOffset = scroll.exchange(0.0f);
+		if (scrollOffset != 0.0f)
+			simulated.ProcessMouseScroll(scrollOffset);
+
+		// keep the camera above the terrain surface
+		if (ground)
+			simulated.Position.y = std::max(simulated.Position.y, ground(simulated.Position.x, simulated.Position.z));
+	}
+};
+
+#endif	// CAMERASIMULATION_H
@@ -0,0 +1,310 @@
+#ifndef CDLODTERRAIN_H
+#define CDLODTERRAIN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Shader.h>
+#include <Frustum.h>
+#include <HeightPyramid.h>
+#include <ParallelFor.h>
+#include <TerrainQuadtree.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// quadrants selected for one pass: world corner (x, z), world size and LOD level, one instance each
+struct CdlodDrawList {
+	std::vector<glm::vec4> quadrants;
+
+	void clear()
+	{
+		quadrants.clear();
+	}
+};
+
+// Continuous distance dependent LOD (Strugar's CDLOD) for GPUs without usable tessellation: a quadtree over the map
+// whose level L nodes are LEAF_SIZE * 2^L world units wide and always drawn as a GRID_QUADS x GRID_QUADS grid, so the
+// vertex spacing doubles with every level. Every frame the nodes are selected on the CPU by distance (level L covers
+// the camera distances up to lodRange * 2^L) and frustum, and drawn as instances of one quadrant mesh: a node drawn
+// whole is four quadrants, a node whose children are partly in the finer range draws only the other quadrants.
+// CDLOD.vert displaces the grid with the same heightmap as the TES and morphs each level into the next coarser
+// grid towards the end of its range, so level changes never pop. Node heights come from the min/max pyramid.
+class CdlodTerrain {
+public:
+	static const int GRID_QUADS = 32;			// per node side
+	static const int QUADRANT_QUADS = GRID_QUADS / 2;
+	static constexpr float LEAF_SIZE = 32.0f;	// one world unit (heightmap texel) per level 0 quad
+	static const int MAX_LEVELS = 16;			// size of morphRanges in CDLOD.vert
+
+	// the part of every level's range over which it morphs into the next level
+	static constexpr float MORPH_START = 0.66f;
+
+	CdlodTerrain() {}
+
+	~CdlodTerrain()
+	{
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ebo);
+			glDeleteBuffers(1, &instanceBuffer);
+		}
+	}
+
+	void build(int width, int height, const HeightPyramid& pyramid, float lodRange)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		mapMin = glm::vec2(-width / 2.0f, -height / 2.0f);
+		mapMax = glm::vec2(width / 2.0f, height / 2.0f);
+
+		// enough levels for a single root node to cover the map
+		levelCount = 1;
+		while (levelCount < MAX_LEVELS && LEAF_SIZE * (float)(1 << (levelCount - 1)) < (float)std::max(width, height))
+			++levelCount;
+
+		// the top level covers any distance and never morphs
+		ranges.resize(levelCount);
+		for (int l = 0; l < levelCount; ++l)
+			ranges[l] = l + 1 < levelCount ? lodRange * (float)(1 << l) : 1.0e30f;
+
+		levels.resize(levelCount);
+		for (int l = 0; l < levelCount; ++l)
+		{
+			Level& level = levels[l];
+			level.size = LEAF_SIZE * (float)(1 << l);
+			level.nodesX = std::max(1, (int)std::ceil(width / level.size));
+			level.nodesZ = std::max(1, (int)std::ceil(height / level.size));
+			level.minHeight.resize((size_t)level.nodesX * level.nodesZ);
+			level.maxHeight.resize((size_t)level.nodesX * level.nodesZ);
+
+			// node rectangle in pyramid texels, one texel of border for the bilinear filter
+			float texelsX = (float)pyramid.getSourceWidth() / width, texelsZ = (float)pyramid.getSourceHeight() / height;
+			Level* target = &level;
+			const HeightPyramid* heights = &pyramid;
+			parallelFor(0, level.nodesZ, [=](int rowBegin, int rowEnd) {
+				for (int z = rowBegin; z < rowEnd; ++z)
+				{
+					for (int x = 0; x < target->nodesX; ++x)
+					{
+						int x0 = (int)std::floor(x * target->size * texelsX), x1 = (int)std::ceil((x + 1) * target->size * texelsX);
+						int y0 = (int)std::floor(z * target->size * texelsZ), y1 = (int)std::ceil((z + 1) * target->size * texelsZ);
+						size_t index = (size_t)z * target->nodesX + x;
+						heights->queryHeights(x0 - 1, y0 - 1, x1, y1, target->minHeight[index], target->maxHeight[index]);
+					}
+				}
+			}, 8);
+		}
+
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// shared quadrant mesh and the instance buffer; attribute 0 is the grid position, 1 the quadrant
+	void createBuffers()
+	{
+		std::vector<float> vertices;
+		for (int z = 0; z <= QUADRANT_QUADS; ++z)
+		{
+			for (int x = 0; x <= QUADRANT_QUADS; ++x)
+			{
+				vertices.push_back((float)x);
+				vertices.push_back((float)z);
+			}
+		}
+
+		std::vector<GLushort> indices;
+		for (int z = 0; z < QUADRANT_QUADS; ++z)
+		{
+			for (int x = 0; x < QUADRANT_QUADS; ++x)
+			{
+				GLushort i00 = (GLushort)(z * (QUADRANT_QUADS + 1) + x), i10 = i00 + 1;
+				GLushort i01 = (GLushort)(i00 + QUADRANT_QUADS + 1), i11 = i01 + 1;
+				indices.insert(indices.end(), { i00, i01, i10, i10, i01, i11 });
+			}
+		}
+		indexCount = (GLsizei)indices.size();
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ebo);
+		glGenBuffers(1, &instanceBuffer);
+
+		glBindVertexArray(vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+		glVertexAttribDivisor(1, 1);
+		glEnableVertexAttribArray(1);
+
+		glBindVertexArray(0);
+	}
+
+	// grid constants and the per level morph ranges of CDLOD.vert
+	void setUniforms(Shader& shader) const
+	{
+		shader.use();
+		shader.setFloat("gridQuads", (float)QUADRANT_QUADS);
+		shader.setVec4("mapBounds", glm::vec4(mapMin.x, mapMin.y, mapMax.x, mapMax.y));
+
+		// one upload of the whole array; a level without a range would render fully morphed
+		std::vector<glm::vec2> morphRanges(levelCount);
+		for (int l = 0; l < levelCount; ++l)
+		{
+			float previous = l > 0 ? ranges[l - 1] : 0.0f;
+			float morphEnd = ranges[l];
+			float morphStart = previous + (morphEnd - previous) * MORPH_START;
+			morphRanges[l] = glm::vec2(morphStart, morphEnd);
+
+			if (!(morphEnd > morphStart))
+				std::cout << "WARNING::CDLOD: empty morph range for level " << l << std::endl;
+		}
+
+		if (levelCount > 0)
+			glUniform2fv(shader.getUniformLocation("morphRanges"), levelCount, &morphRanges[0].x);
+	}
+
+	// selects the quadrants for a camera position (the mirrored one for the reflection), culled against the frustum
+	// and the optional clipping plane (a zero plane disables the clip test); visible counts the drawn quadrants,
+	// culled the rejected nodes
+	PatchCullStats select(const Frustum& frustum, const glm::vec3& cameraPosition, const glm::vec4& clippingPlane, CdlodDrawList& drawList)
+	{
+		PROFILE_SCOPE("cdlod select");
+
+		drawList.clear();
+		PatchCullStats stats;
+		if (levels.empty())
+			return stats;
+
+		int top = levelCount - 1;
+		for (int z = 0; z < levels[top].nodesZ; ++z)
+			for (int x = 0; x < levels[top].nodesX; ++x)
+				selectNode(top, x, z, frustum, cameraPosition, clippingPlane, drawList, stats);
+
+		return stats;
+	}
+
+	void draw(const CdlodDrawList& drawList) const
+	{
+		if (drawList.quadrants.empty())
+			return;
+
+		// orphaned every pass, the driver hands out fresh storage instead of waiting for the previous draw
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, drawList.quadrants.size() * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, drawList.quadrants.size() * sizeof(glm::vec4), drawList.quadrants.data());
+
+		glBindVertexArray(vao);
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0, (GLsizei)drawList.quadrants.size());
+	}
+
+	int getLevelCount() const
+	{
+		return levelCount;
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+private:
+	struct Level {
+		float size = 0.0f;
+		int nodesX = 0;
+		int nodesZ = 0;
+		std::vector<float> minHeight;
+		std::vector<float> maxHeight;
+	};
+
+	std::vector<Level> levels;
+	std::vector<float> ranges;		// farthest camera distance of every level
+	int levelCount = 0;
+	glm::vec2 mapMin = glm::vec2(0.0f);
+	glm::vec2 mapMax = glm::vec2(0.0f);
+
+	GLuint vao = 0, vbo = 0, ebo = 0, instanceBuffer = 0;
+	GLsizei indexCount = 0;
+	double buildMilliseconds = 0.0;
+
+	void nodeBounds(int level, int x, int z, glm::vec3& boxMin, glm::vec3& boxMax) const
+	{
+		const Level& l = levels[level];
+		size_t index = (size_t)z * l.nodesX + x;
+		glm::vec2 corner = mapMin + glm::vec2(x, z) * l.size;
+		boxMin = glm::vec3(corner.x, l.minHeight[index], corner.y);
+		boxMax = glm::vec3(std::min(corner.x + l.size, mapMax.x), l.maxHeight[index], std::min(corner.y + l.size, mapMax.y));
+	}
+
+	static bool inRange(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& position, float range)
+	{
+		glm::vec3 nearest = glm::clamp(position, boxMin, boxMax);
+		glm::vec3 offset = nearest - position;
+		return glm::dot(offset, offset) <= range * range;
+	}
+
+	void addQuadrant(int level, int x, int z, int quadrant, CdlodDrawList& drawList, PatchCullStats& stats) const
+	{
+		float half = levels[level].size * 0.5f;
+		glm::vec2 corner = mapMin + glm::vec2(x, z) * levels[level].size + glm::vec2(quadrant & 1, quadrant >> 1) * half;
+		if (corner.x >= mapMax.x || corner.y >= mapMax.y)
+			return;
+
+		drawList.quadrants.push_back(glm::vec4(corner.x, corner.y, half, (float)level));
+		++stats.visiblePatches;
+	}
+
+	// returns false when the node is beyond its level's range, the parent then draws its area
+	bool selectNode(int level, int x, int z, const Frustum& frustum, const glm::vec3& cameraPosition, const glm::vec4& clippingPlane,
+		CdlodDrawList& drawList, PatchCullStats& stats) const
+	{
+		glm::vec3 boxMin, boxMax;
+		nodeBounds(level, x, z, boxMin, boxMax);
+
+		if (!inRange(boxMin, boxMax, cameraPosition, ranges[level]))
+			return false;
+
+		bool clipped = clippingPlane != glm::vec4(0.0f) && Frustum::testPlane(clippingPlane, boxMin, boxMax) == Frustum::OUTSIDE;
+		if (clipped || frustum.testAABB(boxMin, boxMax) == Frustum::OUTSIDE)
+		{
+			++stats.culledPatches;
+			return true;
+		}
+
+		// whole node at this level when nothing of it is within the next finer range
+		if (level == 0 || !inRange(boxMin, boxMax, cameraPosition, ranges[level - 1]))
+		{
+			for (int q = 0; q < 4; ++q)
+				addQuadrant(level, x, z, q, drawList, stats);
+			return true;
+		}
+
+		// children in the finer range select themselves, the rest are drawn as quadrants of this node
+		const Level& child = levels[level - 1];
+		for (int q = 0; q < 4; ++q)
+		{
+			int cx = x * 2 + (q & 1), cz = z * 2 + (q >> 1);
+			if (cx >= child.nodesX || cz >= child.nodesZ)
+				continue;
+			if (!selectNode(level - 1, cx, cz, frustum, cameraPosition, clippingPlane, drawList, stats))
+				addQuadrant(level, x, z, q, drawList, stats);
+		}
+		return true;
+	}
+};
+
+#endif	// CDLODTERRAIN_H
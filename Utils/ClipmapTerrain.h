@@ -0,0 +1,363 @@
+#ifndef CLIPMAPTERRAIN_H
+#define CLIPMAPTERRAIN_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Shader.h>
+#include <Heightmap.h>
+#include <ParallelFor.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// Geometry clipmap terrain (Losasso and Hoppe): nested square grids centred on the camera, level L with a sample
+// spacing of 2^L heightmap texels, every level drawn as the same GRID_QUADS x GRID_QUADS grid. Each level keeps its
+// heights in a TEXTURE_SIZE x TEXTURE_SIZE GL_R32F texture addressed toroidally (grid sample g lives at texel
+// g mod TEXTURE_SIZE), so when the camera moves only the rows and columns it reveals are written with
+// glTexSubImage2D; the per frame work stays the same whatever the extent of the map. Clipmap.vert cuts the next finer
+// level's footprint out of every level and blends each level into the next coarser one towards its border.
+// The level samples are taken at the grid vertices: level 0 averages the four texels around each vertex, coarser
+// levels filter the level below with [1 2 1] / 4 and are kept on the CPU, built in parallel at load time.
+class ClipmapTerrain {
+public:
+	static const int TEXTURE_SIZE = 256;
+	static const int GRID_QUADS = TEXTURE_SIZE - 2;		// even, one spare texel row for the toroidal wrap
+	static const int TRANSITION_WIDTH = GRID_QUADS / 10;	// samples over which a level blends into the next
+	static const int MAX_LEVELS = 12;
+
+	ClipmapTerrain() {}
+
+	~ClipmapTerrain()
+	{
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ebo);
+		}
+		for (Level& level : levels)
+			if (level.texture)
+				glDeleteTextures(1, &level.texture);
+	}
+
+	// levelCount 0 picks enough levels for the coarsest one to reach across the map from anywhere on it
+	void build(const Heightmap& heightmap, int width, int height, int levelCount)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		source = &heightmap;
+		mapMin = glm::vec2(-width / 2.0f, -height / 2.0f);
+		mapMax = glm::vec2(width / 2.0f, height / 2.0f);
+		texelSize = (float)width / std::max(1, heightmap.width);
+
+		if (levelCount <= 0)
+		{
+			levelCount = 1;
+			while (levelCount < MAX_LEVELS && GRID_QUADS / 2 * texelSize * (float)(1 << (levelCount - 1)) < (float)std::max(width, height))
+				++levelCount;
+		}
+		levels.resize(std::min(levelCount, MAX_LEVELS));
+
+		// level 0 samples are computed from the heightmap when uploaded, the coarser ones stored
+		levels[0].width = heightmap.width + 1;
+		levels[0].height = heightmap.height + 1;
+		for (size_t l = 1; l < levels.size(); ++l)
+		{
+			Level& level = levels[l];
+			level.width = levels[l - 1].width / 2 + 1;
+			level.height = levels[l - 1].height / 2 + 1;
+			level.samples.resize((size_t)level.width * level.height);
+
+			const ClipmapTerrain* self = this;
+			int finer = (int)l - 1;
+			Level* target = &level;
+			parallelFor(0, level.height, [=](int rowBegin, int rowEnd) {
+				for (int z = rowBegin; z < rowEnd; ++z)
+				{
+					for (int x = 0; x < target->width; ++x)
+					{
+						float sum = 0.0f;
+						for (int dz = -1; dz <= 1; ++dz)
+							for (int dx = -1; dx <= 1; ++dx)
+								sum += self->sample(finer, x * 2 + dx, z * 2 + dz) * (float)((2 - std::abs(dx)) * (2 - std::abs(dz)));
+						target->samples[(size_t)z * target->width + x] = (uint16_t)(sum / 16.0f + 0.5f);
+					}
+				}
+			}, 8);
+		}
+
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// level textures, the shared grid mesh and the constant uniforms of Clipmap.vert; the level being drawn is bound
+	// to fineUnit and the next coarser one to coarseUnit
+	void createResources(Shader& shader, int fineTextureUnit, int coarseTextureUnit)
+	{
+		fineUnit = fineTextureUnit;
+		coarseUnit = coarseTextureUnit;
+
+		glActiveTexture(GL_TEXTURE0 + fineUnit);
+		for (Level& level : levels)
+		{
+			glGenTextures(1, &level.texture);
+			glBindTexture(GL_TEXTURE_2D, level.texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, TEXTURE_SIZE, TEXTURE_SIZE, 0, GL_RED, GL_FLOAT, nullptr);
+		}
+
+		std::vector<float> vertices;
+		for (int z = 0; z <= GRID_QUADS; ++z)
+		{
+			for (int x = 0; x <= GRID_QUADS; ++x)
+			{
+				vertices.push_back((float)x);
+				vertices.push_back((float)z);
+			}
+		}
+
+		// (GRID_QUADS + 1)^2 vertices still fit 16 bit indices
+		std::vector<GLushort> indices;
+		for (int z = 0; z < GRID_QUADS; ++z)
+		{
+			for (int x = 0; x < GRID_QUADS; ++x)
+			{
+				GLushort i00 = (GLushort)(z * (GRID_QUADS + 1) + x), i10 = i00 + 1;
+				GLushort i01 = (GLushort)(i00 + GRID_QUADS + 1), i11 = i01 + 1;
+				indices.insert(indices.end(), { i00, i01, i10, i10, i01, i11 });
+			}
+		}
+		indexCount = (GLsizei)indices.size();
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ebo);
+
+		glBindVertexArray(vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+
+		shader.use();
+		shader.setInt("fineHeights", fineUnit);
+		shader.setInt("coarseHeights", coarseUnit);
+		shader.setVec2("mapMin", mapMin);
+		shader.setVec2("mapMax", mapMax);
+		shader.setFloat("gridQuads", (float)GRID_QUADS);
+		shader.setFloat("textureSize", (float)TEXTURE_SIZE);
+		shader.setFloat("transitionWidth", (float)TRANSITION_WIDTH);
+
+		levelSpacing = shader.getUniform<float>("levelSpacing");
+		levelOrigin = shader.getUniform<glm::vec2>("levelOrigin");
+		levelIndex = shader.getUniform<float>("levelIndex");
+		viewerPosition = shader.getUniform<glm::vec2>("viewer");
+		hasCoarser = shader.getUniform<bool>("hasCoarser");
+		hasHole = shader.getUniform<bool>("hasHole");
+		holeRect = shader.getUniform<glm::vec4>("holeRect");
+	}
+
+	// recentres the levels on the camera, uploading only the samples that entered them since the last call
+	void update(const glm::vec3& cameraPosition)
+	{
+		PROFILE_SCOPE("clipmap update");
+
+		viewer = glm::vec2(cameraPosition.x, cameraPosition.z);
+		uploadedTexels = 0;
+
+		glActiveTexture(GL_TEXTURE0 + fineUnit);
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			Level& level = levels[l];
+			float spacing = texelSize * (float)(1 << l);
+
+			// even origins keep every level's border on vertices of the next coarser one
+			glm::vec2 centre = (viewer - mapMin) / spacing - (float)(GRID_QUADS / 2);
+			int originX = 2 * (int)std::floor(centre.x * 0.5f);
+			int originZ = 2 * (int)std::floor(centre.y * 0.5f);
+			if (level.valid && originX == level.originX && originZ == level.originZ)
+				continue;
+
+			glBindTexture(GL_TEXTURE_2D, level.texture);
+
+			int dx = originX - level.originX, dz = originZ - level.originZ;
+			if (!level.valid || std::abs(dx) >= TEXTURE_SIZE || std::abs(dz) >= TEXTURE_SIZE)
+				uploadRect((int)l, originX, originZ, originX + TEXTURE_SIZE, originZ + TEXTURE_SIZE);
+			else
+			{
+				// columns that entered, over all new rows, then rows that entered over the remaining columns
+				int keptX0 = std::max(originX, level.originX), keptX1 = std::min(originX, level.originX) + TEXTURE_SIZE;
+				if (dx > 0)
+					uploadRect((int)l, keptX1, originZ, originX + TEXTURE_SIZE, originZ + TEXTURE_SIZE);
+				else if (dx < 0)
+					uploadRect((int)l, originX, originZ, keptX0, originZ + TEXTURE_SIZE);
+
+				if (dz > 0)
+					uploadRect((int)l, keptX0, level.originZ + TEXTURE_SIZE, keptX1, originZ + TEXTURE_SIZE);
+				else if (dz < 0)
+					uploadRect((int)l, keptX0, originZ, keptX1, level.originZ);
+			}
+
+			level.originX = originX;
+			level.originZ = originZ;
+			level.valid = true;
+		}
+
+		totalUploadedTexels += uploadedTexels;
+	}
+
+	// draws the levels finest first; the heightMapShader has to be in use
+	void draw() const
+	{
+		if (!vao)
+			return;
+
+		glEnable(GL_CLIP_DISTANCE1);
+		glBindVertexArray(vao);
+		viewerPosition.set(viewer);
+
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			glActiveTexture(GL_TEXTURE0 + fineUnit);
+			glBindTexture(GL_TEXTURE_2D, levels[l].texture);
+			glActiveTexture(GL_TEXTURE0 + coarseUnit);
+			glBindTexture(GL_TEXTURE_2D, levels[std::min(l + 1, levels.size() - 1)].texture);
+
+			levelSpacing.set(texelSize * (float)(1 << l));
+			levelOrigin.set(glm::vec2((float)levels[l].originX, (float)levels[l].originZ));
+			levelIndex.set((float)l);
+			hasCoarser.set(l + 1 < levels.size());
+
+			// the finer level covers half of its own grid in this level's samples
+			hasHole.set(l > 0);
+			if (l > 0)
+			{
+				glm::vec2 finer = glm::vec2((float)levels[l - 1].originX, (float)levels[l - 1].originZ) * 0.5f;
+				holeRect.set(glm::vec4(finer.x, finer.y, finer.x + GRID_QUADS / 2, finer.y + GRID_QUADS / 2));
+			}
+
+			glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0);
+		}
+
+		glDisable(GL_CLIP_DISTANCE1);
+	}
+
+	int getLevelCount() const
+	{
+		return (int)levels.size();
+	}
+
+	// triangles of all levels per pass, the finer footprints included
+	long long getTriangleCount() const
+	{
+		return (long long)levels.size() * GRID_QUADS * GRID_QUADS * 2;
+	}
+
+	// samples written by the last update and since the start
+	long long getUploadedTexels() const
+	{
+		return uploadedTexels;
+	}
+
+	long long getTotalUploadedTexels() const
+	{
+		return totalUploadedTexels;
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+private:
+	struct Level {
+		int width = 0;					// samples, one more than the texels or grid cells they sit between
+		int height = 0;
+		std::vector<uint16_t> samples;	// empty for level 0
+		GLuint texture = 0;
+		int originX = 0;				// grid coordinates of the first resident sample
+		int originZ = 0;
+		bool valid = false;
+	};
+
+	const Heightmap* source = nullptr;
+	std::vector<Level> levels;
+	glm::vec2 mapMin = glm::vec2(0.0f);
+	glm::vec2 mapMax = glm::vec2(0.0f);
+	float texelSize = 1.0f;			// world units per heightmap texel, the level 0 spacing
+	glm::vec2 viewer = glm::vec2(0.0f);
+
+	int fineUnit = 0;
+	int coarseUnit = 0;
+	UniformHandle<float> levelSpacing;
+	UniformHandle<glm::vec2> levelOrigin;
+	UniformHandle<float> levelIndex;
+	UniformHandle<glm::vec2> viewerPosition;
+	UniformHandle<bool> hasCoarser;
+	UniformHandle<bool> hasHole;
+	UniformHandle<glm::vec4> holeRect;
+
+	GLuint vao = 0, vbo = 0, ebo = 0;
+	GLsizei indexCount = 0;
+	std::vector<float> staging;
+	long long uploadedTexels = 0;
+	long long totalUploadedTexels = 0;
+	double buildMilliseconds = 0.0;
+
+	// normalized 16 bit sample of a level, clamped to the map border
+	float sample(int level, int x, int z) const
+	{
+		const Level& l = levels[level];
+		x = std::max(0, std::min(x, l.width - 1));
+		z = std::max(0, std::min(z, l.height - 1));
+		if (level > 0)
+			return l.samples[(size_t)z * l.width + x];
+
+		// level 0 vertices sit on texel corners
+		int x0 = std::max(x - 1, 0), x1 = std::min(x, source->width - 1);
+		int z0 = std::max(z - 1, 0), z1 = std::min(z, source->height - 1);
+		return (source->texel(x0, z0) + source->texel(x1, z0) + source->texel(x0, z1) + source->texel(x1, z1)) * 0.25f;
+	}
+
+	// writes the world heights of grid samples [x0, x1) x [z0, z1) of a level, split where the rectangle wraps
+	// around the texture; the level's texture has to be bound
+	void uploadRect(int level, int x0, int z0, int x1, int z1)
+	{
+		for (int z = z0; z < z1; )
+		{
+			int texelZ = ((z % TEXTURE_SIZE) + TEXTURE_SIZE) % TEXTURE_SIZE;
+			int rows = std::min(z1 - z, TEXTURE_SIZE - texelZ);
+
+			for (int x = x0; x < x1; )
+			{
+				int texelX = ((x % TEXTURE_SIZE) + TEXTURE_SIZE) % TEXTURE_SIZE;
+				int columns = std::min(x1 - x, TEXTURE_SIZE - texelX);
+
+				staging.resize((size_t)columns * rows);
+				for (int r = 0; r < rows; ++r)
+					for (int c = 0; c < columns; ++c)
+						staging[(size_t)r * columns + c] = source->toHeight(sample(level, x + c, z + r) / 65535.0f);
+
+				glTexSubImage2D(GL_TEXTURE_2D, 0, texelX, texelZ, columns, rows, GL_RED, GL_FLOAT, staging.data());
+				uploadedTexels += (long long)columns * rows;
+				x += columns;
+			}
+			z += rows;
+		}
+	}
+};
+
+#endif	// CLIPMAPTERRAIN_H
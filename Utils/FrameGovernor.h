@@ -0,0 +1,151 @@
+#ifndef FRAMEGOVERNOR_H
+#define FRAMEGOVERNOR_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Dynamic resolution controller: measures the GPU time of every frame with a ring of GL_TIMESTAMP query pairs
+// (read back a few frames late, never stalling, and free to overlap the PassTimer GL_TIME_ELAPSED queries) and
+// adjusts the water target scale and the main render scale to hold a target frame time. Over budget the water
+// targets are shrunk first, then the main pass; with headroom the main pass is restored first.
+class FrameGovernor {
+public:
+	static const int QUERY_FRAMES = 4;
+
+	FrameGovernor() {}
+
+	~FrameGovernor()
+	{
+		if (initialized)
+			glDeleteQueries(QUERY_FRAMES * 2, &queries[0][0]);
+	}
+
+	// a target of 0 disables the governor, scales then stay at 1
+	void initialize(float targetFrameMs)
+	{
+		targetMs = targetFrameMs;
+		if (targetMs <= 0.0f || initialized)
+			return;
+
+		glGenQueries(QUERY_FRAMES * 2, &queries[0][0]);
+		initialized = true;
+	}
+
+	bool isEnabled() const
+	{
+		return initialized && targetMs > 0.0f;
+	}
+
+	void beginFrame()
+	{
+		if (!isEnabled())
+			return;
+
+		slot = (slot + 1) % QUERY_FRAMES;
+		measuring = true;
+		if (pending[slot])
+		{
+			// the driver runs more than QUERY_FRAMES frames behind: this frame goes unmeasured instead of waiting,
+			// its queries are still in flight and stay pending
+			GLint available = 0;
+			glGetQueryObjectiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+			{
+				measuring = false;
+				return;
+			}
+
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+			pending[slot] = false;
+			addSample((end - start) / 1.0e6f);
+		}
+
+		glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+	}
+
+	void endFrame()
+	{
+		if (!isEnabled() || !measuring)
+			return;
+
+		glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+		pending[slot] = true;
+	}
+
+	float getWaterScale() const
+	{
+		return waterScale;
+	}
+
+	float getRenderScale() const
+	{
+		return renderScale;
+	}
+
+	float getAverageGpuMs() const
+	{
+		return averageMs;
+	}
+
+	float getTargetMs() const
+	{
+		return targetMs;
+	}
+
+private:
+	// frames between two adjustments, lets the average settle on the new resolution
+	static const int ADJUST_INTERVAL = 15;
+
+	GLuint queries[QUERY_FRAMES][2] = {};		// frame start and end timestamps
+	bool pending[QUERY_FRAMES] = {};
+	int slot = 0;
+	bool measuring = false;						// the current frame's slot was free for new timestamps
+	bool initialized = false;
+
+	float targetMs = 0.0f;
+	float averageMs = 0.0f;
+	int samples = 0;
+	int framesSinceAdjust = 0;
+
+	float waterScale = 1.0f;
+	float renderScale = 1.0f;
+	float minWaterScale = 0.5f;
+	float minRenderScale = 0.5f;
+
+	void addSample(float gpuMs)
+	{
+		averageMs = samples == 0 ? gpuMs : averageMs + 0.1f * (gpuMs - averageMs);
+		++samples;
+
+		if (++framesSinceAdjust < ADJUST_INTERVAL)
+			return;
+		framesSinceAdjust = 0;
+
+		// frame time scales roughly with the pixel count, i.e. with the square of the resolution scale
+		float factor = std::sqrt(targetMs / std::max(averageMs, 0.01f));
+
+		if (averageMs > targetMs)
+		{
+			factor = std::max(factor, 0.9f);
+			if (waterScale > minWaterScale)
+				waterScale = std::max(minWaterScale, waterScale * factor);
+			else
+				renderScale = std::max(minRenderScale, renderScale * factor);
+		}
+		else if (averageMs < targetMs * 0.85f)
+		{
+			// grow slowly and stay below the target to avoid oscillating around it
+			factor = std::min(factor, 1.05f);
+			if (renderScale < 1.0f)
+				renderScale = std::min(1.0f, renderScale * factor);
+			else
+				waterScale = std::min(1.0f, waterScale * factor);
+		}
+	}
+};
+
+#endif	// FRAMEGOVERNOR_H
@@ -5,52 +5,135 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <iostream>
+#include <algorithm>
+
+// Reflection and refraction targets sized as fractions of the backbuffer, re-created when it is resized.
+// With dynamic resolution the passes render into the lower left part of their targets (the storage is only
+// re-created on resize), and the main pass can render into a scene target at a reduced scale that is then
+// upscaled to the screen. When the scene depth has to be readable (occlusion culling) the main pass always
+// renders into the scene target, with a depth texture instead of a renderbuffer.
 class FrameBufferHandler {
 public:
-	static const int REFLECTION_WIDTH = 320;
-	static const int REFLECTION_HEIGHT = 180;
+	FrameBufferHandler(int startingTexSlot, int width, int height, float reflectionSizeFraction = 0.2f, float refractionSizeFraction = 0.8f)
+		: reflectionFraction(reflectionSizeFraction), refractionFraction(refractionSizeFraction), textureStartSlot(startingTexSlot)
+	{
+		resize(width, height);
+	}
 
-	static const int REFRACTION_WIDTH = 1280;
-	static const int REFRACTION_HEIGHT = 720;
+	~FrameBufferHandler()
+	{
+		cleanUp();
+	}
 
-	static const int screenWidth = 1600;
-	static const int screenHeight = 1200;
+	void cleanUp()
+	{
+		deleteTargets();
+
+		if (offscreenFrameBuffer)
+		{
+			glDeleteFramebuffers(1, &offscreenFrameBuffer);
+			glDeleteRenderbuffers(1, &offscreenColorBuffer);
+			glDeleteRenderbuffers(1, &offscreenDepthBuffer);
+		}
+		offscreenFrameBuffer = offscreenColorBuffer = offscreenDepthBuffer = 0;
+	}
 
-	FrameBufferHandler(int startingTexSlot = 0) : textureStartSlot(startingTexSlot)
+	// re-creates the targets for a new backbuffer size, returns false if nothing changed
+	bool resize(int width, int height)
 	{
+		if (width <= 0 || height <= 0 || (width == screenWidth && height == screenHeight))
+			return false;
+
+		deleteTargets();
+		screenWidth = width;
+		screenHeight = height;
+
+		reflectionWidth = std::max(1, (int)(width * reflectionFraction));
+		reflectionHeight = std::max(1, (int)(height * reflectionFraction));
+		refractionWidth = std::max(1, (int)(width * refractionFraction));
+		refractionHeight = std::max(1, (int)(height * refractionFraction));
+
 		initializeReflectionFrameBuffer();
 		initializeRefractionFrameBuffer();
+		initializeSceneFrameBuffer();
+		return true;
 	}
 
-	~FrameBufferHandler()
+	// creates a color + depth target used instead of the window framebuffer when running headless
+	void initializeOffscreenFrameBuffer(int width, int height)
 	{
-		cleanUp();
+		offscreenFrameBuffer = createFrameBuffer();
+
+		glGenRenderbuffers(1, &offscreenColorBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, offscreenColorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColorBuffer);
+
+		offscreenDepthBuffer = createDepthBufferAttachment(width, height);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER::OFFSCREEN_TARGET_INCOMPLETE" << std::endl;
+
+		defaultFrameBuffer = offscreenFrameBuffer;
+		unbindCurrentFrameBuffer();
 	}
 
-	void cleanUp()
+	// dynamic resolution: fraction of the water targets and of the screen actually rendered, in (0, 1]
+	void setDynamicScale(float waterPassScale, float mainPassScale)
 	{
-		glDeleteFramebuffers(1, &reflectionFrameBuffer);
-		glDeleteTextures(1, &reflectionTexture);
-		glDeleteRenderbuffers(1, &reflectionDepthBuffer);
+		waterScale = std::max(0.1f, std::min(waterPassScale, 1.0f));
+		renderScale = std::max(0.1f, std::min(mainPassScale, 1.0f));
+	}
 
-		glDeleteFramebuffers(1, &refractionFrameBuffer);
-		glDeleteTextures(1, &refractionTexture);
-		glDeleteTextures(1, &refractionDepthTexture);
+	// keeps the main pass depth in a texture bound to depthTextureUnit, re-creates the scene target
+	void setSceneDepthReadable(bool readable, int depthTextureUnit)
+	{
+		if (readable == sceneDepthReadable)
+			return;
+
+		sceneDepthReadable = readable;
+		sceneDepthUnit = depthTextureUnit;
+		deleteSceneTarget();
+		initializeSceneFrameBuffer();
 	}
 
 	void bindReflectionFrameBuffer()
 	{
-		bindFrameBuffer(reflectionFrameBuffer, REFLECTION_WIDTH, REFLECTION_HEIGHT);
+		bindFrameBuffer(reflectionFrameBuffer, getScaled(reflectionWidth, waterScale), getScaled(reflectionHeight, waterScale));
 	}
 
 	void bindRefractionFrameBuffer()
 	{
-		bindFrameBuffer(refractionFrameBuffer, REFRACTION_WIDTH, REFRACTION_HEIGHT);
+		bindFrameBuffer(refractionFrameBuffer, getScaled(refractionWidth, waterScale), getScaled(refractionHeight, waterScale));
+	}
+
+	// target of the main pass: the screen, or the scene target when rendering at a reduced scale
+	void bindSceneFrameBuffer()
+	{
+		if (usesSceneTarget())
+			bindFrameBuffer(sceneFrameBuffer, getScaled(screenWidth, renderScale), getScaled(screenHeight, renderScale));
+		else
+			unbindCurrentFrameBuffer();
+	}
+
+	// upscales the scene target to the screen, leaves the screen target bound
+	void presentScene()
+	{
+		if (usesSceneTarget())
+		{
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFrameBuffer);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFrameBuffer);
+			glBlitFramebuffer(0, 0, getScaled(screenWidth, renderScale), getScaled(screenHeight, renderScale),
+				0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+		unbindCurrentFrameBuffer();
 	}
 
-	void unbindCurrentFrameBuffer(int screenWidth, int screenHeight)
+	// binds the screen target (the window, or the offscreen target when running headless)
+	void unbindCurrentFrameBuffer()
 	{
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, defaultFrameBuffer);
 		glViewport(0, 0, screenWidth, screenHeight);
 	}
 
@@ -69,6 +152,61 @@ public:
 		return refractionDepthTexture;
 	}
 
+	// 0 unless setSceneDepthReadable was enabled
+	GLuint getSceneDepthTexture() const
+	{
+		return sceneDepthTexture;
+	}
+
+	// part of the scene target the main pass renders to
+	int getSceneWidth() const
+	{
+		return getScaled(screenWidth, renderScale);
+	}
+
+	int getSceneHeight() const
+	{
+		return getScaled(screenHeight, renderScale);
+	}
+
+	// part of the water textures that holds the last rendered image, for the water shader
+	glm::vec2 getReflectionUVScale() const
+	{
+		return glm::vec2(getScaled(reflectionWidth, waterScale) / (float)reflectionWidth, getScaled(reflectionHeight, waterScale) / (float)reflectionHeight);
+	}
+
+	glm::vec2 getRefractionUVScale() const
+	{
+		return glm::vec2(getScaled(refractionWidth, waterScale) / (float)refractionWidth, getScaled(refractionHeight, waterScale) / (float)refractionHeight);
+	}
+
+	// tessellation scale for the terrain drawn into each target: its vertical resolution relative to the screen,
+	// so patches keep roughly the same triangle size in pixels as in the main pass
+	float getReflectionTessScale() const
+	{
+		return getTessScale(getScaled(reflectionHeight, waterScale));
+	}
+
+	float getRefractionTessScale() const
+	{
+		return getTessScale(getScaled(refractionHeight, waterScale));
+	}
+
+	float getSceneTessScale() const
+	{
+		return getTessScale(getScaled(screenHeight, renderScale));
+	}
+
+	int getScreenWidth() const
+	{
+		return screenWidth;
+	}
+
+	int getScreenHeight() const
+	{
+		return screenHeight;
+	}
+
 private:
 	GLuint reflectionFrameBuffer = 0;
 	GLuint reflectionTexture = 0;
@@ -78,8 +216,77 @@ private:
 	GLuint refractionTexture = 0;
 	GLuint refractionDepthTexture = 0;
 
+	GLuint sceneFrameBuffer = 0;
+	GLuint sceneColorBuffer = 0;
+	GLuint sceneDepthBuffer = 0;
+	GLuint sceneDepthTexture = 0;
+	bool sceneDepthReadable = false;
+	int sceneDepthUnit = 0;
+
+	GLuint offscreenFrameBuffer = 0;
+	GLuint offscreenColorBuffer = 0;
+	GLuint offscreenDepthBuffer = 0;
+	GLuint defaultFrameBuffer = 0;
+
+	int screenWidth = 0;
+	int screenHeight = 0;
+	int reflectionWidth = 0;
+	int reflectionHeight = 0;
+	int refractionWidth = 0;
+	int refractionHeight = 0;
+
+	float reflectionFraction;
+	float refractionFraction;
+	float waterScale = 1.0f;
+	float renderScale = 1.0f;
+
 	int textureStartSlot;
 
+	static int getScaled(int size, float scale)
+	{
+		return std::max(1, (int)(size * scale + 0.5f));
+	}
+
+	bool isSceneScaled() const
+	{
+		return getScaled(screenWidth, renderScale) < screenWidth || getScaled(screenHeight, renderScale) < screenHeight;
+	}
+
+	bool usesSceneTarget() const
+	{
+		return sceneDepthReadable || isSceneScaled();
+	}
+
+	float getTessScale(int targetHeight) const
+	{
+		return screenHeight > 0 ? std::min(1.0f, (float)targetHeight / (float)screenHeight) : 1.0f;
+	}
+
+	void deleteTargets()
+	{
+		glDeleteFramebuffers(1, &reflectionFrameBuffer);
+		glDeleteTextures(1, &reflectionTexture);
+		glDeleteRenderbuffers(1, &reflectionDepthBuffer);
+
+		glDeleteFramebuffers(1, &refractionFrameBuffer);
+		glDeleteTextures(1, &refractionTexture);
+		glDeleteTextures(1, &refractionDepthTexture);
+
+		reflectionFrameBuffer = reflectionTexture = reflectionDepthBuffer = 0;
+		refractionFrameBuffer = refractionTexture = refractionDepthTexture = 0;
+		deleteSceneTarget();
+	}
+
+	void deleteSceneTarget()
+	{
+		glDeleteFramebuffers(1, &sceneFrameBuffer);
+		glDeleteRenderbuffers(1, &sceneColorBuffer);
+		glDeleteRenderbuffers(1, &sceneDepthBuffer);
+		glDeleteTextures(1, &sceneDepthTexture);
+
+		sceneFrameBuffer = sceneColorBuffer = sceneDepthBuffer = sceneDepthTexture = 0;
+	}
+
 	GLuint createFrameBuffer()
 	{
 		GLuint frameBuffer;
@@ -108,6 +315,8 @@ private:
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
 
@@ -145,18 +354,34 @@ private:
 	void initializeReflectionFrameBuffer()
 	{
 		reflectionFrameBuffer = createFrameBuffer();
-		reflectionTexture = createTextureAttachment(REFLECTION_WIDTH, REFLECTION_HEIGHT, textureStartSlot);
-		reflectionDepthBuffer = createDepthBufferAttachment(REFLECTION_WIDTH, REFLECTION_HEIGHT);
-		unbindCurrentFrameBuffer(screenWidth, screenHeight);
-		
+		reflectionTexture = createTextureAttachment(reflectionWidth, reflectionHeight, textureStartSlot);
+		reflectionDepthBuffer = createDepthBufferAttachment(reflectionWidth, reflectionHeight);
+		unbindCurrentFrameBuffer();
 	}
 
 	void initializeRefractionFrameBuffer()
 	{
 		refractionFrameBuffer = createFrameBuffer();
-		refractionTexture = createTextureAttachment(REFRACTION_WIDTH, REFRACTION_HEIGHT, textureStartSlot + 1);
-		refractionDepthTexture = createDepthTextureAttachment(REFRACTION_WIDTH, REFRACTION_HEIGHT, textureStartSlot + 2);
-		unbindCurrentFrameBuffer(screenWidth, screenHeight);
+		refractionTexture = createTextureAttachment(refractionWidth, refractionHeight, textureStartSlot + 1);
+		refractionDepthTexture = createDepthTextureAttachment(refractionWidth, refractionHeight, textureStartSlot + 2);
+		unbindCurrentFrameBuffer();
+	}
+
+	// full size storage, the main pass uses only part of it at reduced render scales
+	void initializeSceneFrameBuffer()
+	{
+		sceneFrameBuffer = createFrameBuffer();
+
+		glGenRenderbuffers(1, &sceneColorBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, sceneColorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, screenWidth, screenHeight);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColorBuffer);
+
+		if (sceneDepthReadable)
+			sceneDepthTexture = createDepthTextureAttachment(screenWidth, screenHeight, sceneDepthUnit);
+		else
+			sceneDepthBuffer = createDepthBufferAttachment(screenWidth, screenHeight);
+		unbindCurrentFrameBuffer();
 	}
 };
 
@@ -0,0 +1,83 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// View frustum described by six planes (xyz = inward facing normal, w = distance)
+// extracted from a combined projection * view matrix
+class Frustum {
+public:
+	enum TestResult {
+		OUTSIDE,
+		INTERSECTING,
+		INSIDE
+	};
+
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	Frustum(const glm::mat4& viewProjection)
+	{
+		update(viewProjection);
+	}
+
+	// Gribb/Hartmann plane extraction; glm matrices are column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	void update(const glm::mat4& m)
+	{
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		planes[0] = row3 + row0;	// left
+		planes[1] = row3 - row0;	// right
+		planes[2] = row3 + row1;	// bottom
+		planes[3] = row3 - row1;	// top
+		planes[4] = row3 + row2;	// near
+		planes[5] = row3 - row2;	// far
+
+		for (int i = 0; i < 6; ++i)
+		{
+			float len = glm::length(glm::vec3(planes[i].x, planes[i].y, planes[i].z));
+			if (len > 0.0f)
+				planes[i] = planes[i] / len;
+		}
+	}
+
+	// classifies an axis aligned box against the frustum using the positive/negative vertex of each plane
+	TestResult testAABB(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		TestResult result = INSIDE;
+
+		for (int i = 0; i < 6; ++i)
+		{
+			TestResult planeResult = testPlane(planes[i], boxMin, boxMax);
+			if (planeResult == OUTSIDE)
+				return OUTSIDE;
+			if (planeResult == INTERSECTING)
+				result = INTERSECTING;
+		}
+
+		return result;
+	}
+
+	// classifies an axis aligned box against a single plane, points with dot(plane, p) >= 0 are inside
+	static TestResult testPlane(const glm::vec4& plane, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 positive(plane.x >= 0.0f ? boxMax.x : boxMin.x,
+			plane.y >= 0.0f ? boxMax.y : boxMin.y,
+			plane.z >= 0.0f ? boxMax.z : boxMin.z);
+		glm::vec3 negative(plane.x >= 0.0f ? boxMin.x : boxMax.x,
+			plane.y >= 0.0f ? boxMin.y : boxMax.y,
+			plane.z >= 0.0f ? boxMin.z : boxMax.z);
+
+		if (glm::dot(glm::vec3(plane.x, plane.y, plane.z), positive) + plane.w < 0.0f)
+			return OUTSIDE;
+		if (glm::dot(glm::vec3(plane.x, plane.y, plane.z), negative) + plane.w < 0.0f)
+			return INTERSECTING;
+		return INSIDE;
+	}
+};
+
+#endif	// FRUSTUM_H
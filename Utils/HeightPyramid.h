@@ -0,0 +1,392 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+#include <glad/glad.h>
+
+#include <Heightmap.h>
+#include <ParallelFor.h>
+#include <Simd.h>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+// Min/max mip pyramid over the heightmap. Level 0 reduces 2x2 heightmap texels, every further level
+// reduces 2x2 texels of the previous one; level sizes follow the GL mip chain (floor halving) and the last
+// row/column of an odd sized level is folded into its neighbour, so every texel bound stays conservative.
+// Values are stored as interleaved (min, max) pairs of the 16 bit heightmap texels, ready for a GL_RG16 texture.
+class HeightPyramid {
+public:
+	struct Level {
+		int width = 0;
+		int height = 0;
+		std::vector<uint16_t> minMax;
+	};
+
+	HeightPyramid() {}
+
+	void build(const Heightmap& heightmap)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		levels.clear();
+		sourceWidth = heightmap.width;
+		sourceHeight = heightmap.height;
+		heightScale = heightmap.heightScale;
+		heightOffset = heightmap.heightOffset;
+
+		if (!heightmap.isValid())
+			return;
+
+		levels.push_back(Level());
+		reduceSource(heightmap, levels.back());
+
+		while (levels.back().width > 1 || levels.back().height > 1)
+		{
+			levels.push_back(Level());
+			reduceLevel(levels[levels.size() - 2], levels.back());
+		}
+
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	int getLevelCount() const
+	{
+		return (int)levels.size();
+	}
+
+	const Level& getLevel(int level) const
+	{
+		return levels[level];
+	}
+
+	// size of the heightmap the pyramid was built from, which may be a reduced overview of the rendered map
+	int getSourceWidth() const
+	{
+		return sourceWidth;
+	}
+
+	int getSourceHeight() const
+	{
+		return sourceHeight;
+	}
+
+	// normalization of the texture values, Height = value * heightScale + heightOffset
+	float getHeightScale() const
+	{
+		return heightScale;
+	}
+
+	float getHeightOffset() const
+	{
+		return heightOffset;
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+	// conservative displaced height bounds over the inclusive heightmap texel rectangle [x0, x1] x [y0, y1];
+	// coordinates outside the map wrap around like the GL_REPEAT heightmap sampler
+	void queryHeights(int x0, int y0, int x1, int y1, float& minHeight, float& maxHeight) const
+	{
+		if (levels.empty())
+		{
+			minHeight = heightOffset;
+			maxHeight = heightOffset + heightScale;
+			return;
+		}
+
+		uint16_t lo = 0xFFFF, hi = 0;
+
+		int xSegments[4], ySegments[4];
+		int xCount = wrapRange(x0, x1, sourceWidth, xSegments);
+		int yCount = wrapRange(y0, y1, sourceHeight, ySegments);
+
+		for (int a = 0; a < xCount; ++a)
+		{
+			for (int b = 0; b < yCount; ++b)
+				queryClamped(xSegments[2 * a], ySegments[2 * b], xSegments[2 * a + 1], ySegments[2 * b + 1], lo, hi);
+		}
+
+		minHeight = lo / 65535.0f * heightScale + heightOffset;
+		maxHeight = hi / 65535.0f * heightScale + heightOffset;
+	}
+
+	// uploads the pyramid as a GL_RG16 texture, pyramid level n being mip level n
+	GLuint createTexture(int textureUnit) const
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(0, getLevelCount() - 1));
+
+		for (int l = 0; l < getLevelCount(); ++l)
+			glTexImage2D(GL_TEXTURE_2D, l, GL_RG16, levels[l].width, levels[l].height, 0, GL_RG, GL_UNSIGNED_SHORT, levels[l].minMax.data());
+
+		return texture;
+	}
+
+private:
+	std::vector<Level> levels;
+
+	int sourceWidth = 0;
+	int sourceHeight = 0;
+	float heightScale = 64.0f;
+	float heightOffset = -16.0f;
+	double buildMilliseconds = 0.0;
+
+	// splits an inclusive, possibly wrapping range into at most two ranges inside [0, size)
+	static int wrapRange(int a, int b, int size, int* segments)
+	{
+		if (b - a + 1 >= size)
+		{
+			segments[0] = 0;
+			segments[1] = size - 1;
+			return 1;
+		}
+
+		int start = ((a % size) + size) % size;
+		int end = start + (b - a);
+		if (end < size)
+		{
+			segments[0] = start;
+			segments[1] = end;
+			return 1;
+		}
+
+		segments[0] = start;
+		segments[1] = size - 1;
+		segments[2] = 0;
+		segments[3] = end - size;
+		return 2;
+	}
+
+	void queryClamped(int x0, int y0, int x1, int y1, uint16_t& lo, uint16_t& hi) const
+	{
+		if (levels.empty())
+			return;
+
+		// pick the level where the range spans only a couple of texels per axis
+		int span = std::max(x1 - x0, y1 - y0) + 1;
+		int level = 0;
+		while (level + 1 < getLevelCount() && (2 << (level + 1)) <= span / 2)
+			++level;
+
+		const Level& l = levels[level];
+		int shift = level + 1;
+		int lx0 = std::min(x0 >> shift, l.width - 1), lx1 = std::min(x1 >> shift, l.width - 1);
+		int ly0 = std::min(y0 >> shift, l.height - 1), ly1 = std::min(y1 >> shift, l.height - 1);
+
+		for (int y = ly0; y <= ly1; ++y)
+		{
+			const uint16_t* row = l.minMax.data() + (size_t)y * l.width * 2;
+			for (int x = lx0; x <= lx1; ++x)
+			{
+				lo = std::min(lo, row[2 * x]);
+				hi = std::max(hi, row[2 * x + 1]);
+			}
+		}
+	}
+
+	// source rows (or columns) reduced into output texel i: 2i and 2i + 1, plus 2i + 2 for the last texel of an odd size
+	static void sourceSpan(int i, int outSize, int inSize, int& first, int& last)
+	{
+		first = 2 * i;
+		last = (i == outSize - 1) ? inSize - 1 : 2 * i + 1;
+		last = std::max(first, last);
+		first = std::min(first, inSize - 1);
+	}
+
+	static void reduceSource(const Heightmap& heightmap, Level& out)
+	{
+		int inWidth = heightmap.width, inHeight = heightmap.height;
+		out.width = std::max(1, inWidth / 2);
+		out.height = std::max(1, inHeight / 2);
+		out.minMax.resize((size_t)out.width * out.height * 2);
+
+		parallelFor(0, out.height, [&](int rowBegin, int rowEnd) {
+			std::vector<uint16_t> rowMin(inWidth + 16), rowMax(inWidth + 16);
+
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				int first, last;
+				sourceSpan(y, out.height, inHeight, first, last);
+
+				// vertical reduction into one min and one max row
+				const uint16_t* texels = heightmap.texels.data();
+				verticalSource(texels + (size_t)first * inWidth, texels + (size_t)last * inWidth, rowMin.data(), rowMax.data(), inWidth);
+				for (int r = first + 1; r < last; ++r)
+					verticalSource(texels + (size_t)r * inWidth, rowMin.data(), rowMin.data(), rowMax.data(), inWidth);
+
+				horizontalSource(rowMin.data(), rowMax.data(), inWidth, out.minMax.data() + (size_t)y * out.width * 2, out.width);
+			}
+		}, 16);
+	}
+
+	static void reduceLevel(const Level& in, Level& out)
+	{
+		out.width = std::max(1, in.width / 2);
+		out.height = std::max(1, in.height / 2);
+		out.minMax.resize((size_t)out.width * out.height * 2);
+
+		parallelFor(0, out.height, [&](int rowBegin, int rowEnd) {
+			std::vector<uint16_t> row((size_t)in.width * 2 + 16);
+
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				int first, last;
+				sourceSpan(y, out.height, in.height, first, last);
+
+				const uint16_t* src = in.minMax.data() + (size_t)first * in.width * 2;
+				std::copy(src, src + (size_t)in.width * 2, row.begin());
+				for (int r = first + 1; r <= last; ++r)
+					verticalU16(in.minMax.data() + (size_t)r * in.width * 2, row.data(), in.width);
+
+				horizontalU16(row.data(), in.width, out.minMax.data() + (size_t)y * out.width * 2, out.width);
+			}
+		}, 16);
+	}
+
+#ifdef TERRAIN_SIMD_SSE2
+	// SSE2 has no unsigned 16 bit min/max, flip the sign bit and use the signed versions
+	static __m128i minU16(__m128i a, __m128i b)
+	{
+		const __m128i bias = _mm_set1_epi16((short)0x8000);
+		return _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias)), bias);
+	}
+
+	static __m128i maxU16(__m128i a, __m128i b)
+	{
+		const __m128i bias = _mm_set1_epi16((short)0x8000);
+		return _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias)), bias);
+	}
+
+	// min of the even (min) lanes, max of the odd (max) lanes
+	static __m128i combineMinMax(__m128i a, __m128i b)
+	{
+		const __m128i minLanes = _mm_set1_epi32(0x0000FFFF);
+		return _mm_or_si128(_mm_and_si128(minU16(a, b), minLanes), _mm_andnot_si128(minLanes, maxU16(a, b)));
+	}
+#endif
+
+	// rowMin = min(a, b), rowMax = max(a, b); passing rowMin as b folds an extra row into the running rows
+	static void verticalSource(const uint16_t* a, const uint16_t* b, uint16_t* rowMin, uint16_t* rowMax, int width)
+	{
+		bool folding = (b == rowMin);
+		int x = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+			__m128i vMin = _mm_loadu_si128((const __m128i*)(b + x));
+			__m128i vMax = folding ? _mm_loadu_si128((const __m128i*)(rowMax + x)) : vMin;
+			_mm_storeu_si128((__m128i*)(rowMin + x), minU16(va, vMin));
+			_mm_storeu_si128((__m128i*)(rowMax + x), maxU16(va, vMax));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			uint16_t vMin = b[x];
+			uint16_t vMax = folding ? rowMax[x] : vMin;
+			rowMin[x] = std::min(a[x], vMin);
+			rowMax[x] = std::max(a[x], vMax);
+		}
+	}
+
+	static void horizontalSource(const uint16_t* rowMin, const uint16_t* rowMax, int inWidth, uint16_t* out, int outWidth)
+	{
+		// the last texel may fold an odd column, keep it on the scalar path
+		int bulk = (inWidth >= 2) ? outWidth - 1 : 0;
+		int x = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		const __m128i lowHalf = _mm_set1_epi32(0x0000FFFF);
+		for (; x + 4 <= bulk; x += 4)
+		{
+			// 8 input texels -> 4 output texels, odd columns shifted onto the even ones within each 32 bit lane
+			__m128i vMin = _mm_loadu_si128((const __m128i*)(rowMin + 2 * x));
+			__m128i vMax = _mm_loadu_si128((const __m128i*)(rowMax + 2 * x));
+			__m128i lo = _mm_and_si128(minU16(vMin, _mm_srli_epi32(vMin, 16)), lowHalf);
+			__m128i hi = _mm_slli_epi32(maxU16(vMax, _mm_srli_epi32(vMax, 16)), 16);
+			_mm_storeu_si128((__m128i*)(out + 2 * x), _mm_or_si128(lo, hi));
+		}
+#endif
+		for (; x < outWidth; ++x)
+		{
+			int first, last;
+			sourceSpan(x, outWidth, inWidth, first, last);
+
+			uint16_t lo = rowMin[first], hi = rowMax[first];
+			for (int c = first + 1; c <= last; ++c)
+			{
+				lo = std::min(lo, rowMin[c]);
+				hi = std::max(hi, rowMax[c]);
+			}
+			out[2 * x] = lo;
+			out[2 * x + 1] = hi;
+		}
+	}
+
+	static void verticalU16(const uint16_t* src, uint16_t* row, int width)
+	{
+		int x = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		for (; x + 4 <= width; x += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + 2 * x));
+			__m128i r = _mm_loadu_si128((const __m128i*)(row + 2 * x));
+			_mm_storeu_si128((__m128i*)(row + 2 * x), combineMinMax(r, v));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			row[2 * x] = std::min(row[2 * x], src[2 * x]);
+			row[2 * x + 1] = std::max(row[2 * x + 1], src[2 * x + 1]);
+		}
+	}
+
+	static void horizontalU16(const uint16_t* row, int inWidth, uint16_t* out, int outWidth)
+	{
+		int bulk = (inWidth >= 2) ? outWidth - 1 : 0;
+		int x = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		for (; x + 4 <= bulk; x += 4)
+		{
+			// 8 input texels -> 4 output texels, odd texels shifted onto the even ones
+			__m128i v0 = _mm_loadu_si128((const __m128i*)(row + 4 * x));
+			__m128i v1 = _mm_loadu_si128((const __m128i*)(row + 4 * x + 8));
+			__m128i r0 = combineMinMax(v0, _mm_srli_epi64(v0, 32));
+			__m128i r1 = combineMinMax(v1, _mm_srli_epi64(v1, 32));
+			r0 = _mm_shuffle_epi32(r0, _MM_SHUFFLE(2, 0, 2, 0));
+			r1 = _mm_shuffle_epi32(r1, _MM_SHUFFLE(2, 0, 2, 0));
+			_mm_storeu_si128((__m128i*)(out + 2 * x), _mm_unpacklo_epi64(r0, r1));
+		}
+#endif
+		for (; x < outWidth; ++x)
+		{
+			int first, last;
+			sourceSpan(x, outWidth, inWidth, first, last);
+
+			uint16_t lo = row[2 * first], hi = row[2 * first + 1];
+			for (int c = first + 1; c <= last; ++c)
+			{
+				lo = std::min(lo, row[2 * c]);
+				hi = std::max(hi, row[2 * c + 1]);
+			}
+			out[2 * x] = lo;
+			out[2 * x + 1] = hi;
+		}
+	}
+};
+
+#endif	// HEIGHTPYRAMID_H
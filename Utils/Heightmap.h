@@ -0,0 +1,116 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include <ParallelFor.h>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// CPU copy of the heightmap channel sampled by Shader.TES, normalized to 16 bits, together with the mapping
+// from normalized texel value to terrain height (Height = value * heightScale + heightOffset)
+struct Heightmap {
+	int width = 0;
+	int height = 0;
+	std::vector<uint16_t> texels;
+
+	float heightScale = 64.0f;
+	float heightOffset = -16.0f;
+
+	bool isValid() const
+	{
+		return width > 0 && height > 0 && !texels.empty();
+	}
+
+	uint16_t texel(int x, int y) const
+	{
+		return texels[(size_t)y * width + x];
+	}
+
+	// maps a value normalized to [0, 1] to terrain height, exactly like the TES
+	float toHeight(float normalized) const
+	{
+		return normalized * heightScale + heightOffset;
+	}
+
+	float texelHeight(int x, int y) const
+	{
+		return toHeight(texel(x, y) / 65535.0f);
+	}
+
+	// 64 bit FNV-1a of the texels, little endian, to tell whether two runs sampled the same terrain
+	uint64_t checksum() const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (uint16_t value : texels)
+		{
+			hash = (hash ^ (value & 0xFF)) * 1099511628211ull;
+			hash = (hash ^ (value >> 8)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// extracts the sampled channel from decoded 8 bit stb_image data: the TES used to read .y of an RGBA upload,
+	// single channel images only have .x
+	static Heightmap fromImage(const unsigned char* data, int width, int height, int nrChannels)
+	{
+		return extract(data, width, height, nrChannels, [](unsigned char value) { return (uint16_t)(value * 257); });
+	}
+
+	static Heightmap fromImage16(const uint16_t* data, int width, int height, int nrChannels)
+	{
+		return extract(data, width, height, nrChannels, [](uint16_t value) { return value; });
+	}
+
+	// float heightmaps store heights directly (Height = value * heightScale + heightOffset in the TES);
+	// the CPU copy is normalized over the value range and the mapping adjusted to match
+	static Heightmap fromFloat(const float* data, int width, int height, float heightScale, float heightOffset)
+	{
+		float lo = INFINITY, hi = -INFINITY;
+		for (size_t i = 0; i < (size_t)width * height; ++i)
+		{
+			lo = std::min(lo, data[i]);
+			hi = std::max(hi, data[i]);
+		}
+		float range = hi > lo ? hi - lo : 1.0f;
+
+		// rounding error is at most half a 16 bit step of the value range
+		Heightmap heightmap = extract(data, width, height, 1, [=](float value) {
+			return (uint16_t)std::min(65535.0f, (value - lo) / range * 65535.0f + 0.5f);
+		});
+		heightmap.heightScale = range * heightScale;
+		heightmap.heightOffset = lo * heightScale + heightOffset;
+		return heightmap;
+	}
+
+private:
+	template<typename T, typename Convert>
+	static Heightmap extract(const T* data, int width, int height, int nrChannels, Convert convert)
+	{
+		Heightmap heightmap;
+		if (!data || width <= 0 || height <= 0)
+			return heightmap;
+
+		heightmap.width = width;
+		heightmap.height = height;
+		heightmap.texels.resize((size_t)width * height);
+
+		int channel = nrChannels > 1 ? 1 : 0;
+		uint16_t* texels = heightmap.texels.data();
+
+		parallelFor(0, height, [=](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				const T* src = data + (size_t)y * width * nrChannels + channel;
+				uint16_t* dst = texels + (size_t)y * width;
+				for (int x = 0; x < width; ++x)
+					dst[x] = convert(src[(size_t)x * nrChannels]);
+			}
+		}, 64);
+
+		return heightmap;
+	}
+};
+
+#endif	// HEIGHTMAP_H
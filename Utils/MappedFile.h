@@ -0,0 +1,147 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+// Read-only or read-write memory mapping of a whole file
+class MappedFile {
+public:
+	MappedFile() {}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool openRead(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return fail(path);
+
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (uint64_t)fileSize.QuadPart;
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+			return fail(path);
+
+		data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return fail(path);
+
+		struct stat info;
+		fstat(fd, &info);
+		size = (uint64_t)info.st_size;
+
+		void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		data = address == MAP_FAILED ? nullptr : (unsigned char*)address;
+#endif
+		return data ? true : fail(path);
+	}
+
+	// creates (or truncates) a file of the given size and maps it for writing
+	bool create(const std::string& path, uint64_t fileSize)
+	{
+		close();
+		size = fileSize;
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return fail(path);
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+		if (!mapping)
+			return fail(path);
+
+		data = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+#else
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, (off_t)size) != 0)
+			return fail(path);
+
+		void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		data = address == MAP_FAILED ? nullptr : (unsigned char*)address;
+#endif
+		return data ? true : fail(path);
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap(data, size);
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	bool isOpen() const
+	{
+		return data != nullptr;
+	}
+
+	unsigned char* getData() const
+	{
+		return data;
+	}
+
+	uint64_t getSize() const
+	{
+		return size;
+	}
+
+private:
+	unsigned char* data = nullptr;
+	uint64_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+
+	bool fail(const std::string& path)
+	{
+		std::cout << "Failed to map file " << path << std::endl;
+		close();
+		return false;
+	}
+};
+
+#endif	// MAPPEDFILE_H
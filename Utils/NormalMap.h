@@ -0,0 +1,133 @@
+#ifndef NORMALMAP_H
+#define NORMALMAP_H
+
+#include <glad/glad.h>
+
+#include <Heightmap.h>
+#include <ParallelFor.h>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Terrain normals derived from the heightmap with a 3x3 Sobel filter at load time, using the height mapping of
+// Shader.TES and the world size of one heightmap texel. Only x and z are stored (GL_RG8_SNORM), the shader
+// rebuilds y = sqrt(1 - x^2 - z^2) since terrain normals always point up. Borders wrap like the GL_REPEAT heightmap.
+class NormalMap {
+public:
+	NormalMap() {}
+
+	void build(const Heightmap& heightmap, float worldWidth, float worldHeight)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		width = heightmap.width;
+		height = heightmap.height;
+		texels.clear();
+		if (!heightmap.isValid())
+			return;
+
+		texels.resize((size_t)width * height * 2);
+
+		// Sobel weights sum to 4 per side (1 + 2 + 1) and the sides are 2 texels apart, so the weighted difference
+		// is 8 times the rise per texel: gradient = sum / (8 * texel size), in heightmap units per world unit
+		float slopeX = heightmap.heightScale / 65535.0f / (8.0f * worldWidth / width);
+		float slopeZ = heightmap.heightScale / 65535.0f / (8.0f * worldHeight / height);
+
+		const uint16_t* src = heightmap.texels.data();
+		int8_t* dst = texels.data();
+		int w = width, h = height;
+
+		parallelFor(0, height, [=](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				const uint16_t* above = src + (size_t)((y + h - 1) % h) * w;
+				const uint16_t* row = src + (size_t)y * w;
+				const uint16_t* below = src + (size_t)((y + 1) % h) * w;
+				int8_t* out = dst + (size_t)y * w * 2;
+
+				for (int x = 0; x < w; ++x)
+				{
+					int left = x > 0 ? x - 1 : w - 1;
+					int right = x + 1 < w ? x + 1 : 0;
+
+					int gx = (above[right] + 2 * row[right] + below[right]) - (above[left] + 2 * row[left] + below[left]);
+					int gz = (below[left] + 2 * below[x] + below[right]) - (above[left] + 2 * above[x] + above[right]);
+
+					float nx = -gx * slopeX, nz = -gz * slopeZ;
+					float inverseLength = 1.0f / std::sqrt(nx * nx + 1.0f + nz * nz);
+					out[2 * x] = toSnorm8(nx * inverseLength);
+					out[2 * x + 1] = toSnorm8(nz * inverseLength);
+				}
+			}
+		}, 64);
+
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	bool isValid() const
+	{
+		return !texels.empty();
+	}
+
+	int getWidth() const
+	{
+		return width;
+	}
+
+	int getHeight() const
+	{
+		return height;
+	}
+
+	// y component of the stored unit normal, 1 on flat ground
+	float getNormalY(int x, int y) const
+	{
+		const int8_t* texel = texels.data() + ((size_t)y * width + x) * 2;
+		float nx = texel[0] / 127.0f, nz = texel[1] / 127.0f;
+		return std::sqrt(std::max(0.0f, 1.0f - nx * nx - nz * nz));
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+	// uploads the normals as a mipmapped GL_RG8_SNORM texture sampled like the heightmap
+	GLuint createTexture(int textureUnit) const
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// rows of odd widths are not 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8_SNORM, width, height, 0, GL_RG, GL_BYTE, texels.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		return texture;
+	}
+
+private:
+	int width = 0;
+	int height = 0;
+	std::vector<int8_t> texels;		// interleaved (x, z)
+	double buildMilliseconds = 0.0;
+
+	static int8_t toSnorm8(float value)
+	{
+		return (int8_t)std::lround(std::max(-1.0f, std::min(value, 1.0f)) * 127.0f);
+	}
+};
+
+#endif	// NORMALMAP_H
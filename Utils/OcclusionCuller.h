@@ -0,0 +1,376 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Shader.h>
+#include <Camera.h>
+#include <TerrainQuadtree.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GPU occlusion culling of the terrain patches against a max depth (Hi-Z) pyramid of the previous frame's main pass.
+// GL 4.1 has no compute shaders or multi draw indirect, so the pyramid is reduced with fragment shader passes and
+// the patches that survive the frustum culling are tested in a geometry shader that writes the control point indices
+// of the visible ones into a transform feedback buffer, drawn with glDrawTransformFeedback.
+// The pyramid is only trusted while the camera moves slowly; after a fast move, a resize or before the first
+// frame the frustum culled list is drawn unchanged.
+class OcclusionCuller {
+public:
+	// frames between issuing a patch count query and reading it back
+	static const int QUERY_FRAMES = 4;
+
+	struct Stats {
+		int testedPatches = 0;			// frustum visible patches tested on the GPU
+		int occludedPatches = 0;		// of those rejected by the pyramid, a few frames late
+		int fallbackFrames = 0;			// frames drawn without the test since the last reset
+	};
+
+	OcclusionCuller() {}
+
+	~OcclusionCuller()
+	{
+		if (!initialized)
+			return;
+
+		deletePyramid();
+		glDeleteTextures(1, &patchBoundsTexture);
+		glDeleteBuffers(1, &feedbackBuffer);
+		glDeleteTransformFeedbacks(1, &feedback);
+		glDeleteVertexArrays(1, &feedbackVAO);
+		glDeleteVertexArrays(1, &emptyVAO);
+		glDeleteFramebuffers(1, &pyramidFrameBuffer);
+		glDeleteQueries(QUERY_FRAMES, queries);
+	}
+
+	// the pyramid and the patch bounds are bound to their own texture units while culling
+	void initialize(Shader& hiZProgram, Shader& cullProgram, int hiZTextureUnit, int boundsTextureUnit)
+	{
+		hiZShader = &hiZProgram;
+		cullShader = &cullProgram;
+		hiZUnit = hiZTextureUnit;
+		boundsUnit = boundsTextureUnit;
+
+		glGenFramebuffers(1, &pyramidFrameBuffer);
+		glGenVertexArrays(1, &emptyVAO);
+		glGenVertexArrays(1, &feedbackVAO);
+		glGenBuffers(1, &feedbackBuffer);
+		glGenTransformFeedbacks(1, &feedback);
+		glGenTextures(1, &patchBoundsTexture);
+		glGenQueries(QUERY_FRAMES, queries);
+
+		// the captured indices feed attribute 0 of Shader.vert
+		glBindVertexArray(feedbackVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, feedbackBuffer);
+		glVertexAttribIPointer(0, 1, GL_INT, sizeof(GLint), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindVertexArray(0);
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, feedbackBuffer);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+		hiZSourceLevel = hiZShader->getUniform<int>("sourceLevel");
+		hiZSourceSize = hiZShader->getUniform<glm::ivec2>("sourceSize");
+		cullViewProjection = cullShader->getUniform<glm::mat4>("viewProjection");
+		cullDepthSize = cullShader->getUniform<glm::ivec2>("depthSize");
+		cullLevels = cullShader->getUniform<int>("hiZLevels");
+
+		hiZShader->use();
+		hiZShader->setInt("sourceDepth", hiZUnit);
+
+		cullShader->use();
+		cullShader->setInt("hiZ", hiZUnit);
+		cullShader->setInt("patchBounds", boundsUnit);
+
+		initialized = true;
+	}
+
+	// uploads the per patch height bounds of the quadtree and sizes the feedback buffer for the whole grid
+	void setPatchGrid(const TerrainQuadtree& quadtree, int width, int height)
+	{
+		int rez = quadtree.getGridRez();
+		const std::vector<float>& minHeights = quadtree.getPatchMinHeights();
+		const std::vector<float>& maxHeights = quadtree.getPatchMaxHeights();
+
+		std::vector<float> bounds((size_t)rez * rez * 2);
+		for (size_t p = 0; p < minHeights.size(); ++p)
+		{
+			bounds[2 * p] = minHeights[p];
+			bounds[2 * p + 1] = maxHeights[p];
+		}
+
+		glActiveTexture(GL_TEXTURE0 + boundsUnit);
+		glBindTexture(GL_TEXTURE_2D, patchBoundsTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, rez, rez, 0, GL_RG, GL_FLOAT, bounds.data());
+
+		glBindBuffer(GL_ARRAY_BUFFER, feedbackBuffer);
+		glBufferData(GL_ARRAY_BUFFER, (size_t)rez * rez * 4 * sizeof(GLint), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		cullShader->use();
+		cullShader->setInt("gridRez", rez);
+		cullShader->setVec2("gridOrigin", glm::vec2(-width / 2.0f, -height / 2.0f));
+		cullShader->setVec2("gridSpacing", glm::vec2(width / (float)rez, height / (float)rez));
+
+		// results of queries still in flight belong to the old grid
+		for (int q = 0; q < QUERY_FRAMES; ++q)
+			queryPending[q] = false;
+	}
+
+	// camera movement per frame above which the previous frame's pyramid is not used
+	void setFallbackThresholds(float distance, float angleDegrees)
+	{
+		maxMove = distance;
+		maxTurn = angleDegrees;
+	}
+
+	// tests the frustum culled patches, returns false when the caller has to draw them directly
+	bool cull(const PatchDrawList& candidates, const Camera& camera)
+	{
+		PROFILE_SCOPE("occlusion cull");
+
+		readQueries();
+
+		bool moved = glm::length(camera.Position - pyramidPosition) > maxMove
+			|| std::fabs(camera.Yaw - pyramidYaw) > maxTurn || std::fabs(camera.Pitch - pyramidPitch) > maxTurn;
+		if (!pyramidValid || moved || candidates.first.empty())
+		{
+			++stats.fallbackFrames;
+			return false;
+		}
+
+		// the draw list is in control points, the cull pass runs one point per patch
+		pointFirst.clear();
+		pointCount.clear();
+		int tested = 0;
+		for (size_t r = 0; r < candidates.first.size(); ++r)
+		{
+			pointFirst.push_back(candidates.first[r] / 4);
+			pointCount.push_back(candidates.count[r] / 4);
+			tested += candidates.count[r] / 4;
+		}
+
+		cullShader->use();
+		glActiveTexture(GL_TEXTURE0 + hiZUnit);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		glActiveTexture(GL_TEXTURE0 + boundsUnit);
+		glBindTexture(GL_TEXTURE_2D, patchBoundsTexture);
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindVertexArray(emptyVAO);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+
+		querySlot = (querySlot + 1) % QUERY_FRAMES;
+		bool queryFree = !queryPending[querySlot];
+		if (queryFree)
+			glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, queries[querySlot]);
+
+		glBeginTransformFeedback(GL_POINTS);
+		glMultiDrawArrays(GL_POINTS, pointFirst.data(), pointCount.data(), (GLsizei)pointFirst.size());
+		glEndTransformFeedback();
+
+		if (queryFree)
+		{
+			glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+			queryPending[querySlot] = true;
+			queryTested[querySlot] = tested;
+		}
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		return true;
+	}
+
+	// draws the patches that passed the last cull, with the terrain program bound
+	void draw() const
+	{
+		glBindVertexArray(feedbackVAO);
+		glDrawTransformFeedback(GL_PATCHES, feedback);
+	}
+
+	// reduces the main pass depth into the pyramid used next frame; leaves the pyramid framebuffer bound
+	void buildPyramid(GLuint depthTexture, int depthWidth, int depthHeight, const glm::mat4& viewProjection, const Camera& camera)
+	{
+		PROFILE_SCOPE("hi-z pyramid");
+
+		if (!depthTexture)
+			return;
+
+		if (depthWidth != pyramidDepthWidth || depthHeight != pyramidDepthHeight)
+			createPyramid(depthWidth, depthHeight);
+
+		GLint polygonMode[2];
+		glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		glDisable(GL_DEPTH_TEST);
+
+		hiZShader->use();
+		glBindVertexArray(emptyVAO);
+		glBindFramebuffer(GL_FRAMEBUFFER, pyramidFrameBuffer);
+		glActiveTexture(GL_TEXTURE0 + hiZUnit);
+
+		int sourceWidth = depthWidth, sourceHeight = depthHeight;
+		for (int level = 0; level < pyramidLevels; ++level)
+		{
+			// level 0 reads the scene depth, every further level the one before it, restricted to that level
+			// so the level being written is never sampled
+			if (level == 0)
+			{
+				glBindTexture(GL_TEXTURE_2D, depthTexture);
+				hiZSourceLevel.set(0);
+			}
+			else
+			{
+				glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+				hiZSourceLevel.set(level - 1);
+			}
+			hiZSourceSize.set(glm::ivec2(sourceWidth, sourceHeight));
+
+			int targetWidth = std::max(1, sourceWidth / 2), targetHeight = std::max(1, sourceHeight / 2);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, level);
+			glViewport(0, 0, targetWidth, targetHeight);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+
+			sourceWidth = targetWidth;
+			sourceHeight = targetHeight;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, pyramidLevels - 1);
+
+		glEnable(GL_DEPTH_TEST);
+		glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+
+		cullViewProjection.set(viewProjection);
+		cullDepthSize.set(glm::ivec2(depthWidth, depthHeight));
+		cullLevels.set(pyramidLevels);
+
+		pyramidValid = true;
+		pyramidPosition = camera.Position;
+		pyramidYaw = camera.Yaw;
+		pyramidPitch = camera.Pitch;
+	}
+
+	// the next frame draws without the test, e.g. after the render targets changed
+	void invalidate()
+	{
+		pyramidValid = false;
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void resetFallbackCount()
+	{
+		stats.fallbackFrames = 0;
+	}
+
+private:
+	Shader* hiZShader = nullptr;
+	Shader* cullShader = nullptr;
+	int hiZUnit = 0;
+	int boundsUnit = 0;
+	bool initialized = false;
+
+	GLuint pyramidFrameBuffer = 0;
+	GLuint pyramidTexture = 0;
+	int pyramidLevels = 0;
+	int pyramidDepthWidth = 0;
+	int pyramidDepthHeight = 0;
+	bool pyramidValid = false;
+
+	glm::vec3 pyramidPosition = glm::vec3(0.0f);
+	float pyramidYaw = 0.0f;
+	float pyramidPitch = 0.0f;
+	float maxMove = 5.0f;
+	float maxTurn = 3.0f;
+
+	GLuint patchBoundsTexture = 0;
+	GLuint feedbackBuffer = 0;
+	GLuint feedback = 0;
+	GLuint feedbackVAO = 0;
+	GLuint emptyVAO = 0;
+	std::vector<GLint> pointFirst;
+	std::vector<GLsizei> pointCount;
+
+	GLuint queries[QUERY_FRAMES] = {};
+	bool queryPending[QUERY_FRAMES] = {};
+	int queryTested[QUERY_FRAMES] = {};
+	int querySlot = 0;
+	Stats stats;
+
+	UniformHandle<int> hiZSourceLevel;
+	UniformHandle<glm::ivec2> hiZSourceSize;
+	UniformHandle<glm::mat4> cullViewProjection;
+	UniformHandle<glm::ivec2> cullDepthSize;
+	UniformHandle<int> cullLevels;
+
+	void createPyramid(int depthWidth, int depthHeight)
+	{
+		deletePyramid();
+		pyramidDepthWidth = depthWidth;
+		pyramidDepthHeight = depthHeight;
+
+		int width = std::max(1, depthWidth / 2), height = std::max(1, depthHeight / 2);
+		pyramidLevels = 1;
+		while ((width >> pyramidLevels) > 0 || (height >> pyramidLevels) > 0)
+			++pyramidLevels;
+
+		glGenTextures(1, &pyramidTexture);
+		glActiveTexture(GL_TEXTURE0 + hiZUnit);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		for (int level = 0; level < pyramidLevels; ++level)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(1, width >> level), std::max(1, height >> level), 0, GL_RED, GL_FLOAT, nullptr);
+
+		pyramidValid = false;
+	}
+
+	void deletePyramid()
+	{
+		glDeleteTextures(1, &pyramidTexture);
+		pyramidTexture = 0;
+		pyramidLevels = 0;
+	}
+
+	// non blocking: only results that are already available are read
+	void readQueries()
+	{
+		for (int q = 0; q < QUERY_FRAMES; ++q)
+		{
+			if (!queryPending[q])
+				continue;
+
+			GLuint available = 0;
+			glGetQueryObjectuiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint written = 0;
+			glGetQueryObjectuiv(queries[q], GL_QUERY_RESULT, &written);
+			queryPending[q] = false;
+
+			// every visible patch writes 4 points
+			stats.testedPatches = queryTested[q];
+			stats.occludedPatches = queryTested[q] - (int)(written / 4);
+		}
+	}
+};
+
+#endif	// OCCLUSIONCULLER_H
@@ -0,0 +1,124 @@
+#ifndef OFFSCREENCONTEXT_H
+#define OFFSCREENCONTEXT_H
+
+// Windowless OpenGL context for headless runs (benchmarks on GPU-less CI machines through Mesa llvmpipe).
+// Uses EGL with the surfaceless platform when the project is built with TERRAIN_ENABLE_EGL (link against libEGL);
+// otherwise create() fails and the caller falls back to a hidden GLFW window.
+
+#ifdef TERRAIN_ENABLE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <iostream>
+
+class OffscreenContext {
+public:
+	OffscreenContext() {}
+
+	~OffscreenContext()
+	{
+		destroy();
+	}
+
+	// creates a core profile context of the requested version and makes it current without any surface
+	bool create(int majorVersion, int minorVersion)
+	{
+#ifdef TERRAIN_ENABLE_EGL
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint eglMajor, eglMinor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor))
+		{
+			std::cout << "Failed to initialize EGL display!" << std::endl;
+			display = EGL_NO_DISPLAY;
+			return false;
+		}
+
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "EGL display does not support desktop OpenGL!" << std::endl;
+			destroy();
+			return false;
+		}
+
+		// no surface is ever created, a config is only needed by implementations without EGL_KHR_no_config_context
+		EGLint configAttributes[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+		};
+		EGLConfig config = (EGLConfig)0;
+		EGLint configCount = 0;
+		if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+			config = (EGLConfig)0;
+
+		EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, majorVersion,
+			EGL_CONTEXT_MINOR_VERSION, minorVersion,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+		if (context == EGL_NO_CONTEXT)
+		{
+			std::cout << "Failed to create EGL context!" << std::endl;
+			destroy();
+			return false;
+		}
+
+		if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			std::cout << "Failed to make the surfaceless EGL context current!" << std::endl;
+			destroy();
+			return false;
+		}
+
+		std::cout << "Created surfaceless EGL " << eglMajor << "." << eglMinor << " context" << std::endl;
+		return true;
+#else
+		(void)majorVersion;
+		(void)minorVersion;
+		return false;
+#endif
+	}
+
+	void destroy()
+	{
+#ifdef TERRAIN_ENABLE_EGL
+		if (display != EGL_NO_DISPLAY)
+		{
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#endif
+	}
+
+	// loader for glad
+	static void* getProcAddress(const char* name)
+	{
+#ifdef TERRAIN_ENABLE_EGL
+		return (void*)eglGetProcAddress(name);
+#else
+		(void)name;
+		return nullptr;
+#endif
+	}
+
+private:
+#ifdef TERRAIN_ENABLE_EGL
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+#endif	// OFFSCREENCONTEXT_H
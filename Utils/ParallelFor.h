@@ -0,0 +1,51 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// number of worker threads used by the load time passes, never zero
+inline unsigned int getWorkerThreadCount()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+// splits [begin, end) into contiguous chunks and runs body(chunkBegin, chunkEnd) on each of them,
+// one chunk per thread; ranges shorter than minChunk per thread run on fewer threads
+template <typename Body>
+void parallelFor(int begin, int end, const Body& body, int minChunk = 1, unsigned int threadCount = 0)
+{
+	if (end <= begin)
+		return;
+
+	if (threadCount == 0)
+		threadCount = getWorkerThreadCount();
+
+	int range = end - begin;
+	int chunks = std::max(1, std::min((int)threadCount, range / std::max(1, minChunk)));
+	if (chunks == 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(chunks - 1);
+
+	for (int c = 1; c < chunks; ++c)
+	{
+		int chunkBegin = begin + (int)((long long)range * c / chunks);
+		int chunkEnd = begin + (int)((long long)range * (c + 1) / chunks);
+		workers.emplace_back([&body, chunkBegin, chunkEnd]() { body(chunkBegin, chunkEnd); });
+	}
+
+	// the calling thread takes the first chunk
+	body(begin, begin + (int)((long long)range / chunks));
+
+	for (size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+}
+
+#endif	// PARALLELFOR_H
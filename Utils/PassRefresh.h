@@ -0,0 +1,71 @@
+#ifndef PASSREFRESH_H
+#define PASSREFRESH_H
+
+#include <Camera.h>
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+// Decides when an offscreen pass (reflection / refraction) has to be rendered again. By default it runs every frame;
+// with an interval it runs every N frames, with a distance threshold whenever the camera moved (or turned by more
+// than angleThreshold degrees) since the last refresh, with both on whichever comes first. In between the previous
+// textures are reused.
+class PassRefresh {
+public:
+	PassRefresh(int frameInterval = 0, float distanceThreshold = 0.0f, float angleThresholdDegrees = 2.0f)
+		: interval(frameInterval), moveThreshold(distanceThreshold), angleThreshold(angleThresholdDegrees) {}
+
+	bool isEveryFrame() const
+	{
+		return interval <= 1 && moveThreshold <= 0.0f;
+	}
+
+	// call once per frame, returns true if the pass has to be rendered
+	bool update(const Camera& camera)
+	{
+		++framesSinceRefresh;
+
+		bool refresh = !refreshed || isEveryFrame();
+		if (interval > 0 && framesSinceRefresh >= interval)
+			refresh = true;
+		if (moveThreshold > 0.0f && hasMoved(camera))
+			refresh = true;
+
+		if (refresh)
+		{
+			refreshed = true;
+			framesSinceRefresh = 0;
+			lastPosition = camera.Position;
+			lastYaw = camera.Yaw;
+			lastPitch = camera.Pitch;
+		}
+		return refresh;
+	}
+
+	// forces the next update to refresh, e.g. when the water level changes
+	void invalidate()
+	{
+		refreshed = false;
+	}
+
+private:
+	int interval;
+	float moveThreshold;
+	float angleThreshold;
+
+	bool refreshed = false;
+	int framesSinceRefresh = 0;
+	glm::vec3 lastPosition = glm::vec3(0.0f);
+	float lastYaw = 0.0f;
+	float lastPitch = 0.0f;
+
+	bool hasMoved(const Camera& camera) const
+	{
+		return glm::length(camera.Position - lastPosition) >= moveThreshold
+			|| std::fabs(camera.Yaw - lastYaw) >= angleThreshold
+			|| std::fabs(camera.Pitch - lastPitch) >= angleThreshold;
+	}
+};
+
+#endif	// PASSREFRESH_H
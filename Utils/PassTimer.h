@@ -0,0 +1,181 @@
+#ifndef PASSTIMER_H
+#define PASSTIMER_H
+
+#include <glad/glad.h>
+
+#include <Profiler.h>
+
+#include <vector>
+#include <chrono>
+
+// render passes measured every frame
+enum RenderPass {
+	PASS_REFLECTION,
+	PASS_REFRACTION,
+	PASS_TERRAIN,
+	PASS_WATER,
+	PASS_SWAP,
+	PASS_COUNT
+};
+
+static const char* const RENDER_PASS_NAMES[PASS_COUNT] = { "reflection", "refraction", "terrain", "water", "swap" };
+
+// CPU and GPU (GL_TIME_ELAPSED) time of every render pass. Queries live in a ring of QUERY_FRAMES
+// frames so results are read back a few frames late instead of stalling the pipeline. Besides the raw samples
+// (benchmark runs) it keeps rolling per pass averages, and while the Profiler is enabled every pass also lands in
+// the trace: the CPU time on the render thread track, the GPU time on the GPU track starting at the pass' CPU start.
+// Disabled, beginPass / endPass only test a flag.
+class PassTimer {
+public:
+	static const int QUERY_FRAMES = 4;
+
+	PassTimer() {}
+
+	~PassTimer()
+	{
+		if (initialized)
+			glDeleteQueries(QUERY_FRAMES * PASS_COUNT, &queries[0][0]);
+	}
+
+	void initialize(bool enable = true)
+	{
+		glGenQueries(QUERY_FRAMES * PASS_COUNT, &queries[0][0]);
+		initialized = true;
+		enabled = enable;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled;
+	}
+
+	// only between frames, a pass must not be left open
+	void setEnabled(bool enable)
+	{
+		enabled = initialized && enable;
+	}
+
+	// raw samples grow every frame, interactive runs only keep the averages
+	void setRecordSamples(bool record)
+	{
+		recordSamples = record;
+	}
+
+	// advances the ring, reading back the frame whose queries are about to be reused
+	void beginFrame()
+	{
+		if (!enabled)
+			return;
+
+		frameSlot = (frameSlot + 1) % QUERY_FRAMES;
+		collect(frameSlot);
+	}
+
+	void beginPass(RenderPass pass)
+	{
+		if (!enabled)
+			return;
+
+		cpuStart[pass] = std::chrono::high_resolution_clock::now();
+		traceStart[frameSlot][pass] = Profiler::instance().isEnabled() ? Profiler::instance().now() : -1.0;
+		glBeginQuery(GL_TIME_ELAPSED, queries[frameSlot][pass]);
+	}
+
+	void endPass(RenderPass pass)
+	{
+		if (!enabled)
+			return;
+
+		glEndQuery(GL_TIME_ELAPSED);
+		double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cpuStart[pass]).count();
+		if (recordSamples)
+			cpuSamples[pass].push_back(cpuMs);
+		addAverage(averageCpuMs[pass], cpuMs);
+		pending[frameSlot][pass] = true;
+
+		if (traceStart[frameSlot][pass] >= 0.0)
+			Profiler::instance().addEvent(RENDER_PASS_NAMES[pass], traceStart[frameSlot][pass], cpuMs * 1000.0);
+	}
+
+	// reads every outstanding query, used once the measured frames are done
+	void flush()
+	{
+		if (!enabled)
+			return;
+
+		for (int f = 1; f <= QUERY_FRAMES; ++f)
+			collect((frameSlot + f) % QUERY_FRAMES);
+	}
+
+	const std::vector<double>& getCpuSamples(RenderPass pass) const
+	{
+		return cpuSamples[pass];
+	}
+
+	const std::vector<double>& getGpuSamples(RenderPass pass) const
+	{
+		return gpuSamples[pass];
+	}
+
+	// rolling averages over roughly the last ten frames the pass ran in
+	double getAverageCpuMs(RenderPass pass) const
+	{
+		return averageCpuMs[pass];
+	}
+
+	double getAverageGpuMs(RenderPass pass) const
+	{
+		return averageGpuMs[pass];
+	}
+
+	void clearSamples()
+	{
+		for (int p = 0; p < PASS_COUNT; ++p)
+		{
+			cpuSamples[p].clear();
+			gpuSamples[p].clear();
+		}
+	}
+
+private:
+	GLuint queries[QUERY_FRAMES][PASS_COUNT] = {};
+	bool pending[QUERY_FRAMES][PASS_COUNT] = {};
+	int frameSlot = 0;
+	bool initialized = false;
+	bool enabled = false;
+	bool recordSamples = true;
+	double traceStart[QUERY_FRAMES][PASS_COUNT] = {};	// Profiler time of the pass start, -1 when not traced
+
+	std::chrono::high_resolution_clock::time_point cpuStart[PASS_COUNT];
+	std::vector<double> cpuSamples[PASS_COUNT];
+	std::vector<double> gpuSamples[PASS_COUNT];
+	double averageCpuMs[PASS_COUNT] = {};
+	double averageGpuMs[PASS_COUNT] = {};
+
+	static void addAverage(double& average, double sample)
+	{
+		average = average == 0.0 ? sample : average + 0.1 * (sample - average);
+	}
+
+	void collect(int slot)
+	{
+		for (int p = 0; p < PASS_COUNT; ++p)
+		{
+			if (!pending[slot][p])
+				continue;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[slot][p], GL_QUERY_RESULT, &elapsed);
+			double gpuMs = elapsed / 1.0e6;
+			if (recordSamples)
+				gpuSamples[p].push_back(gpuMs);
+			addAverage(averageGpuMs[p], gpuMs);
+			pending[slot][p] = false;
+
+			if (traceStart[slot][p] >= 0.0)
+				Profiler::instance().addEvent(RENDER_PASS_NAMES[p], traceStart[slot][p], gpuMs * 1000.0, Profiler::GPU_TRACK);
+		}
+	}
+};
+
+#endif	// PASSTIMER_H
@@ -0,0 +1,145 @@
+#ifndef PATCHROUGHNESS_H
+#define PATCHROUGHNESS_H
+
+#include <glad/glad.h>
+
+#include <Heightmap.h>
+#include <ParallelFor.h>
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// How far the terrain of every patch strays from the bilinear surface through its four corner heights, the surface a
+// patch tessellated at level 1 would show. Built at load time (and for every new grid resolution) over all heightmap
+// texels whose centers fall inside the patch, in parallel over the patch rows, and uploaded as a gridRez x gridRez
+// GL_R32F texture in world height units, texel (i, j) for patch (i, j) of the layout in main.cpp.
+class PatchRoughness {
+public:
+	PatchRoughness() {}
+
+	~PatchRoughness()
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+	}
+
+	void build(const Heightmap& heightmap, int gridRez)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		rez = gridRez;
+		deviations.assign((size_t)rez * rez, 0.0f);
+		if (!heightmap.isValid() || rez <= 0)
+			return;
+
+		const Heightmap* map = &heightmap;
+		float* dst = deviations.data();
+		int n = rez;
+
+		parallelFor(0, rez, [=](int rowBegin, int rowEnd) {
+			for (int j = rowBegin; j < rowEnd; ++j)
+				for (int i = 0; i < n; ++i)
+					dst[(size_t)j * n + i] = patchDeviation(*map, i, j, n);
+		});
+
+		// how much of the grid is close to flat, for the load time report
+		flatPatches = (int)std::count_if(deviations.begin(), deviations.end(), [](float d) { return d < 0.1f; });
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// creates the texture on the first call, replaces its contents afterwards
+	GLuint upload(int textureUnit)
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		if (!texture)
+		{
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		else
+			glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, rez, rez, 0, GL_RED, GL_FLOAT, deviations.data());
+		return texture;
+	}
+
+	float getDeviation(int i, int j) const
+	{
+		return deviations[(size_t)j * rez + i];
+	}
+
+	int getFlatPatchCount() const
+	{
+		return flatPatches;
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+private:
+	int rez = 0;
+	std::vector<float> deviations;
+	GLuint texture = 0;
+	int flatPatches = 0;
+	double buildMilliseconds = 0.0;
+
+	// bilinear, wrapping sample at texel coordinates (texel centers at + 0.5), like the GL_REPEAT heightmap
+	static float sample(const Heightmap& map, float x, float y)
+	{
+		x -= 0.5f;
+		y -= 0.5f;
+		float fx = std::floor(x), fy = std::floor(y);
+		float tx = x - fx, ty = y - fy;
+
+		int x0 = ((int)fx % map.width + map.width) % map.width, x1 = (x0 + 1) % map.width;
+		int y0 = ((int)fy % map.height + map.height) % map.height, y1 = (y0 + 1) % map.height;
+
+		float top = map.texel(x0, y0) + (map.texel(x1, y0) - map.texel(x0, y0)) * tx;
+		float bottom = map.texel(x0, y1) + (map.texel(x1, y1) - map.texel(x0, y1)) * tx;
+		return top + (bottom - top) * ty;
+	}
+
+	// largest |height - bilinear corner surface| of patch (i, j), in world height units
+	static float patchDeviation(const Heightmap& map, int i, int j, int gridRez)
+	{
+		// patch extent in texel coordinates
+		float x0 = (float)i / gridRez * map.width, x1 = (float)(i + 1) / gridRez * map.width;
+		float y0 = (float)j / gridRez * map.height, y1 = (float)(j + 1) / gridRez * map.height;
+
+		float h00 = sample(map, x0, y0), h10 = sample(map, x1, y0);
+		float h01 = sample(map, x0, y1), h11 = sample(map, x1, y1);
+
+		// texels whose centers lie in [x0, x1) x [y0, y1)
+		int firstX = (int)std::ceil(x0 - 0.5f), lastX = (int)std::ceil(x1 - 0.5f);
+		int firstY = (int)std::ceil(y0 - 0.5f), lastY = (int)std::ceil(y1 - 0.5f);
+
+		float maxDeviation = 0.0f;
+		for (int y = firstY; y < lastY; ++y)
+		{
+			float v = (y + 0.5f - y0) / (y1 - y0);
+			float left = h00 + (h01 - h00) * v;
+			float right = h10 + (h11 - h10) * v;
+			const uint16_t* row = map.texels.data() + (size_t)(y % map.height) * map.width;
+
+			for (int x = firstX; x < lastX; ++x)
+			{
+				float u = (x + 0.5f - x0) / (x1 - x0);
+				float plane = left + (right - left) * u;
+				maxDeviation = std::max(maxDeviation, std::abs(row[x % map.width] - plane));
+			}
+		}
+
+		return maxDeviation / 65535.0f * std::abs(map.heightScale);
+	}
+};
+
+#endif	// PATCHROUGHNESS_H
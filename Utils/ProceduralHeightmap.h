@@ -0,0 +1,413 @@
+#ifndef PROCEDURALHEIGHTMAP_H
+#define PROCEDURALHEIGHTMAP_H
+
+#include <glad/glad.h>
+
+#include <Heightmap.h>
+#include <ParallelFor.h>
+#include <Simd.h>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Heightmap generated from a seed, for running and benchmarking without the heightmap asset: domain warped gradient
+// noise fBm for the land masses plus ridged multifractal noise for the mountains, masked to the higher ground.
+// Everything is integer fixed point (Q16 positions, Q15 noise, 16 x 16 bit products), so a seed gives the same
+// texels on every compiler, CPU and thread count: no float rounding, FMA contraction or reduction order to differ.
+// The texels are evaluated four at a time with SSE2 (the scalar path runs the same kernel for the row tails and
+// other architectures), in parallel over rows, and normalized to 16 bits over the range of a sparse pre-pass.
+class ProceduralHeightmap {
+public:
+	static const int MIN_SIZE = 64;
+	static const int MAX_SIZE = 16384;
+
+	ProceduralHeightmap() {}
+
+	Heightmap generate(int width, int height, uint32_t seed)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		Heightmap heightmap;
+		heightmap.width = std::max(MIN_SIZE, std::min(width, MAX_SIZE));
+		heightmap.height = std::max(MIN_SIZE, std::min(height, MAX_SIZE));
+		heightmap.texels.resize((size_t)heightmap.width * heightmap.height);
+		setup(heightmap.width, heightmap.height, seed);
+
+		// range of every 4th texel of every 4th row, widened so the texels in between rarely clip
+		const int SPARSE_STEP = 4;
+		int sparseWidth = (heightmap.width + SPARSE_STEP - 1) / SPARSE_STEP;
+		int sparseRows = (heightmap.height + SPARSE_STEP - 1) / SPARSE_STEP;
+		std::vector<int32_t> rowMin(sparseRows), rowMax(sparseRows);
+
+		const ProceduralHeightmap* self = this;
+		int32_t* mins = rowMin.data();
+		int32_t* maxs = rowMax.data();
+		parallelFor(0, sparseRows, [=](int rowBegin, int rowEnd) {
+			std::vector<int32_t> row(sparseWidth);
+			for (int r = rowBegin; r < rowEnd; ++r)
+			{
+				self->evaluateRow(r * SPARSE_STEP, 0, SPARSE_STEP, sparseWidth, row.data());
+				mins[r] = *std::min_element(row.begin(), row.end());
+				maxs[r] = *std::max_element(row.begin(), row.end());
+			}
+		}, 4);
+
+		int32_t lo = *std::min_element(rowMin.begin(), rowMin.end());
+		int32_t hi = *std::max_element(rowMax.begin(), rowMax.end());
+		int32_t margin = (hi - lo) / 32 + 1;
+		lo -= margin;
+		hi += margin;
+
+		// value * 65535 / range as a 32.32 fixed point multiply
+		uint64_t scale = ((uint64_t)65535 << 32) / (uint64_t)(hi - lo);
+		uint16_t* texels = heightmap.texels.data();
+		int w = heightmap.width;
+
+		parallelFor(0, heightmap.height, [=](int rowBegin, int rowEnd) {
+			std::vector<int32_t> row(w);
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				self->evaluateRow(y, 0, 1, w, row.data());
+
+				uint16_t* out = texels + (size_t)y * w;
+				for (int x = 0; x < w; ++x)
+				{
+					int64_t offset = std::max((int64_t)0, (int64_t)row[x] - lo);
+					out[x] = (uint16_t)std::min((uint64_t)65535, ((uint64_t)offset * scale) >> 32);
+				}
+			}
+		}, 16);
+
+		generateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return heightmap;
+	}
+
+	// uploads the texels as a mipmapped GL_R16 texture, sampled like the loaded heightmap
+	static GLuint createTexture(const Heightmap& heightmap, int textureUnit)
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// rows of odd widths are not 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, heightmap.width, heightmap.height, 0, GL_RED, GL_UNSIGNED_SHORT, heightmap.texels.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		return texture;
+	}
+
+	// seamless water distortion for running without waterDUDV.png: a few sine waves with whole periods over the
+	// texture, packed like the asset (RG around 0.5), linear filtered without mips
+	static GLuint createDudvTexture(int size, int textureUnit)
+	{
+		const float twoPi = 6.28318531f;
+		const int waves[3][4] = { { 3, 2, 5, 4 }, { 7, -5, -6, 9 }, { 13, 11, 11, -14 } };	// u, v frequency of the r and g waves
+		const float amplitudes[3] = { 0.5f, 0.3f, 0.2f };
+
+		std::vector<unsigned char> texels((size_t)size * size * 2);
+		for (int y = 0; y < size; ++y)
+		{
+			for (int x = 0; x < size; ++x)
+			{
+				float u = twoPi * x / size, v = twoPi * y / size;
+				float r = 0.0f, g = 0.0f;
+				for (int w = 0; w < 3; ++w)
+				{
+					r += amplitudes[w] * std::sin(waves[w][0] * u + waves[w][1] * v + w);
+					g += amplitudes[w] * std::sin(waves[w][2] * u + waves[w][3] * v + 2 * w);
+				}
+				texels[((size_t)y * size + x) * 2] = (unsigned char)(127.5f + 127.5f * r);
+				texels[((size_t)y * size + x) * 2 + 1] = (unsigned char)(127.5f + 127.5f * g);
+			}
+		}
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, size, size, 0, GL_RG, GL_UNSIGNED_BYTE, texels.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		return texture;
+	}
+
+	double getGenerateMilliseconds() const
+	{
+		return generateMilliseconds;
+	}
+
+private:
+	static const int WARP_OCTAVES = 3;
+
+	// per octave hash seed and lattice offset (Q16), so octaves and layers never share lattice points
+	struct Octave {
+		int32_t seed = 0;
+		int32_t offsetX = 0;
+		int32_t offsetY = 0;
+	};
+
+	int baseShift = 0;				// log2 of the coarsest lattice cell in texels
+	std::vector<Octave> warpX, warpY, continents, ridges;
+	double generateMilliseconds = 0.0;
+
+	// splitmix style integer hash of a running state
+	static uint32_t nextRandom(uint32_t& state)
+	{
+		state += 0x9E3779B9u;
+		uint32_t z = state;
+		z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+		z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+		return z ^ (z >> 16);
+	}
+
+	void setup(int width, int height, uint32_t seed)
+	{
+		// lattice cells from a quarter of the map down to two texels
+		int size = std::max(width, height);
+		int sizeLog = 0;
+		while ((2 << sizeLog) <= size)
+			++sizeLog;
+		baseShift = std::max(3, std::min(sizeLog - 2, 12));
+
+		uint32_t state = seed;
+		auto octaves = [&](int count) {
+			std::vector<Octave> result(count);
+			for (Octave& octave : result)
+			{
+				octave.seed = (int32_t)(nextRandom(state) & 0xFFFF);
+				uint32_t x = nextRandom(state), y = nextRandom(state);
+				octave.offsetX = (int32_t)(x & 0x0FFFFFFF);
+				octave.offsetY = (int32_t)(y & 0x0FFFFFFF);
+			}
+			return result;
+		};
+
+		warpX = octaves(WARP_OCTAVES);
+		warpY = octaves(WARP_OCTAVES);
+		continents = octaves(baseShift);
+		ridges = octaves(baseShift - 1);
+	}
+
+	// int32 lanes: one texel, or four with SSE2. Products only take operands within int16 range (mul16), which SSE2
+	// computes exactly with pmaddwd against an operand whose upper halves are zero.
+	struct ScalarLanes {
+		typedef int32_t V;
+		static V set(int32_t v) { return v; }
+		static V add(V a, V b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+		static V sub(V a, V b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+		static V andv(V a, V b) { return a & b; }
+		static V orv(V a, V b) { return a | b; }
+		static V xorv(V a, V b) { return a ^ b; }
+		static V sra(V a, int n) { return a >> n; }
+		static V srl(V a, int n) { return (int32_t)((uint32_t)a >> n); }
+		static V sll(V a, int n) { return (int32_t)((uint32_t)a << n); }
+		static V mul16(V a, V b) { return (int32_t)(int16_t)a * (int32_t)(int16_t)b; }
+		static V cmpeq(V a, V b) { return a == b ? -1 : 0; }
+		static V cmpgt(V a, V b) { return a > b ? -1 : 0; }
+	};
+
+#ifdef TERRAIN_SIMD_SSE2
+	struct SseLanes {
+		typedef __m128i V;
+		static V set(int32_t v) { return _mm_set1_epi32(v); }
+		static V add(V a, V b) { return _mm_add_epi32(a, b); }
+		static V sub(V a, V b) { return _mm_sub_epi32(a, b); }
+		static V andv(V a, V b) { return _mm_and_si128(a, b); }
+		static V orv(V a, V b) { return _mm_or_si128(a, b); }
+		static V xorv(V a, V b) { return _mm_xor_si128(a, b); }
+		static V sra(V a, int n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+		static V srl(V a, int n) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+		static V sll(V a, int n) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+		static V mul16(V a, V b) { return _mm_madd_epi16(a, _mm_and_si128(b, _mm_set1_epi32(0xFFFF))); }
+		static V cmpeq(V a, V b) { return _mm_cmpeq_epi32(a, b); }
+		static V cmpgt(V a, V b) { return _mm_cmpgt_epi32(a, b); }
+	};
+#endif
+
+	template <typename L>
+	static typename L::V select(typename L::V mask, typename L::V a, typename L::V b)
+	{
+		return L::orv(L::andv(mask, a), L::andv(L::xorv(mask, L::set(-1)), b));
+	}
+
+	template <typename L>
+	static typename L::V minimum(typename L::V a, typename L::V b)
+	{
+		return select<L>(L::cmpgt(a, b), b, a);
+	}
+
+	template <typename L>
+	static typename L::V maximum(typename L::V a, typename L::V b)
+	{
+		return select<L>(L::cmpgt(a, b), a, b);
+	}
+
+	// v, or -v where mask is set
+	template <typename L>
+	static typename L::V negate(typename L::V v, typename L::V mask)
+	{
+		return L::sub(L::xorv(v, mask), mask);
+	}
+
+	// 16 bit hash of a lattice point
+	template <typename L>
+	static typename L::V hash(typename L::V ix, typename L::V iy, int32_t seed)
+	{
+		typedef typename L::V V;
+		const V mask = L::set(0xFFFF);
+		V h = L::andv(L::xorv(L::xorv(L::mul16(ix, L::set(0x6A09)), L::mul16(iy, L::set(0x3C6F))), L::set(seed)), mask);
+		h = L::xorv(h, L::srl(h, 8));
+		h = L::andv(L::mul16(h, L::set(0x2C1B)), mask);
+		h = L::xorv(h, L::srl(h, 7));
+		h = L::andv(L::mul16(h, L::set(0x5BD1)), mask);
+		return L::xorv(h, L::srl(h, 8));
+	}
+
+	// dot product of one of eight gradients (four diagonal, four axis aligned) with the Q15 offset, in [-16383, 16383]
+	template <typename L>
+	static typename L::V gradient(typename L::V h, typename L::V dx, typename L::V dy)
+	{
+		typedef typename L::V V;
+		V g = L::srl(h, 13);
+		V negativeX = L::cmpeq(L::andv(g, L::set(1)), L::set(1));
+		V alongY = L::cmpeq(L::andv(g, L::set(2)), L::set(2));
+		V diagonal = L::cmpeq(L::andv(g, L::set(4)), L::set(0));
+
+		V useX = L::orv(diagonal, L::xorv(alongY, L::set(-1)));
+		V useY = L::orv(diagonal, alongY);
+		V negativeY = select<L>(diagonal, alongY, negativeX);
+
+		V dot = L::add(L::andv(useX, negate<L>(dx, negativeX)), L::andv(useY, negate<L>(dy, negativeY)));
+		return maximum<L>(L::sra(dot, 2), L::set(-16383));
+	}
+
+	// 6t^5 - 15t^4 + 10t^3 of a Q15 t, the polynomial factor in Q11
+	template <typename L>
+	static typename L::V fade(typename L::V t)
+	{
+		typedef typename L::V V;
+		V t2 = L::sra(L::mul16(t, t), 15);
+		V t3 = L::sra(L::mul16(t2, t), 15);
+		V sixT2 = L::add(L::sll(t2, 2), L::sll(t2, 1));
+		V fifteenT = L::sub(L::sll(t, 4), t);
+		V polynomial = L::sra(L::add(L::sub(sixT2, fifteenT), L::set(10 * 32768)), 4);
+		return L::sra(L::mul16(t3, polynomial), 11);
+	}
+
+	template <typename L>
+	static typename L::V lerp(typename L::V a, typename L::V b, typename L::V s)
+	{
+		return L::add(a, L::sra(L::mul16(L::sub(b, a), s), 15));
+	}
+
+	// gradient noise of Q16 texel positions on a lattice of 2^shift texel cells, in [-16383, 16383]
+	template <typename L>
+	static typename L::V noise(typename L::V px, typename L::V py, int shift, const Octave& octave)
+	{
+		typedef typename L::V V;
+		V lx = L::add(L::sra(px, shift), L::set(octave.offsetX));
+		V ly = L::add(L::sra(py, shift), L::set(octave.offsetY));
+
+		V ix = L::sra(lx, 16), iy = L::sra(ly, 16);
+		V ix1 = L::add(ix, L::set(1)), iy1 = L::add(iy, L::set(1));
+		V fx = L::srl(L::andv(lx, L::set(0xFFFF)), 1), fy = L::srl(L::andv(ly, L::set(0xFFFF)), 1);
+		V fx1 = L::sub(fx, L::set(32768)), fy1 = L::sub(fy, L::set(32768));
+
+		V d00 = gradient<L>(hash<L>(ix, iy, octave.seed), fx, fy);
+		V d10 = gradient<L>(hash<L>(ix1, iy, octave.seed), fx1, fy);
+		V d01 = gradient<L>(hash<L>(ix, iy1, octave.seed), fx, fy1);
+		V d11 = gradient<L>(hash<L>(ix1, iy1, octave.seed), fx1, fy1);
+
+		V sx = fade<L>(fx), sy = fade<L>(fy);
+		return lerp<L>(lerp<L>(d00, d10, sx), lerp<L>(d01, d11, sx), sy);
+	}
+
+	// octaves halving the cell size and the amplitude, in about [-32766, 32766]
+	template <typename L>
+	static typename L::V fbm(typename L::V px, typename L::V py, int firstShift, const std::vector<Octave>& octaves)
+	{
+		typename L::V sum = L::set(0);
+		for (int i = 0; i < (int)octaves.size() && firstShift - i >= 1; ++i)
+			sum = L::add(sum, L::sra(noise<L>(px, py, firstShift - i, octaves[i]), i));
+		return sum;
+	}
+
+	// Musgrave's ridged multifractal: sharp crests where the noise crosses zero, finer octaves weighted by the
+	// coarser ridges so valleys stay smooth, in [0, 32766]
+	template <typename L>
+	static typename L::V ridged(typename L::V px, typename L::V py, int firstShift, const std::vector<Octave>& octaves)
+	{
+		typedef typename L::V V;
+		V sum = L::set(0);
+		V weight = L::set(16383);
+		for (int i = 0; i < (int)octaves.size() && firstShift - i >= 1; ++i)
+		{
+			V n = noise<L>(px, py, firstShift - i, octaves[i]);
+			V ridge = L::sub(L::set(16383), negate<L>(n, L::sra(n, 31)));
+			ridge = L::sra(L::mul16(ridge, ridge), 14);
+			ridge = L::sra(L::mul16(ridge, weight), 14);
+			weight = minimum<L>(L::sll(ridge, 1), L::set(16383));
+			sum = L::add(sum, L::sra(ridge, i));
+		}
+		return sum;
+	}
+
+	// unnormalized height of texel (x, y)
+	template <typename L>
+	typename L::V heightAt(typename L::V x, typename L::V y) const
+	{
+		typedef typename L::V V;
+		V px = L::add(L::sll(x, 16), L::set(0x8000));
+		V py = L::add(L::sll(y, 16), L::set(0x8000));
+
+		// warp the position by up to about a fifth of the coarsest cell
+		V warpedX = L::add(px, L::sll(fbm<L>(px, py, baseShift, warpX), baseShift - 1));
+		V warpedY = L::add(py, L::sll(fbm<L>(px, py, baseShift, warpY), baseShift - 1));
+
+		V land = fbm<L>(warpedX, warpedY, baseShift, continents);
+		V mountains = ridged<L>(warpedX, warpedY, baseShift - 1, ridges);
+
+		// mountains rise on the higher ground only, over lowlands flattened to half height
+		V mask = minimum<L>(maximum<L>(L::sll(L::add(land, L::set(4096)), 1), L::set(0)), L::set(16383));
+		return L::add(L::sra(land, 1), L::sra(L::mul16(mountains, mask), 12));
+	}
+
+	// heights of count texels of row y, from x0 in steps of stride
+	void evaluateRow(int y, int x0, int stride, int count, int32_t* out) const
+	{
+		int i = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		__m128i vy = _mm_set1_epi32(y);
+		for (; i + 4 <= count; i += 4)
+		{
+			int x = x0 + i * stride;
+			__m128i vx = _mm_setr_epi32(x, x + stride, x + 2 * stride, x + 3 * stride);
+			_mm_storeu_si128((__m128i*)(out + i), heightAt<SseLanes>(vx, vy));
+		}
+#endif
+		for (; i < count; ++i)
+			out[i] = heightAt<ScalarLanes>(x0 + i * stride, y);
+	}
+};
+
+#endif	// PROCEDURALHEIGHTMAP_H
@@ -0,0 +1,181 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+// Timeline of named CPU scopes (any thread) and GPU pass durations, kept in a ring of the last MAX_EVENTS events
+// and written out as Chrome trace_event JSON (chrome://tracing, Perfetto). While disabled a scope costs one relaxed
+// atomic load. Scope names have to be string literals or otherwise outlive the profiler.
+class Profiler {
+public:
+	static const int MAX_EVENTS = 1 << 16;
+
+	// trace track of the GPU pass durations
+	static const int GPU_TRACK = 0;
+
+	static Profiler& instance()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	void setEnabled(bool enable)
+	{
+		enabled.store(enable, std::memory_order_relaxed);
+	}
+
+	// microseconds since the profiler was created, the trace time base
+	double now() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+	}
+
+	// a finished event on the calling thread's track
+	void addEvent(const char* name, double startUs, double durationUs)
+	{
+		addEvent(name, startUs, durationUs, threadTrack());
+	}
+
+	void addEvent(const char* name, double startUs, double durationUs, int track)
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+		Event& event = events[next % MAX_EVENTS];
+		event.name = name;
+		event.start = startUs;
+		event.duration = durationUs;
+		event.track = track;
+		event.counter = false;
+		++next;
+	}
+
+	// a value plotted over time, e.g. primitives per pass
+	void addCounter(const char* name, double value)
+	{
+		double timestamp = now();
+		std::lock_guard<std::mutex> lock(eventMutex);
+		Event& event = events[next % MAX_EVENTS];
+		event.name = name;
+		event.start = timestamp;
+		event.duration = value;
+		event.track = GPU_TRACK;
+		event.counter = true;
+		++next;
+	}
+
+	// writes the recorded events as a trace_event JSON file, returns false when it can't be written;
+	// otherData is the body of a JSON object stored next to the events (e.g. "\"key\": [1, 2]")
+	bool writeTrace(const std::string& path, const std::string& otherData = std::string())
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			std::cout << "Failed to write trace " << path << std::endl;
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(eventMutex);
+		size_t count = std::min(next, (size_t)MAX_EVENTS);
+
+		file << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		file << "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << GPU_TRACK << ", \"args\": { \"name\": \"GPU\" } }";
+		for (int t = 1; t < trackCount.load(); ++t)
+			file << ",\n  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t << ", \"args\": { \"name\": \"thread " << t << "\" } }";
+
+		file.setf(std::ios::fixed);
+		file.precision(3);
+		for (size_t i = next - count; i < next; ++i)
+		{
+			const Event& event = events[i % MAX_EVENTS];
+			if (event.counter)
+			{
+				file << ",\n  { \"name\": \"" << event.name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << event.start
+					<< ", \"args\": { \"value\": " << event.duration << " } }";
+				continue;
+			}
+			file << ",\n  { \"name\": \"" << event.name << "\", \"cat\": \"" << (event.track == GPU_TRACK ? "gpu" : "cpu")
+				<< "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.track << ", \"ts\": " << event.start
+				<< ", \"dur\": " << event.duration << " }";
+		}
+		file << "\n]";
+		if (!otherData.empty())
+			file << ",\n\"otherData\": { " << otherData << " }";
+		file << " }\n";
+
+		std::cout << "Wrote " << count << " trace events to " << path << std::endl;
+		return true;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+		next = 0;
+	}
+
+private:
+	struct Event {
+		const char* name = "";
+		double start = 0.0;
+		double duration = 0.0;			// the value of counters
+		int track = 0;
+		bool counter = false;
+	};
+
+	std::atomic<bool> enabled{ false };
+	std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+	std::mutex eventMutex;
+	std::vector<Event> events = std::vector<Event>(MAX_EVENTS);
+	size_t next = 0;					// total events recorded, the ring keeps the last MAX_EVENTS
+
+	std::atomic<int> trackCount{ 1 };
+
+	Profiler() {}
+
+	// every thread gets its own track, numbered in order of its first event
+	int threadTrack()
+	{
+		thread_local int track = trackCount.fetch_add(1);
+		return track;
+	}
+};
+
+// times the enclosing block on the calling thread's track
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* scopeName)
+	{
+		if (!Profiler::instance().isEnabled())
+			return;
+
+		name = scopeName;
+		start = Profiler::instance().now();
+	}
+
+	~ProfileScope()
+	{
+		if (name)
+			Profiler::instance().addEvent(name, start, Profiler::instance().now() - start);
+	}
+
+private:
+	const char* name = nullptr;
+	double start = 0.0;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#endif	// PROFILER_H
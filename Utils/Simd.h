@@ -0,0 +1,10 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// SSE2 is part of every x86-64 target; other architectures use the scalar paths
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#endif	// SIMD_H
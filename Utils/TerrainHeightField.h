@@ -0,0 +1,217 @@
+#ifndef TERRAINHEIGHTFIELD_H
+#define TERRAINHEIGHTFIELD_H
+
+#include <Heightmap.h>
+#include <Simd.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// CPU terrain height and normal queries in world space (x, z), matching the displacement of Shader.TES:
+// the patch grid spans [-worldWidth / 2, worldWidth / 2] x [-worldHeight / 2, worldHeight / 2] with texture
+// coordinates running linearly across it, and the heightmap is sampled like the GL_LINEAR / GL_REPEAT R16
+// texture (bilinear between texel centers, wrapping at the edges). Results equal the TES at its tessellated
+// vertices up to the sub-texel weight precision of the GPU filter.
+// The batched queries take positions as separate x / z arrays and evaluate 4 points per SSE2 step.
+class TerrainHeightField {
+public:
+	TerrainHeightField() {}
+
+	// keeps a copy of the heightmap texels; worldWidth / worldHeight is the size of the rendered patch grid,
+	// which differs from the heightmap size when the heightmap is a reduced overview
+	void build(const Heightmap& heightmap, float worldWidth, float worldHeight)
+	{
+		width = heightmap.width;
+		height = heightmap.height;
+		texels = heightmap.texels;
+		heightScale = heightmap.heightScale;
+		heightOffset = heightmap.heightOffset;
+
+		// texel coordinate = (x / worldWidth + 0.5) * width - 0.5
+		scaleX = width / worldWidth;
+		scaleZ = height / worldHeight;
+		biasX = width * 0.5f - 0.5f;
+		biasZ = height * 0.5f - 0.5f;
+	}
+
+	bool isValid() const
+	{
+		return width > 0 && height > 0 && !texels.empty();
+	}
+
+	float getHeight(float x, float z) const
+	{
+		float result;
+		getHeights(&x, &z, &result, 1);
+		return result;
+	}
+
+	glm::vec3 getNormal(float x, float z) const
+	{
+		float h;
+		glm::vec3 normal;
+		getHeightsAndNormals(&x, &z, &h, &normal, 1);
+		return normal;
+	}
+
+	void getHeights(const float* x, const float* z, float* heights, size_t count) const
+	{
+		sample(x, z, heights, nullptr, count);
+	}
+
+	// normals of the bilinear surface, the analytic gradient inside the texel cell the point falls in
+	void getHeightsAndNormals(const float* x, const float* z, float* heights, glm::vec3* normals, size_t count) const
+	{
+		sample(x, z, heights, normals, count);
+	}
+
+private:
+	int width = 0;
+	int height = 0;
+	std::vector<uint16_t> texels;
+
+	float heightScale = 64.0f;
+	float heightOffset = -16.0f;
+	float scaleX = 1.0f, scaleZ = 1.0f;
+	float biasX = 0.0f, biasZ = 0.0f;
+
+	// bilinear cell of 4 points: wrapped texel indices of the corners and the weights inside the cell
+	struct Cell {
+		alignas(16) int32_t x0[4], x1[4], y0[4], y1[4];
+		alignas(16) float fx[4], fy[4];
+	};
+
+	void sample(const float* x, const float* z, float* heights, glm::vec3* normals, size_t count) const
+	{
+		if (!isValid())
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				heights[i] = heightOffset;
+				if (normals)
+					normals[i] = glm::vec3(0.0f, 1.0f, 0.0f);
+			}
+			return;
+		}
+
+		// slope of one texel step in world units, scaled to height
+		float slopeX = heightScale / 65535.0f * scaleX;
+		float slopeZ = heightScale / 65535.0f * scaleZ;
+
+		size_t i = 0;
+#ifdef TERRAIN_SIMD_SSE2
+		for (; i + 4 <= count; i += 4)
+		{
+			Cell cell;
+			locateCell(_mm_loadu_ps(x + i), _mm_loadu_ps(z + i), cell);
+
+			alignas(16) float h00[4], h10[4], h01[4], h11[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				const uint16_t* row0 = texels.data() + (size_t)cell.y0[k] * width;
+				const uint16_t* row1 = texels.data() + (size_t)cell.y1[k] * width;
+				h00[k] = row0[cell.x0[k]];
+				h10[k] = row0[cell.x1[k]];
+				h01[k] = row1[cell.x0[k]];
+				h11[k] = row1[cell.x1[k]];
+			}
+
+			__m128 fx = _mm_load_ps(cell.fx), fy = _mm_load_ps(cell.fy);
+			__m128 v00 = _mm_load_ps(h00), v10 = _mm_load_ps(h10), v01 = _mm_load_ps(h01), v11 = _mm_load_ps(h11);
+			__m128 top = lerp(v00, v10, fx);
+			__m128 bottom = lerp(v01, v11, fx);
+			__m128 value = lerp(top, bottom, fy);
+
+			const __m128 toHeight = _mm_set1_ps(heightScale / 65535.0f);
+			_mm_storeu_ps(heights + i, _mm_add_ps(_mm_mul_ps(value, toHeight), _mm_set1_ps(heightOffset)));
+
+			if (normals)
+			{
+				alignas(16) float dx[4], dz[4];
+				_mm_store_ps(dx, lerp(_mm_sub_ps(v10, v00), _mm_sub_ps(v11, v01), fy));
+				_mm_store_ps(dz, _mm_sub_ps(bottom, top));
+				for (int k = 0; k < 4; ++k)
+					normals[i + k] = glm::normalize(glm::vec3(-dx[k] * slopeX, 1.0f, -dz[k] * slopeZ));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			int x0, x1, y0, y1;
+			float fx, fy;
+			locateAxis(x[i] * scaleX + biasX, width, x0, x1, fx);
+			locateAxis(z[i] * scaleZ + biasZ, height, y0, y1, fy);
+
+			const uint16_t* row0 = texels.data() + (size_t)y0 * width;
+			const uint16_t* row1 = texels.data() + (size_t)y1 * width;
+			float v00 = row0[x0], v10 = row0[x1], v01 = row1[x0], v11 = row1[x1];
+
+			float top = v00 + (v10 - v00) * fx;
+			float bottom = v01 + (v11 - v01) * fx;
+			float value = top + (bottom - top) * fy;
+			heights[i] = value * (heightScale / 65535.0f) + heightOffset;
+
+			if (normals)
+			{
+				float dx = (v10 - v00) + ((v11 - v01) - (v10 - v00)) * fy;
+				float dz = bottom - top;
+				normals[i] = glm::normalize(glm::vec3(-dx * slopeX, 1.0f, -dz * slopeZ));
+			}
+		}
+	}
+
+	// texel coordinate s on an axis of the given size: wraps it into [0, size), then splits it into the
+	// two GL_REPEAT neighbours and the weight of the second one
+	static void locateAxis(float s, int size, int& i0, int& i1, float& f)
+	{
+		s -= std::floor(s / size) * size;
+		float base = std::floor(s);
+		f = s - base;
+		i0 = std::min((int)base, size - 1);
+		i1 = i0 + 1 == size ? 0 : i0 + 1;
+	}
+
+#ifdef TERRAIN_SIMD_SSE2
+	static __m128 lerp(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	// SSE2 has no floor, truncate and step down where that rounded up
+	static __m128 floorPs(__m128 v)
+	{
+		__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, v), _mm_set1_ps(1.0f)));
+	}
+
+	static void locateAxis(__m128 s, int size, int32_t* i0, int32_t* i1, float* f)
+	{
+		__m128 sizePs = _mm_set1_ps((float)size);
+		s = _mm_sub_ps(s, _mm_mul_ps(floorPs(_mm_div_ps(s, sizePs)), sizePs));
+		__m128 base = floorPs(s);
+		_mm_store_ps(f, _mm_sub_ps(s, base));
+
+		// rounding can land exactly on size, clamp to size - 1 and wrap the right neighbour to 0
+		__m128i last = _mm_set1_epi32(size - 1);
+		__m128i index = _mm_cvttps_epi32(base);
+		__m128i over = _mm_cmpgt_epi32(index, last);
+		index = _mm_or_si128(_mm_and_si128(over, last), _mm_andnot_si128(over, index));
+		__m128i next = _mm_andnot_si128(_mm_cmpeq_epi32(index, last), _mm_add_epi32(index, _mm_set1_epi32(1)));
+
+		_mm_store_si128((__m128i*)i0, index);
+		_mm_store_si128((__m128i*)i1, next);
+	}
+
+	void locateCell(__m128 x, __m128 z, Cell& cell) const
+	{
+		locateAxis(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(scaleX)), _mm_set1_ps(biasX)), width, cell.x0, cell.x1, cell.fx);
+		locateAxis(_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(scaleZ)), _mm_set1_ps(biasZ)), height, cell.y0, cell.y1, cell.fy);
+	}
+#endif
+};
+
+#endif	// TERRAINHEIGHTFIELD_H
@@ -0,0 +1,296 @@
+#ifndef TERRAINMATERIALS_H
+#define TERRAINMATERIALS_H
+
+#include <glad/glad.h>
+
+#include <Heightmap.h>
+#include <NormalMap.h>
+#include <TextureLoader.h>
+#include <ParallelFor.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// one terrain material: fully present inside its height and slope ranges, fading out linearly over the fade
+// widths outside of them. Heights are normalized over the heightmap range (0 lowest, 1 highest), slopes in degrees.
+struct MaterialLayer {
+	std::string texture;
+	float minHeight = 0.0f;
+	float maxHeight = 1.0f;
+	float heightFade = 0.25f;
+	float minSlope = 0.0f;
+	float maxSlope = 90.0f;
+	float slopeFade = 0.0f;
+};
+
+// Terrain materials as data: the layer textures are packed into one GL_TEXTURE_2D_ARRAY with shared mips, and the
+// per texel blend weights of up to 4 layers are precomputed from the heightmap and normal map into an RGBA8 splat
+// texture, so the fragment shader always takes 4 array samples without branching.
+class TerrainMaterials {
+public:
+	static const int MAX_LAYERS = 4;
+
+	TerrainMaterials()
+	{
+		// the former height bands: dirt, dirt, grass, snow with linear blends between neighbours
+		const char* textures[MAX_LAYERS] = { "dirt1.png", "dirt4.png", "grass_mossy.png", "snow01.png" };
+		const float peaks[MAX_LAYERS][2] = { { 0.0f, 0.25f }, { 0.5f, 0.5f }, { 0.754f, 0.754f }, { 1.0f, 1.0f } };
+
+		for (int l = 0; l < MAX_LAYERS; ++l)
+		{
+			MaterialLayer layer;
+			layer.texture = textures[l];
+			layer.minHeight = peaks[l][0];
+			layer.maxHeight = peaks[l][1];
+			layers.push_back(layer);
+		}
+	}
+
+	// one layer per line: texture minHeight maxHeight heightFade [minSlope maxSlope slopeFade], # starts a comment
+	bool load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "Failed to open material list " << path << std::endl;
+			return false;
+		}
+
+		std::vector<MaterialLayer> loaded;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+
+			std::istringstream stream(line);
+			MaterialLayer layer;
+			if (!(stream >> layer.texture >> layer.minHeight >> layer.maxHeight >> layer.heightFade))
+				continue;
+			stream >> layer.minSlope >> layer.maxSlope >> layer.slopeFade;
+
+			if ((int)loaded.size() == MAX_LAYERS)
+			{
+				std::cout << "WARNING::MATERIALS: only the first " << MAX_LAYERS << " layers of " << path << " are used" << std::endl;
+				break;
+			}
+			loaded.push_back(layer);
+		}
+
+		if (loaded.empty())
+		{
+			std::cout << "Material list " << path << " has no layers" << std::endl;
+			return false;
+		}
+
+		layers = loaded;
+		std::cout << "Loaded material list " << path << " with " << layers.size() << " layers" << std::endl;
+		return true;
+	}
+
+	const std::vector<MaterialLayer>& getLayers() const
+	{
+		return layers;
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+	// layer textures have to be loaded with keepPixels, 4 channels and 8 bits; every layer is resampled to
+	// the size of the first one. Without any decoded layer the array is only created with a fallbackSize,
+	// all layers mid gray
+	GLuint createArrayTexture(const TextureLoader& loader, const std::vector<int>& assets, int textureUnit, int fallbackSize = 0) const
+	{
+		int width = 0, height = 0;
+		for (size_t l = 0; l < assets.size() && width == 0; ++l)
+		{
+			if (loader.get(assets[l]).pixels)
+			{
+				width = loader.get(assets[l]).width;
+				height = loader.get(assets[l]).height;
+			}
+		}
+		if (width == 0)
+		{
+			if (fallbackSize <= 0)
+				return 0;
+			width = height = fallbackSize;
+		}
+		size_t layerCount = std::max<size_t>(1, assets.size());
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, (GLsizei)layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+		std::vector<unsigned char> resampled;
+		for (size_t l = 0; l < layerCount; ++l)
+		{
+			LoadedTexture missing;
+			const LoadedTexture& layer = l < assets.size() ? loader.get(assets[l]) : missing;
+			const unsigned char* pixels = (const unsigned char*)layer.pixels;
+			if (!pixels || layer.channels != 4 || layer.pixelType != GL_UNSIGNED_BYTE)
+			{
+				// missing layers are left mid gray instead of undefined
+				resampled.assign((size_t)width * height * 4, 128);
+				pixels = resampled.data();
+			}
+			else if (layer.width != width || layer.height != height)
+			{
+				std::cout << "WARNING::MATERIALS: layer " << l << " is " << layer.width << " x " << layer.height
+					<< ", resampled to " << width << " x " << height << std::endl;
+				resample(pixels, layer.width, layer.height, resampled, width, height);
+				pixels = resampled.data();
+			}
+
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)l, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		}
+
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		return texture;
+	}
+
+	// blend weights of every layer per heightmap texel, normalized to a sum of 1
+	void buildSplatMap(const Heightmap& heightmap, const NormalMap& normalMap)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		splatWidth = heightmap.width;
+		splatHeight = heightmap.height;
+		splat.assign((size_t)splatWidth * splatHeight * 4, 0);
+		if (!heightmap.isValid())
+			return;
+
+		bool useSlopes = normalMap.getWidth() == splatWidth && normalMap.getHeight() == splatHeight;
+		const MaterialLayer* layerData = layers.data();
+		int layerCount = (int)layers.size();
+		int w = splatWidth;
+		unsigned char* out = splat.data();
+
+		parallelFor(0, splatHeight, [&, layerData, layerCount, w, out](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				for (int x = 0; x < w; ++x)
+				{
+					float value = heightmap.texel(x, y) / 65535.0f;
+					float slope = useSlopes ? std::acos(std::min(1.0f, normalMap.getNormalY(x, y))) * 57.29578f : 0.0f;
+
+					float weights[MAX_LAYERS] = {};
+					float sum = 0.0f;
+					for (int l = 0; l < layerCount; ++l)
+					{
+						const MaterialLayer& layer = layerData[l];
+						weights[l] = rangeWeight(value, layer.minHeight, layer.maxHeight, layer.heightFade)
+							* rangeWeight(slope, layer.minSlope, layer.maxSlope, layer.slopeFade);
+						sum += weights[l];
+					}
+
+					// texels outside every range take the layer whose height range is closest
+					if (sum <= 0.0f)
+					{
+						int closest = 0;
+						float closestDistance = INFINITY;
+						for (int l = 0; l < layerCount; ++l)
+						{
+							float distance = std::max(layerData[l].minHeight - value, value - layerData[l].maxHeight);
+							if (distance < closestDistance)
+							{
+								closestDistance = distance;
+								closest = l;
+							}
+						}
+						weights[closest] = sum = 1.0f;
+					}
+
+					unsigned char* texel = out + ((size_t)y * w + x) * 4;
+					for (int l = 0; l < MAX_LAYERS; ++l)
+						texel[l] = (unsigned char)(weights[l] / sum * 255.0f + 0.5f);
+				}
+			}
+		}, 64);
+
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// uploads the splat weights as a mipmapped GL_RGBA8 texture laid out like the heightmap
+	GLuint createSplatTexture(int textureUnit) const
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, splatWidth, splatHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, splat.data());
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		return texture;
+	}
+
+private:
+	std::vector<MaterialLayer> layers;
+
+	int splatWidth = 0;
+	int splatHeight = 0;
+	std::vector<unsigned char> splat;		// RGBA8, one weight per layer
+	double buildMilliseconds = 0.0;
+
+	// 1 inside [lo, hi], falling to 0 over fade on both sides
+	static float rangeWeight(float value, float lo, float hi, float fade)
+	{
+		if (fade <= 0.0f)
+			return (value >= lo && value <= hi) ? 1.0f : 0.0f;
+		return std::max(0.0f, std::min(1.0f, std::min(value - lo, hi - value) / fade + 1.0f));
+	}
+
+	// bilinear RGBA8 resample, only used when layer sizes differ
+	static void resample(const unsigned char* src, int srcWidth, int srcHeight, std::vector<unsigned char>& dst, int width, int height)
+	{
+		dst.resize((size_t)width * height * 4);
+		for (int y = 0; y < height; ++y)
+		{
+			float sy = std::max(0.0f, (y + 0.5f) * srcHeight / height - 0.5f);
+			int y0 = std::min((int)sy, srcHeight - 1), y1 = std::min(y0 + 1, srcHeight - 1);
+			float fy = sy - y0;
+
+			for (int x = 0; x < width; ++x)
+			{
+				float sx = std::max(0.0f, (x + 0.5f) * srcWidth / width - 0.5f);
+				int x0 = std::min((int)sx, srcWidth - 1), x1 = std::min(x0 + 1, srcWidth - 1);
+				float fx = sx - x0;
+
+				for (int c = 0; c < 4; ++c)
+				{
+					float top = src[((size_t)y0 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[((size_t)y0 * srcWidth + x1) * 4 + c] * fx;
+					float bottom = src[((size_t)y1 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[((size_t)y1 * srcWidth + x1) * 4 + c] * fx;
+					dst[((size_t)y * width + x) * 4 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+				}
+			}
+		}
+	}
+};
+
+#endif	// TERRAINMATERIALS_H
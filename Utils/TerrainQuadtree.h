@@ -0,0 +1,248 @@
+#ifndef TERRAINQUADTREE_H
+#define TERRAINQUADTREE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <Frustum.h>
+#include <HeightPyramid.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <algorithm>
+
+// visible / culled patch counters of a single culling pass
+struct PatchCullStats {
+	int visiblePatches = 0;
+	int culledPatches = 0;
+};
+
+// list of contiguous patch ranges ready to be submitted with glMultiDrawArrays
+struct PatchDrawList {
+	std::vector<GLint> first;
+	std::vector<GLsizei> count;
+
+	void clear()
+	{
+		first.clear();
+		count.clear();
+	}
+
+	void draw() const
+	{
+		if (!first.empty())
+			glMultiDrawArrays(GL_PATCHES, first.data(), count.data(), (GLsizei)first.size());
+	}
+};
+
+// Quadtree over the rez x rez patch grid built in main.cpp. Patch (i, j) starts at vertex
+// (i * rez + j) * patchPoints and spans [i, i + 1] x [j, j + 1] grid cells; every node keeps
+// a world space AABB that includes the real min/max displaced heights of the patches below it
+class TerrainQuadtree {
+public:
+	struct Node {
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		int i0, j0, i1, j1;		// covered patch range, [i0, i1) x [j0, j1)
+		int children[4];
+		int childCount;
+	};
+
+	TerrainQuadtree() {}
+
+	// builds the tree over a width x height terrain; patch heights come from the min/max pyramid,
+	// which maps them the same way as Shader.TES (its texels may be coarser than a world unit)
+	void build(unsigned int rez, int width, int height, const HeightPyramid& pyramid, unsigned int patchPoints = 4)
+	{
+		gridRez = (int)rez;
+		pointsPerPatch = (int)patchPoints;
+		nodes.clear();
+		patchMinHeight.assign(gridRez * gridRez, 0.0f);
+		patchMaxHeight.assign(gridRez * gridRez, 0.0f);
+
+		computePatchHeights(pyramid.getSourceWidth(), pyramid.getSourceHeight(), pyramid);
+
+		mapWidth = (float)width;
+		mapHeight = (float)height;
+		buildNode(0, 0, gridRez, gridRez);
+	}
+
+	// collects every patch whose bounds intersect the frustum and the optional clipping plane
+	// (a zero plane disables the clip test) into contiguous draw ranges
+	PatchCullStats cull(const Frustum& frustum, const glm::vec4& clippingPlane, PatchDrawList& drawList)
+	{
+		PROFILE_SCOPE("quadtree cull");
+
+		drawList.clear();
+		ranges.clear();
+
+		PatchCullStats stats;
+		if (!nodes.empty())
+			cullNode(0, frustum, clippingPlane, clippingPlane != glm::vec4(0.0f), stats);
+
+		// emit the ranges in vertex order so neighbouring rows collapse into a single draw
+		std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) { return a.first < b.first; });
+		for (size_t k = 0; k < ranges.size(); ++k)
+		{
+			if (!drawList.first.empty() && drawList.first.back() + drawList.count.back() == ranges[k].first)
+				drawList.count.back() += ranges[k].count;
+			else
+			{
+				drawList.first.push_back(ranges[k].first);
+				drawList.count.push_back(ranges[k].count);
+			}
+		}
+
+		stats.culledPatches = gridRez * gridRez - stats.visiblePatches;
+		return stats;
+	}
+
+	int getPatchCount() const
+	{
+		return gridRez * gridRez;
+	}
+
+	int getGridRez() const
+	{
+		return gridRez;
+	}
+
+	// displaced height bounds of patch (i, j) at index i * rez + j
+	const std::vector<float>& getPatchMinHeights() const
+	{
+		return patchMinHeight;
+	}
+
+	const std::vector<float>& getPatchMaxHeights() const
+	{
+		return patchMaxHeight;
+	}
+
+	const std::vector<Node>& getNodes() const
+	{
+		return nodes;
+	}
+
+private:
+	struct Range {
+		GLint first;
+		GLsizei count;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Range> ranges;
+	std::vector<float> patchMinHeight;
+	std::vector<float> patchMaxHeight;
+
+	int gridRez = 0;
+	int pointsPerPatch = 4;
+	float mapWidth = 0.0f;
+	float mapHeight = 0.0f;
+
+	// bounds of the texels touched by each patch; one extra texel on every side (wrapped like GL_REPEAT)
+	// keeps them conservative with respect to bilinear filtering in the TES
+	void computePatchHeights(int width, int height, const HeightPyramid& pyramid)
+	{
+		for (int i = 0; i < gridRez; ++i)
+		{
+			int x0 = (int)((float)i / gridRez * width) - 1;
+			int x1 = (int)((float)(i + 1) / gridRez * width) + 1;
+
+			for (int j = 0; j < gridRez; ++j)
+			{
+				int y0 = (int)((float)j / gridRez * height) - 1;
+				int y1 = (int)((float)(j + 1) / gridRez * height) + 1;
+
+				pyramid.queryHeights(x0, y0, x1, y1, patchMinHeight[i * gridRez + j], patchMaxHeight[i * gridRez + j]);
+			}
+		}
+	}
+
+	int buildNode(int i0, int j0, int i1, int j1)
+	{
+		int index = (int)nodes.size();
+		nodes.push_back(Node());
+
+		Node node;
+		node.i0 = i0;
+		node.j0 = j0;
+		node.i1 = i1;
+		node.j1 = j1;
+		node.childCount = 0;
+		node.boundsMin = glm::vec3(-mapWidth / 2.0f + mapWidth * i0 / (float)gridRez, 0.0f,
+			-mapHeight / 2.0f + mapHeight * j0 / (float)gridRez);
+		node.boundsMax = glm::vec3(-mapWidth / 2.0f + mapWidth * i1 / (float)gridRez, 0.0f,
+			-mapHeight / 2.0f + mapHeight * j1 / (float)gridRez);
+
+		if (i1 - i0 == 1 && j1 - j0 == 1)
+		{
+			node.boundsMin.y = patchMinHeight[i0 * gridRez + j0];
+			node.boundsMax.y = patchMaxHeight[i0 * gridRez + j0];
+		}
+		else
+		{
+			// split every dimension that is still wider than one patch
+			int iMid = i1 - i0 > 1 ? (i0 + i1) / 2 : i1;
+			int jMid = j1 - j0 > 1 ? (j0 + j1) / 2 : j1;
+			int iSplits[3] = { i0, iMid, i1 };
+			int jSplits[3] = { j0, jMid, j1 };
+
+			node.boundsMin.y = 1e30f;
+			node.boundsMax.y = -1e30f;
+
+			for (int a = 0; a < 2; ++a)
+			{
+				for (int b = 0; b < 2; ++b)
+				{
+					if (iSplits[a] == iSplits[a + 1] || jSplits[b] == jSplits[b + 1])
+						continue;
+
+					int child = buildNode(iSplits[a], jSplits[b], iSplits[a + 1], jSplits[b + 1]);
+					node.children[node.childCount++] = child;
+					node.boundsMin.y = std::min(node.boundsMin.y, nodes[child].boundsMin.y);
+					node.boundsMax.y = std::max(node.boundsMax.y, nodes[child].boundsMax.y);
+				}
+			}
+		}
+
+		nodes[index] = node;
+		return index;
+	}
+
+	void cullNode(int index, const Frustum& frustum, const glm::vec4& clippingPlane, bool useClippingPlane, PatchCullStats& stats)
+	{
+		const Node& node = nodes[index];
+
+		Frustum::TestResult result = frustum.testAABB(node.boundsMin, node.boundsMax);
+		if (result == Frustum::OUTSIDE)
+			return;
+
+		if (useClippingPlane)
+		{
+			Frustum::TestResult clipResult = Frustum::testPlane(clippingPlane, node.boundsMin, node.boundsMax);
+			if (clipResult == Frustum::OUTSIDE)
+				return;
+			if (clipResult == Frustum::INTERSECTING)
+				result = Frustum::INTERSECTING;
+		}
+
+		if (result == Frustum::INSIDE || node.childCount == 0)
+		{
+			// whole node visible, one range per grid row
+			for (int i = node.i0; i < node.i1; ++i)
+			{
+				Range range;
+				range.first = (i * gridRez + node.j0) * pointsPerPatch;
+				range.count = (node.j1 - node.j0) * pointsPerPatch;
+				ranges.push_back(range);
+			}
+			stats.visiblePatches += (node.i1 - node.i0) * (node.j1 - node.j0);
+			return;
+		}
+
+		for (int c = 0; c < node.childCount; ++c)
+			cullNode(node.children[c], frustum, clippingPlane, useClippingPlane, stats);
+	}
+};
+
+#endif	// TERRAINQUADTREE_H
@@ -0,0 +1,77 @@
+#ifndef TESSELLATIONBUDGET_H
+#define TESSELLATIONBUDGET_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Triangle budget controller for the screen space error tessellation: reads the primitives the terrain passes
+// generated (TessellationStats, a few frames late) and adjusts the pixels per triangle edge the TCS aims for to hold
+// the budget. The triangle count goes roughly with the square of the level, i.e. with 1 / pixelsPerEdge^2.
+// Like FrameGovernor it coarsens quickly and refines slowly, leaving some headroom below the budget.
+class TessellationBudget {
+public:
+	static constexpr float MIN_PIXELS_PER_EDGE = 1.0f;
+	static constexpr float MAX_PIXELS_PER_EDGE = 64.0f;
+
+	TessellationBudget() {}
+
+	// a budget of 0 disables the controller, the target then stays at pixelsPerEdge
+	void initialize(uint64_t triangleBudget, float pixelsPerEdge)
+	{
+		budget = triangleBudget;
+		target = std::max(MIN_PIXELS_PER_EDGE, std::min(pixelsPerEdge, MAX_PIXELS_PER_EDGE));
+	}
+
+	bool isEnabled() const
+	{
+		return budget > 0;
+	}
+
+	// one read back frame of primitives
+	void addSample(uint64_t primitives)
+	{
+		if (!isEnabled())
+			return;
+
+		averagePrimitives = samples == 0 ? (double)primitives : averagePrimitives + 0.25 * ((double)primitives - averagePrimitives);
+		++samples;
+
+		// the queries are read QUERY_FRAMES late, wait for frames rendered with the last target
+		if (++framesSinceAdjust < ADJUST_INTERVAL)
+			return;
+		framesSinceAdjust = 0;
+
+		float factor = (float)std::sqrt(std::max(averagePrimitives, 1.0) / (double)budget);
+		if (averagePrimitives > (double)budget)
+			target = std::min(MAX_PIXELS_PER_EDGE, target * std::min(factor, 1.25f));
+		else if (averagePrimitives < (double)budget * 0.85)
+			target = std::max(MIN_PIXELS_PER_EDGE, target * std::max(factor, 0.95f));
+	}
+
+	float getPixelsPerEdge() const
+	{
+		return target;
+	}
+
+	double getAveragePrimitives() const
+	{
+		return averagePrimitives;
+	}
+
+	uint64_t getBudget() const
+	{
+		return budget;
+	}
+
+private:
+	static const int ADJUST_INTERVAL = 4;
+
+	uint64_t budget = 0;
+	float target = 8.0f;
+	double averagePrimitives = 0.0;
+	int samples = 0;
+	int framesSinceAdjust = 0;
+};
+
+#endif	// TESSELLATIONBUDGET_H
@@ -0,0 +1,408 @@
+#ifndef TESSELLATIONSTATS_H
+#define TESSELLATIONSTATS_H
+
+#include <glad/glad.h>
+
+#include <Shader.h>
+#include <PassTimer.h>
+#include <TerrainQuadtree.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+// ARB_pipeline_statistics_query, core only since 4.6
+#ifndef GL_TESS_EVALUATION_SHADER_INVOCATIONS
+#define GL_TESS_EVALUATION_SHADER_INVOCATIONS 0x82F6
+#endif
+
+// What the tessellator produces. Every terrain draw of a pass is wrapped in a GL_PRIMITIVES_GENERATED query and,
+// with ARB_pipeline_statistics_query, a GL_TESS_EVALUATION_SHADER_INVOCATIONS query; like PassTimer the queries
+// live in a ring of QUERY_FRAMES frames and are read back a few frames late.
+// Optionally the tessellation levels the TCS picks for every main pass patch are captured as well: a second draw of
+// the same patches runs the terrain vertex shader and TCS with a point mode TES and a geometry shader that keeps one
+// point per patch, written into a transform feedback buffer (GL 4.1 has no image stores or storage buffers for the
+// TCS to write to). Captures are read once their GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN query is available and
+// binned into a histogram of the highest level of each patch.
+class TessellationStats {
+public:
+	static const int QUERY_FRAMES = 4;
+	static const int CAPTURE_BUFFERS = 3;
+	static const int HISTOGRAM_BINS = 64;
+
+	TessellationStats() {}
+
+	~TessellationStats()
+	{
+		if (initialized)
+		{
+			glDeleteQueries(QUERY_FRAMES * PASS_COUNT * 2, &queries[0][0][0]);
+			glDeleteQueries(CAPTURE_BUFFERS, captureQueries);
+		}
+		if (captureFeedback)
+		{
+			glDeleteTransformFeedbacks(1, &captureFeedback);
+			glDeleteBuffers(CAPTURE_BUFFERS, captureBuffers);
+		}
+	}
+
+	void initialize(bool enable = true)
+	{
+		if (!initialized)
+		{
+			glGenQueries(QUERY_FRAMES * PASS_COUNT * 2, &queries[0][0][0]);
+			glGenQueries(CAPTURE_BUFFERS, captureQueries);
+			invocationQueries = hasExtension("GL_ARB_pipeline_statistics_query");
+			initialized = true;
+		}
+		enabled = enable;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled;
+	}
+
+	// only between frames, a pass must not be left open
+	void setEnabled(bool enable)
+	{
+		enabled = initialized && enable;
+	}
+
+	void setRecordSamples(bool record)
+	{
+		recordSamples = record;
+	}
+
+	bool hasInvocationCounts() const
+	{
+		return invocationQueries;
+	}
+
+	// advances the ring, reading back the frame whose queries are about to be reused
+	void beginFrame()
+	{
+		if (!enabled)
+			return;
+
+		frameSlot = (frameSlot + 1) % QUERY_FRAMES;
+		collect(frameSlot);
+		readCaptures();
+	}
+
+	// around the terrain draw calls of a pass only, other draws (e.g. the occlusion test) would be counted too
+	void beginPass(RenderPass pass)
+	{
+		if (!enabled)
+			return;
+
+		glBeginQuery(GL_PRIMITIVES_GENERATED, queries[frameSlot][pass][0]);
+		if (invocationQueries)
+			glBeginQuery(GL_TESS_EVALUATION_SHADER_INVOCATIONS, queries[frameSlot][pass][1]);
+	}
+
+	void endPass(RenderPass pass)
+	{
+		if (!enabled)
+			return;
+
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		if (invocationQueries)
+			glEndQuery(GL_TESS_EVALUATION_SHADER_INVOCATIONS);
+		pending[frameSlot][pass] = true;
+	}
+
+	// rolling averages over roughly the last ten frames the pass ran in
+	double getAveragePrimitives(RenderPass pass) const
+	{
+		return averagePrimitives[pass];
+	}
+
+	double getAverageInvocations(RenderPass pass) const
+	{
+		return averageInvocations[pass];
+	}
+
+	const std::vector<double>& getPrimitiveSamples(RenderPass pass) const
+	{
+		return primitiveSamples[pass];
+	}
+
+	const std::vector<double>& getInvocationSamples(RenderPass pass) const
+	{
+		return invocationSamples[pass];
+	}
+
+	// primitives of all terrain passes of the newest frame read back, false when no frame was read since the last call
+	bool takeFramePrimitives(uint64_t& primitives)
+	{
+		if (!newFramePrimitives)
+			return false;
+
+		primitives = framePrimitives;
+		newFramePrimitives = false;
+		return true;
+	}
+
+	// reads every outstanding query, used once the measured frames are done
+	void flush()
+	{
+		if (!enabled)
+			return;
+
+		for (int f = 1; f <= QUERY_FRAMES; ++f)
+			collect((frameSlot + f) % QUERY_FRAMES);
+	}
+
+	void clearSamples()
+	{
+		for (int p = 0; p < PASS_COUNT; ++p)
+		{
+			primitiveSamples[p].clear();
+			invocationSamples[p].clear();
+		}
+		clearHistogram();
+	}
+
+	// level capture
+	// -------------
+	// captureProgram: terrain vertex shader and TCS with Statistics/TessLevels.TES and .geom, capturing
+	// patchOuterLevels and patchInnerLevels
+	void enableLevelCapture(Shader& captureProgram, int maxPatches)
+	{
+		program = &captureProgram;
+		if (!captureFeedback)
+		{
+			glGenTransformFeedbacks(1, &captureFeedback);
+			glGenBuffers(CAPTURE_BUFFERS, captureBuffers);
+		}
+
+		capturePatches = maxPatches;
+		for (int b = 0; b < CAPTURE_BUFFERS; ++b)
+		{
+			glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, captureBuffers[b]);
+			glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, (GLsizeiptr)maxPatches * FLOATS_PER_PATCH * sizeof(float), nullptr, GL_STREAM_READ);
+			capturePending[b] = false;
+		}
+		glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+	}
+
+	bool isCapturingLevels() const
+	{
+		return enabled && program != nullptr;
+	}
+
+	// draws the patches again through the capture program, its uniforms have to match the terrain pass
+	void captureLevels(const PatchDrawList& patches)
+	{
+		if (!isCapturingLevels() || patches.first.empty())
+			return;
+
+		// every buffer still in flight, skip this frame rather than wait
+		int buffer = captureSlot;
+		if (capturePending[buffer])
+			return;
+		captureSlot = (captureSlot + 1) % CAPTURE_BUFFERS;
+
+		program->use();
+		glEnable(GL_RASTERIZER_DISCARD);
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, captureFeedback);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, captureBuffers[buffer]);
+
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, captureQueries[buffer]);
+		glBeginTransformFeedback(GL_POINTS);
+		patches.draw();
+		glEndTransformFeedback();
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		capturePending[buffer] = true;
+	}
+
+	// patches per level bin, bin b counts patches whose highest level lies in (b, b + 1]
+	const std::vector<uint64_t>& getHistogram() const
+	{
+		return histogram;
+	}
+
+	uint64_t getCapturedPatches() const
+	{
+		return capturedPatches;
+	}
+
+	double getAverageLevel() const
+	{
+		return capturedPatches > 0 ? levelSum / capturedPatches : 0.0;
+	}
+
+	void clearHistogram()
+	{
+		histogram.assign(HISTOGRAM_BINS, 0);
+		capturedPatches = 0;
+		levelSum = 0.0;
+	}
+
+	// "captured_patches", "average_level" and "level_histogram" as JSON members on one line
+	std::string buildHistogramJson() const
+	{
+		std::ostringstream json;
+		json.setf(std::ios::fixed);
+		json.precision(2);
+
+		json << "\"captured_patches\": " << capturedPatches << ", \"average_level\": " << getAverageLevel() << ", \"level_histogram\": [";
+		for (int b = 0; b < HISTOGRAM_BINS; ++b)
+			json << (b > 0 ? ", " : " ") << histogram[b];
+		json << " ]";
+		return json.str();
+	}
+
+	// "primitives" / "tes_invocations" per terrain pass followed by the histogram, one JSON member per line;
+	// statistics formats a sample set
+	template<typename Statistics>
+	std::string buildJson(const Statistics& statistics, const std::string& indent) const
+	{
+		std::ostringstream json;
+		const RenderPass passes[3] = { PASS_REFLECTION, PASS_REFRACTION, PASS_TERRAIN };
+		for (int p = 0; p < 3; ++p)
+		{
+			json << indent << "\"" << RENDER_PASS_NAMES[passes[p]] << "\": { \"primitives\": " << statistics(primitiveSamples[passes[p]]);
+			if (invocationQueries)
+				json << ", \"tes_invocations\": " << statistics(invocationSamples[passes[p]]);
+			json << " },\n";
+		}
+		json << indent << buildHistogramJson() << "\n";
+		return json.str();
+	}
+
+private:
+	// 4 outer and 2 inner levels per captured patch
+	static const int FLOATS_PER_PATCH = 6;
+
+	GLuint queries[QUERY_FRAMES][PASS_COUNT][2] = {};		// primitives generated, TES invocations
+	bool pending[QUERY_FRAMES][PASS_COUNT] = {};
+	int frameSlot = 0;
+	bool initialized = false;
+	bool enabled = false;
+	bool recordSamples = true;
+	bool invocationQueries = false;
+
+	std::vector<double> primitiveSamples[PASS_COUNT];
+	std::vector<double> invocationSamples[PASS_COUNT];
+	double averagePrimitives[PASS_COUNT] = {};
+	double averageInvocations[PASS_COUNT] = {};
+	uint64_t framePrimitives = 0;
+	bool newFramePrimitives = false;
+
+	Shader* program = nullptr;
+	GLuint captureFeedback = 0;
+	GLuint captureBuffers[CAPTURE_BUFFERS] = {};
+	GLuint captureQueries[CAPTURE_BUFFERS] = {};
+	bool capturePending[CAPTURE_BUFFERS] = {};
+	int captureSlot = 0;
+	int capturePatches = 0;
+
+	std::vector<uint64_t> histogram = std::vector<uint64_t>(HISTOGRAM_BINS, 0);
+	uint64_t capturedPatches = 0;
+	double levelSum = 0.0;
+	std::vector<float> readback;
+
+	static bool hasExtension(const char* name)
+	{
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; ++i)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (extension && std::strcmp(extension, name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	static void addAverage(double& average, double sample)
+	{
+		average = average == 0.0 ? sample : average + 0.1 * (sample - average);
+	}
+
+	void collect(int slot)
+	{
+		static const char* const counterNames[PASS_COUNT] = { "reflection primitives", "refraction primitives", "terrain primitives", "", "" };
+
+		uint64_t total = 0;
+		bool collected = false;
+		for (int p = 0; p < PASS_COUNT; ++p)
+		{
+			if (!pending[slot][p])
+				continue;
+
+			GLuint64 primitives = 0, invocations = 0;
+			glGetQueryObjectui64v(queries[slot][p][0], GL_QUERY_RESULT, &primitives);
+			if (invocationQueries)
+				glGetQueryObjectui64v(queries[slot][p][1], GL_QUERY_RESULT, &invocations);
+			pending[slot][p] = false;
+			total += primitives;
+			collected = true;
+
+			if (recordSamples)
+			{
+				primitiveSamples[p].push_back((double)primitives);
+				if (invocationQueries)
+					invocationSamples[p].push_back((double)invocations);
+			}
+			addAverage(averagePrimitives[p], (double)primitives);
+			addAverage(averageInvocations[p], (double)invocations);
+
+			if (Profiler::instance().isEnabled())
+				Profiler::instance().addCounter(counterNames[p], (double)primitives);
+		}
+
+		if (collected)
+		{
+			framePrimitives = total;
+			newFramePrimitives = true;
+		}
+	}
+
+	// non blocking: only captures whose query result is available are read
+	void readCaptures()
+	{
+		for (int b = 0; b < CAPTURE_BUFFERS; ++b)
+		{
+			if (!capturePending[b])
+				continue;
+
+			GLuint available = 0;
+			glGetQueryObjectuiv(captureQueries[b], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint written = 0;
+			glGetQueryObjectuiv(captureQueries[b], GL_QUERY_RESULT, &written);
+			capturePending[b] = false;
+
+			int patches = std::min((int)written, capturePatches);
+			readback.resize((size_t)patches * FLOATS_PER_PATCH);
+			glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, captureBuffers[b]);
+			glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, readback.size() * sizeof(float), readback.data());
+			glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+
+			for (int i = 0; i < patches; ++i)
+			{
+				const float* levels = readback.data() + (size_t)i * FLOATS_PER_PATCH;
+				float level = *std::max_element(levels, levels + FLOATS_PER_PATCH);
+				int bin = std::max(0, std::min((int)std::ceil(level) - 1, HISTOGRAM_BINS - 1));
+				++histogram[bin];
+				levelSum += level;
+			}
+			capturedPatches += patches;
+		}
+	}
+};
+
+#endif	// TESSELLATIONSTATS_H
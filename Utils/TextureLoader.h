@@ -0,0 +1,353 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <ParallelFor.h>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// what to load and how to set up the texture
+struct TextureDesc {
+	std::string path;
+	int textureUnit = 0;
+	int channels = 4;						// channels requested from stb_image (3 = RGB, 4 = RGBA)
+	GLint wrap = GL_REPEAT;
+	GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+	GLint magFilter = GL_LINEAR;
+	bool generateMipmaps = true;
+	bool keepPixels = false;				// keep the decoded pixels on the CPU after the upload
+	bool createTexture = true;				// false only decodes into kept pixels, e.g. for texture array layers
+	GLenum pixelType = GL_UNSIGNED_BYTE;	// GL_UNSIGNED_SHORT decodes 16 bits per channel, GL_FLOAT for HDR / raw float files
+	bool singleChannel = false;				// keep only the green (or gray) channel, uploaded as GL_R8 / GL_R16 / GL_R32F
+	int rawWidth = 0;						// size of headerless .r16 / .r32 files, square when 0
+	int rawHeight = 0;
+
+	TextureDesc() {}
+	TextureDesc(const std::string& texturePath, int unit, int requestedChannels = 4)
+		: path(texturePath), textureUnit(unit), channels(requestedChannels) {}
+};
+
+struct LoadedTexture {
+	GLuint id = 0;
+	int width = 0;
+	int height = 0;
+	int channels = 0;						// channels of the uploaded / kept pixels
+	GLenum pixelType = GL_UNSIGNED_BYTE;	// type of every channel of pixels
+	void* pixels = nullptr;					// only set for keepPixels textures, see releasePixels
+	bool loaded = false;
+
+	double decodeMs = 0.0;
+	double uploadMs = 0.0;
+};
+
+// Loads a batch of images at once: headers are parsed first so pixel buffer objects can be mapped up front,
+// then a worker pool decodes every image straight into its mapped PBO while the main thread waits, and
+// finally the PBOs are unmapped and handed to glTexImage2D so the driver can copy them asynchronously.
+class TextureLoader {
+public:
+	TextureLoader() {}
+
+	~TextureLoader()
+	{
+		for (size_t i = 0; i < textures.size(); ++i)
+			releasePixels((int)i);
+	}
+
+	// returns the index used with get(); raw files are single channel, 16 bit (.r16, .raw) or float (.r32)
+	int add(const TextureDesc& desc)
+	{
+		descs.push_back(desc);
+		if (isRawFile(desc.path))
+		{
+			descs.back().pixelType = endsWith(desc.path, ".r32") ? GL_FLOAT : GL_UNSIGNED_SHORT;
+			descs.back().singleChannel = true;
+		}
+
+		textures.push_back(LoadedTexture());
+		textures.back().pixelType = descs.back().pixelType;
+		// decided here on the calling thread, the decode workers only read it
+		rawPixels.push_back(isRawFile(desc.path) ? 1 : 0);
+		return (int)descs.size() - 1;
+	}
+
+	const LoadedTexture& get(int index) const
+	{
+		return textures[index];
+	}
+
+	void releasePixels(int index)
+	{
+		if (textures[index].pixels)
+		{
+			if (rawPixels[index])
+				std::free(textures[index].pixels);
+			else
+				stbi_image_free(textures[index].pixels);
+			textures[index].pixels = nullptr;
+		}
+	}
+
+	void loadAll()
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		size_t count = descs.size();
+
+		// 1. read the image headers and map one PBO per image
+		std::vector<GLuint> pbos(count, 0);
+		std::vector<void*> mapped(count, nullptr);
+		std::vector<size_t> sizes(count, 0);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			int width, height, fileChannels;
+			if (!descs[i].createTexture || !queryImage(descs[i], width, height, fileChannels))
+				continue;
+
+			sizes[i] = (size_t)width * height * getChannels(descs[i], fileChannels) * getChannelBytes(descs[i].pixelType);
+
+			glGenBuffers(1, &pbos[i]);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, sizes[i], nullptr, GL_STREAM_DRAW);
+			mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizes[i], GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		// 2. decode on a worker pool, each worker pulls the next image
+		std::atomic<int> next(0);
+		unsigned int workerCount = std::min<unsigned int>(getWorkerThreadCount(), (unsigned int)std::max<size_t>(1, count));
+		std::vector<std::thread> workers;
+		for (unsigned int w = 0; w < workerCount; ++w)
+		{
+			workers.emplace_back([&]() {
+				for (int i = next++; i < (int)count; i = next++)
+					decode(i, mapped[i], sizes[i]);
+			});
+		}
+		for (size_t w = 0; w < workers.size(); ++w)
+			workers[w].join();
+
+		auto decoded = std::chrono::high_resolution_clock::now();
+
+		// 3. unmap and upload from the PBOs
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (pbos[i])
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+
+			// decode-only descs are loaded without a texture of their own
+			if (!textures[i].loaded)
+				std::cout << "Failed to load texture " << descs[i].path << std::endl;
+			else if (descs[i].createTexture)
+				upload(i);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (pbos[i])
+				glDeleteBuffers(1, &pbos[i]);
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		decodeWallMs = std::chrono::duration<double, std::milli>(decoded - start).count();
+		uploadWallMs = std::chrono::duration<double, std::milli>(end - decoded).count();
+	}
+
+	void printTimings() const
+	{
+		std::cout << "Texture loading (" << getWorkerThreadCount() << " decode threads):" << std::endl;
+		for (size_t i = 0; i < descs.size(); ++i)
+		{
+			const LoadedTexture& texture = textures[i];
+			std::cout << "  " << std::left << std::setw(24) << descs[i].path << std::right;
+			if (texture.loaded)
+				std::cout << texture.width << " x " << texture.height << " x " << texture.channels
+					<< "  decode " << std::fixed << std::setprecision(1) << texture.decodeMs
+					<< " ms, upload " << texture.uploadMs << " ms" << std::endl;
+			else
+				std::cout << "failed" << std::endl;
+		}
+		std::cout << "  total: decode " << decodeWallMs << " ms, upload " << uploadWallMs << " ms" << std::defaultfloat << std::endl;
+	}
+
+private:
+	std::vector<TextureDesc> descs;
+	std::vector<LoadedTexture> textures;
+	std::vector<unsigned char> rawPixels;	// pixels allocated with malloc instead of by stb_image
+	double decodeWallMs = 0.0;
+	double uploadWallMs = 0.0;
+
+	static bool endsWith(const std::string& value, const std::string& suffix)
+	{
+		return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	static bool isRawFile(const std::string& path)
+	{
+		return endsWith(path, ".r16") || endsWith(path, ".raw") || endsWith(path, ".r32");
+	}
+
+	static int getChannelBytes(GLenum pixelType)
+	{
+		return pixelType == GL_FLOAT ? 4 : (pixelType == GL_UNSIGNED_SHORT ? 2 : 1);
+	}
+
+	static int getChannels(const TextureDesc& desc, int fileChannels)
+	{
+		if (desc.singleChannel)
+			return 1;
+		return desc.channels > 0 ? desc.channels : fileChannels;
+	}
+
+	// image size without decoding it; raw files without an explicit size must be square
+	static bool queryImage(const TextureDesc& desc, int& width, int& height, int& fileChannels)
+	{
+		if (!isRawFile(desc.path))
+			return stbi_info(desc.path.c_str(), &width, &height, &fileChannels) != 0;
+
+		std::ifstream file(desc.path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+
+		size_t texels = (size_t)file.tellg() / getChannelBytes(desc.pixelType);
+		width = desc.rawWidth;
+		height = desc.rawHeight;
+		if (width <= 0 || height <= 0)
+		{
+			width = height = (int)std::lround(std::sqrt((double)texels));
+			if ((size_t)width * height != texels)
+			{
+				std::cout << "Raw texture " << desc.path << " is not square, its size has to be given" << std::endl;
+				return false;
+			}
+		}
+
+		fileChannels = 1;
+		return (size_t)width * height <= texels;
+	}
+
+	// runs on a worker thread, must not touch GL
+	void decode(int index, void* destination, size_t size)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const TextureDesc& desc = descs[index];
+		LoadedTexture& texture = textures[index];
+
+		int width = 0, height = 0, fileChannels = 0;
+		int requestedChannels = desc.singleChannel ? 0 : desc.channels;
+		int channelBytes = getChannelBytes(desc.pixelType);
+		void* data = nullptr;
+
+		if (isRawFile(desc.path))
+		{
+			if (queryImage(desc, width, height, fileChannels))
+			{
+				size_t bytes = (size_t)width * height * channelBytes;
+				std::ifstream file(desc.path, std::ios::binary);
+				data = std::malloc(bytes);
+				if (data && !file.read((char*)data, bytes))
+				{
+					std::free(data);
+					data = nullptr;
+				}
+			}
+		}
+		else if (desc.pixelType == GL_UNSIGNED_SHORT)
+			data = stbi_load_16(desc.path.c_str(), &width, &height, &fileChannels, requestedChannels);
+		else if (desc.pixelType == GL_FLOAT)
+			data = stbi_loadf(desc.path.c_str(), &width, &height, &fileChannels, requestedChannels);
+		else
+			data = stbi_load(desc.path.c_str(), &width, &height, &fileChannels, requestedChannels);
+
+		if (data)
+		{
+			texture.width = width;
+			texture.height = height;
+			texture.channels = getChannels(desc, fileChannels);
+
+			// keep the green channel the heightmap was always sampled from, compacted in place
+			if (desc.singleChannel && fileChannels > 1)
+			{
+				unsigned char* pixels = (unsigned char*)data;
+				for (size_t i = 0; i < (size_t)width * height; ++i)
+					std::memcpy(pixels + i * channelBytes, pixels + (i * fileChannels + 1) * channelBytes, channelBytes);
+			}
+
+			size_t bytes = (size_t)width * height * texture.channels * channelBytes;
+			if (destination && bytes == size)
+			{
+				std::memcpy(destination, data, bytes);
+				texture.loaded = true;
+			}
+			else if (!desc.createTexture)
+				texture.loaded = true;
+
+			if (desc.keepPixels && texture.loaded)
+				texture.pixels = data;
+			else if (rawPixels[index])
+				std::free(data);
+			else
+				stbi_image_free(data);
+		}
+
+		texture.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void upload(size_t index)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const TextureDesc& desc = descs[index];
+		LoadedTexture& texture = textures[index];
+
+		GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+		GLint byteFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+		GLint shortFormats[4] = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+		GLint floatFormats[4] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+
+		int formatIndex = std::max(1, std::min(texture.channels, 4)) - 1;
+		GLenum format = formats[formatIndex];
+		GLint internalFormat = byteFormats[formatIndex];
+		if (desc.pixelType == GL_UNSIGNED_SHORT)
+			internalFormat = shortFormats[formatIndex];
+		else if (desc.pixelType == GL_FLOAT)
+			internalFormat = floatFormats[formatIndex];
+
+		glGenTextures(1, &texture.id);
+		glActiveTexture(GL_TEXTURE0 + desc.textureUnit);
+		glBindTexture(GL_TEXTURE_2D, texture.id);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, desc.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, desc.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+
+		// the source is the bound unpack buffer, offset 0
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, texture.width, texture.height, 0, format, desc.pixelType, (void*)0);
+		if (desc.generateMipmaps)
+			glGenerateMipmap(GL_TEXTURE_2D);
+
+		texture.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+#endif	// TEXTURELOADER_H
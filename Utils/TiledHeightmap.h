@@ -0,0 +1,593 @@
+#ifndef TILEDHEIGHTMAP_H
+#define TILEDHEIGHTMAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <MappedFile.h>
+#include <Heightmap.h>
+#include <ParallelFor.h>
+#include <Profiler.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+// Tiled, mip-chained heightmap file (.thm) written by Tools/HeightmapTiler.cpp.
+// Layout: header, one level descriptor per mip level, then starting at a page aligned offset the tiles of
+// every level in row-major order. A tile stores tileSize x tileSize texels plus a border on every side
+// (edge texels clamped) so it can be filtered bilinearly on its own; texels are 16 bit unsigned normalized.
+struct TiledHeightmapHeader {
+	char magic[4];				// "THM1"
+	uint32_t version;
+	uint32_t width;				// level 0 size in texels
+	uint32_t height;
+	uint32_t tileSize;			// interior texels per tile side
+	uint32_t border;
+	uint32_t levelCount;
+	uint32_t reserved;
+	float heightScale;			// Height = value * heightScale + heightOffset
+	float heightOffset;
+};
+
+struct TiledHeightmapLevel {
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	uint32_t tilesY;
+	uint64_t offset;			// file offset of tile (0, 0)
+};
+
+class TiledHeightmap {
+public:
+	static const uint32_t VERSION = 1;
+	static const uint64_t DATA_ALIGNMENT = 4096;
+
+	TiledHeightmap() {}
+
+	// fills in the level descriptors of a file and returns its total size
+	static uint64_t computeLayout(TiledHeightmapHeader& header, std::vector<TiledHeightmapLevel>& levels)
+	{
+		levels.clear();
+		uint32_t width = header.width, height = header.height;
+		for (;;)
+		{
+			TiledHeightmapLevel level;
+			level.width = width;
+			level.height = height;
+			level.tilesX = (width + header.tileSize - 1) / header.tileSize;
+			level.tilesY = (height + header.tileSize - 1) / header.tileSize;
+			level.offset = 0;
+			levels.push_back(level);
+
+			if (level.tilesX == 1 && level.tilesY == 1)
+				break;
+
+			width = std::max(1u, (width + 1) / 2);
+			height = std::max(1u, (height + 1) / 2);
+		}
+		header.levelCount = (uint32_t)levels.size();
+
+		uint64_t offset = sizeof(TiledHeightmapHeader) + levels.size() * sizeof(TiledHeightmapLevel);
+		offset = (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+
+		uint64_t tileBytes = getTileBytes(header);
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			levels[l].offset = offset;
+			offset += (uint64_t)levels[l].tilesX * levels[l].tilesY * tileBytes;
+		}
+
+		return offset;
+	}
+
+	static uint64_t getTileBytes(const TiledHeightmapHeader& header)
+	{
+		uint64_t stride = header.tileSize + 2 * header.border;
+		return stride * stride * sizeof(uint16_t);
+	}
+
+	bool open(const std::string& path)
+	{
+		if (!file.openRead(path))
+			return false;
+
+		if (file.getSize() < sizeof(TiledHeightmapHeader))
+			return fail(path);
+
+		std::memcpy(&header, file.getData(), sizeof(header));
+		if (std::memcmp(header.magic, "THM1", 4) != 0 || header.version != VERSION || header.tileSize == 0
+			|| header.width == 0 || header.height == 0)
+			return fail(path);
+
+		// the level chain follows from the size and tile size, so the stored one has to be exactly the one the
+		// tiler computed; this also bounds the level count before anything is read with it
+		TiledHeightmapHeader expectedHeader = header;
+		std::vector<TiledHeightmapLevel> expected;
+		uint64_t expectedSize = computeLayout(expectedHeader, expected);
+		if (header.levelCount == 0 || header.levelCount > expectedHeader.levelCount)
+			return fail(path);
+
+		levels.resize(header.levelCount);
+		if (file.getSize() < sizeof(header) + levels.size() * sizeof(TiledHeightmapLevel))
+			return fail(path);
+		std::memcpy(levels.data(), file.getData() + sizeof(header), levels.size() * sizeof(TiledHeightmapLevel));
+
+		if (levels.size() != expected.size() || file.getSize() < expectedSize)
+			return fail(path);
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			if (levels[l].width != expected[l].width || levels[l].height != expected[l].height
+				|| levels[l].tilesX != expected[l].tilesX || levels[l].tilesY != expected[l].tilesY
+				|| levels[l].offset != expected[l].offset)
+				return fail(path);
+		}
+
+		std::cout << "Mapped tiled heightmap " << path << ": " << header.width << " x " << header.height << ", "
+			<< header.levelCount << " levels of " << header.tileSize << " texel tiles" << std::endl;
+		return true;
+	}
+
+	const TiledHeightmapHeader& getHeader() const
+	{
+		return header;
+	}
+
+	int getLevelCount() const
+	{
+		return (int)levels.size();
+	}
+
+	const TiledHeightmapLevel& getLevel(int level) const
+	{
+		return levels[level];
+	}
+
+	int getTileStride() const
+	{
+		return (int)(header.tileSize + 2 * header.border);
+	}
+
+	const uint16_t* getTile(int level, int tx, int ty) const
+	{
+		const TiledHeightmapLevel& l = levels[level];
+		return (const uint16_t*)(file.getData() + l.offset + ((uint64_t)ty * l.tilesX + tx) * getTileBytes(header));
+	}
+
+	// single texel of a level, coordinates clamped to the level
+	uint16_t getTexel(int level, int x, int y) const
+	{
+		return *(const uint16_t*)(file.getData() + getTexelOffset(header, levels[level], x, y));
+	}
+
+	// file offset of the interior copy of a texel, shared with the converter that writes the file
+	static uint64_t getTexelOffset(const TiledHeightmapHeader& header, const TiledHeightmapLevel& level, int x, int y)
+	{
+		x = std::max(0, std::min(x, (int)level.width - 1));
+		y = std::max(0, std::min(y, (int)level.height - 1));
+
+		uint32_t tileSize = header.tileSize, stride = header.tileSize + 2 * header.border;
+		uint64_t tile = (uint64_t)(y / tileSize) * level.tilesX + x / tileSize;
+		uint64_t texel = (uint64_t)(y % tileSize + header.border) * stride + x % tileSize + header.border;
+		return level.offset + tile * getTileBytes(header) + texel * sizeof(uint16_t);
+	}
+
+	// CPU overview from the finest level that fits in maxSize x maxSize, used for culling bounds
+	Heightmap buildOverview(int maxSize) const
+	{
+		int level = 0;
+		while (level + 1 < getLevelCount() && ((int)levels[level].width > maxSize || (int)levels[level].height > maxSize))
+			++level;
+
+		const TiledHeightmapLevel& l = levels[level];
+		Heightmap heightmap;
+		heightmap.width = (int)l.width;
+		heightmap.height = (int)l.height;
+		heightmap.heightScale = header.heightScale;
+		heightmap.heightOffset = header.heightOffset;
+		heightmap.texels.resize((size_t)l.width * l.height);
+
+		uint16_t* texels = heightmap.texels.data();
+		parallelFor(0, (int)l.height, [&](int rowBegin, int rowEnd) {
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				for (int x = 0; x < (int)l.width; ++x)
+					texels[(size_t)y * l.width + x] = getTexel(level, x, y);
+			}
+		}, 16);
+
+		return heightmap;
+	}
+
+private:
+	MappedFile file;
+	TiledHeightmapHeader header = {};
+	std::vector<TiledHeightmapLevel> levels;
+
+	bool fail(const std::string& path)
+	{
+		std::cout << "Invalid tiled heightmap " << path << std::endl;
+		file.close();
+		return false;
+	}
+};
+
+// Fixed-size GPU cache of heightmap tiles: a GL_TEXTURE_2D_ARRAY with one layer per slot and an RG16UI page table
+// holding, for every level 0 tile, the (slot, level) of the finest resident tile that covers it. Tiles near the camera
+// are requested every frame, read from the mapped file on a loader thread and uploaded a few per frame; when the
+// cache is full the least recently used tile is evicted. The coarsest levels stay pinned as a fallback.
+class TileCache {
+public:
+	struct Stats {
+		int residentTiles = 0;
+		int pendingTiles = 0;
+		int uploadsThisFrame = 0;
+		int evictions = 0;
+	};
+
+	TileCache() {}
+
+	~TileCache()
+	{
+		shutdown();
+	}
+
+	void initialize(const TiledHeightmap& heightmap, int slots, int cacheTextureUnit, int pageTableTextureUnit)
+	{
+		source = &heightmap;
+		slotCount = slots;
+		cacheUnit = cacheTextureUnit;
+		pageTableUnit = pageTableTextureUnit;
+		tileStride = heightmap.getTileStride();
+
+		slotKeys.assign(slotCount, EMPTY_KEY);
+		slotLastUsed.assign(slotCount, 0);
+		slotPinned.assign(slotCount, false);
+
+		levelSlots.resize(heightmap.getLevelCount());
+		for (int l = 0; l < heightmap.getLevelCount(); ++l)
+			levelSlots[l].assign((size_t)heightmap.getLevel(l).tilesX * heightmap.getLevel(l).tilesY, -1);
+
+		// tile cache
+		glGenTextures(1, &cacheTexture);
+		glActiveTexture(GL_TEXTURE0 + cacheTextureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cacheTexture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, tileStride, tileStride, slotCount, 0, GL_RED, GL_UNSIGNED_SHORT, nullptr);
+
+		// page table at level 0 tile resolution
+		const TiledHeightmapLevel& level0 = heightmap.getLevel(0);
+		pageTable.assign((size_t)level0.tilesX * level0.tilesY * 2, 0);
+
+		glGenTextures(1, &pageTableTexture);
+		glActiveTexture(GL_TEXTURE0 + pageTableTextureUnit);
+		glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16UI, level0.tilesX, level0.tilesY, 0, GL_RG_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+
+		// pin the coarsest levels (at most a quarter of the cache) so every texel always has a fallback
+		int pinnedBudget = std::max(1, slotCount / 4);
+		for (int l = heightmap.getLevelCount() - 1; l >= 0; --l)
+		{
+			const TiledHeightmapLevel& level = heightmap.getLevel(l);
+			int tiles = (int)(level.tilesX * level.tilesY);
+			if (tiles > pinnedBudget)
+				break;
+
+			for (uint32_t ty = 0; ty < level.tilesY; ++ty)
+			{
+				for (uint32_t tx = 0; tx < level.tilesX; ++tx)
+				{
+					int slot = findSlot(0);
+					upload(slot, makeKey(l, tx, ty), heightmap.getTile(l, tx, ty));
+					slotPinned[slot] = true;
+				}
+			}
+			pinnedBudget -= tiles;
+		}
+		rebuildPageTable();
+
+		loader = std::thread(&TileCache::loaderThread, this);
+	}
+
+	void shutdown()
+	{
+		if (loader.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopLoader = true;
+			}
+			queueCondition.notify_all();
+			loader.join();
+		}
+
+		if (cacheTexture)
+			glDeleteTextures(1, &cacheTexture);
+		if (pageTableTexture)
+			glDeleteTextures(1, &pageTableTexture);
+		cacheTexture = pageTableTexture = 0;
+	}
+
+	// requests the tiles around the camera (in level 0 texel coordinates) and uploads finished ones
+	void update(const glm::vec2& cameraTexel, unsigned int frame, int maxUploadsPerFrame = 8)
+	{
+		PROFILE_SCOPE("tile streaming");
+
+		if (!source)
+			return;
+
+		stats.uploadsThisFrame = 0;
+
+		// 1. desired tiles: a square of residentRadius tiles around the camera on every level, coarse first
+		std::vector<uint64_t> requests;
+		for (int l = source->getLevelCount() - 1; l >= 0; --l)
+		{
+			const TiledHeightmapLevel& level = source->getLevel(l);
+			float tileSpan = (float)(source->getHeader().tileSize << l);
+
+			int tx0 = std::max(0, (int)std::floor(cameraTexel.x / tileSpan - residentRadius));
+			int tx1 = std::min((int)level.tilesX - 1, (int)std::floor(cameraTexel.x / tileSpan + residentRadius));
+			int ty0 = std::max(0, (int)std::floor(cameraTexel.y / tileSpan - residentRadius));
+			int ty1 = std::min((int)level.tilesY - 1, (int)std::floor(cameraTexel.y / tileSpan + residentRadius));
+
+			for (int ty = ty0; ty <= ty1; ++ty)
+			{
+				for (int tx = tx0; tx <= tx1; ++tx)
+				{
+					int slot = levelSlots[l][(size_t)ty * level.tilesX + tx];
+					if (slot >= 0)
+						slotLastUsed[slot] = frame;
+					else
+						requests.push_back(makeKey(l, tx, ty));
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+
+			// anything still queued but no longer wanted is dropped
+			requestQueue.clear();
+			for (size_t r = 0; r < requests.size(); ++r)
+			{
+				if (inFlight.count(requests[r]) == 0 && readyKeys.count(requests[r]) == 0)
+					requestQueue.push_back(requests[r]);
+			}
+
+			for (size_t c = 0; c < completed.size(); ++c)
+			{
+				readyKeys.insert(completed[c].key);
+				ready.push_back(std::move(completed[c]));
+			}
+			completed.clear();
+
+			stats.pendingTiles = (int)(requestQueue.size() + inFlight.size());
+		}
+		queueCondition.notify_one();
+
+		// 2. upload a bounded number of finished tiles, evicting least recently used ones
+		bool changed = false;
+		size_t consumed = 0;
+		for (; consumed < ready.size() && stats.uploadsThisFrame < maxUploadsPerFrame; ++consumed)
+		{
+			LoadedTile& tile = ready[consumed];
+			if (isResident(tile.key))
+				continue;
+
+			int slot = findSlot(frame);
+			if (slot < 0)
+				break;
+
+			upload(slot, tile.key, tile.texels.data());
+			slotLastUsed[slot] = frame;
+			++stats.uploadsThisFrame;
+			changed = true;
+		}
+		for (size_t c = 0; c < consumed; ++c)
+			readyKeys.erase(ready[c].key);
+		ready.erase(ready.begin(), ready.begin() + consumed);
+
+		if (changed)
+			rebuildPageTable();
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	int getSlotCount() const
+	{
+		return slotCount;
+	}
+
+	// tiles of every level kept around the camera, in tiles of that level
+	void setResidentRadius(float radius)
+	{
+		residentRadius = radius;
+	}
+
+private:
+	static const uint64_t EMPTY_KEY = ~0ull;
+
+	struct LoadedTile {
+		uint64_t key;
+		std::vector<uint16_t> texels;
+	};
+
+	const TiledHeightmap* source = nullptr;
+	int slotCount = 0;
+	int tileStride = 0;
+	float residentRadius = 1.5f;
+
+	GLuint cacheTexture = 0;
+	GLuint pageTableTexture = 0;
+	int cacheUnit = 0;				// the textures stay bound to their units, other passes bind on the active one
+	int pageTableUnit = 0;
+
+	std::vector<uint64_t> slotKeys;
+	std::vector<unsigned int> slotLastUsed;
+	std::vector<bool> slotPinned;
+	std::vector<std::vector<int>> levelSlots;
+	std::vector<uint16_t> pageTable;
+	std::vector<LoadedTile> ready;				// loaded but not uploaded yet
+	std::unordered_set<uint64_t> readyKeys;
+	Stats stats;
+
+	// loader thread state, guarded by queueMutex
+	std::thread loader;
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	std::deque<uint64_t> requestQueue;
+	std::unordered_set<uint64_t> inFlight;
+	std::vector<LoadedTile> completed;
+	bool stopLoader = false;
+
+	static uint64_t makeKey(int level, uint32_t tx, uint32_t ty)
+	{
+		return ((uint64_t)level << 48) | ((uint64_t)ty << 24) | tx;
+	}
+
+	static void splitKey(uint64_t key, int& level, int& tx, int& ty)
+	{
+		level = (int)(key >> 48);
+		ty = (int)((key >> 24) & 0xFFFFFF);
+		tx = (int)(key & 0xFFFFFF);
+	}
+
+	bool isResident(uint64_t key) const
+	{
+		int level, tx, ty;
+		splitKey(key, level, tx, ty);
+		return levelSlots[level][(size_t)ty * source->getLevel(level).tilesX + tx] >= 0;
+	}
+
+	// free slot first, then the least recently used unpinned slot not needed this frame
+	int findSlot(unsigned int frame)
+	{
+		int best = -1;
+		for (int s = 0; s < slotCount; ++s)
+		{
+			if (slotKeys[s] == EMPTY_KEY)
+				return s;
+			if (slotPinned[s] || (frame > 0 && slotLastUsed[s] >= frame))
+				continue;
+			if (best < 0 || slotLastUsed[s] < slotLastUsed[best])
+				best = s;
+		}
+
+		if (best >= 0)
+		{
+			int level, tx, ty;
+			splitKey(slotKeys[best], level, tx, ty);
+			levelSlots[level][(size_t)ty * source->getLevel(level).tilesX + tx] = -1;
+			slotKeys[best] = EMPTY_KEY;
+			++stats.evictions;
+		}
+		return best;
+	}
+
+	void upload(int slot, uint64_t key, const uint16_t* texels)
+	{
+		glActiveTexture(GL_TEXTURE0 + cacheUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, cacheTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, tileStride, tileStride, 1, GL_RED, GL_UNSIGNED_SHORT, texels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		int level, tx, ty;
+		splitKey(key, level, tx, ty);
+		levelSlots[level][(size_t)ty * source->getLevel(level).tilesX + tx] = slot;
+		slotKeys[slot] = key;
+		stats.residentTiles = 0;
+		for (int s = 0; s < slotCount; ++s)
+			stats.residentTiles += slotKeys[s] != EMPTY_KEY;
+	}
+
+	void rebuildPageTable()
+	{
+		const TiledHeightmapLevel& level0 = source->getLevel(0);
+		for (uint32_t py = 0; py < level0.tilesY; ++py)
+		{
+			for (uint32_t px = 0; px < level0.tilesX; ++px)
+			{
+				uint16_t* entry = &pageTable[((size_t)py * level0.tilesX + px) * 2];
+				entry[0] = 0;
+				entry[1] = (uint16_t)(source->getLevelCount() - 1);
+
+				for (int l = 0; l < source->getLevelCount(); ++l)
+				{
+					const TiledHeightmapLevel& level = source->getLevel(l);
+					uint32_t tx = std::min(px >> l, level.tilesX - 1);
+					uint32_t ty = std::min(py >> l, level.tilesY - 1);
+					int slot = levelSlots[l][(size_t)ty * level.tilesX + tx];
+					if (slot >= 0)
+					{
+						entry[0] = (uint16_t)slot;
+						entry[1] = (uint16_t)l;
+						break;
+					}
+				}
+			}
+		}
+
+		glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+		glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, level0.tilesX, level0.tilesY, GL_RG_INTEGER, GL_UNSIGNED_SHORT, pageTable.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	// copies requested tiles out of the mapped file, touching (and faulting in) its pages off the render thread
+	void loaderThread()
+	{
+		size_t tileTexels = (size_t)tileStride * tileStride;
+
+		for (;;)
+		{
+			uint64_t key;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this]() { return stopLoader || !requestQueue.empty(); });
+				if (stopLoader)
+					return;
+
+				key = requestQueue.front();
+				requestQueue.pop_front();
+				inFlight.insert(key);
+			}
+
+			int level, tx, ty;
+			splitKey(key, level, tx, ty);
+
+			PROFILE_SCOPE("tile load");
+			LoadedTile tile;
+			tile.key = key;
+			tile.texels.resize(tileTexels);
+			std::memcpy(tile.texels.data(), source->getTile(level, tx, ty), tileTexels * sizeof(uint16_t));
+
+			std::lock_guard<std::mutex> lock(queueMutex);
+			inFlight.erase(key);
+			completed.push_back(std::move(tile));
+		}
+	}
+};
+
+#endif	// TILEDHEIGHTMAP_H
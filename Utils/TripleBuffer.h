@@ -0,0 +1,59 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of the newest value from one producer thread to one consumer thread. The producer fills its
+// own slot and swaps it with the shared middle slot, the consumer swaps its slot with the middle one whenever a newer
+// value is waiting; neither side ever waits and values the consumer did not pick up in time are overwritten.
+template<typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() {}
+
+	// producer: the slot to fill before publish()
+	T& writeSlot()
+	{
+		return slots[writeIndex].value;
+	}
+
+	// producer: hands the filled slot over and takes back the stale middle one
+	void publish()
+	{
+		int previous = middle.exchange(writeIndex | NEW_VALUE, std::memory_order_acq_rel);
+		writeIndex = previous & INDEX_MASK;
+	}
+
+	// consumer: picks up the newest published value, returns false when there is none since the last call
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & NEW_VALUE))
+			return false;
+
+		int previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & INDEX_MASK;
+		return true;
+	}
+
+	// consumer: the value picked up by the last successful update()
+	const T& readSlot() const
+	{
+		return slots[readIndex].value;
+	}
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int NEW_VALUE = 4;
+
+	// one cache line per slot, the two threads never write to the same line
+	struct alignas(64) Slot {
+		T value;
+	};
+
+	Slot slots[3];
+	int writeIndex = 0;					// producer only
+	int readIndex = 1;					// consumer only
+	std::atomic<int> middle{ 2 };		// index of the shared slot, NEW_VALUE when the consumer has not taken it yet
+};
+
+#endif	// TRIPLEBUFFER_H
@@ -0,0 +1,216 @@
+#ifndef WATERMESH_H
+#define WATERMESH_H
+
+#include <glad/glad.h>
+
+#include <HeightPyramid.h>
+#include <ParallelFor.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+
+// Water surface restricted to the tiles where the terrain dips below the water level. The map is split into tiles of
+// TILE_TEXELS heightmap texels whose minimum terrain height comes from the min/max pyramid (one texel of border
+// for the bilinear filter). The tile quads are stored sorted by that minimum, so the wet tiles of any level are a
+// prefix of the buffer: changing the level only moves the draw count, nothing is rebuilt or uploaded.
+// Vertices sit at y = 0 (x, y, z, u, v like the former map sized quad); the level is applied by the model matrix.
+class WaterMesh {
+public:
+	static const int TILE_TEXELS = 16;
+
+	WaterMesh() {}
+
+	~WaterMesh()
+	{
+		if (vao)
+		{
+			glDeleteVertexArrays(1, &vao);
+			glDeleteBuffers(1, &vbo);
+			glDeleteBuffers(1, &ebo);
+		}
+	}
+
+	// worldWidth / worldHeight is the size of the rendered map, the pyramid may be built over a reduced overview
+	void build(const HeightPyramid& pyramid, float worldWidth, float worldHeight)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		int sourceWidth = std::max(1, pyramid.getSourceWidth());
+		int sourceHeight = std::max(1, pyramid.getSourceHeight());
+		tilesX = (sourceWidth + TILE_TEXELS - 1) / TILE_TEXELS;
+		tilesZ = (sourceHeight + TILE_TEXELS - 1) / TILE_TEXELS;
+
+		int tileCount = tilesX * tilesZ;
+		std::vector<float> minHeights(tileCount);
+		std::vector<glm::vec4> rects(tileCount);		// world x0, z0, x1, z1
+
+		int tx = tilesX, tz = tilesZ;
+		parallelFor(0, tilesZ, [&, tx, tz](int rowBegin, int rowEnd) {
+			for (int j = rowBegin; j < rowEnd; ++j)
+			{
+				int y0 = j * TILE_TEXELS, y1 = std::min(y0 + TILE_TEXELS, sourceHeight);
+				for (int i = 0; i < tx; ++i)
+				{
+					int x0 = i * TILE_TEXELS, x1 = std::min(x0 + TILE_TEXELS, sourceWidth);
+
+					// bilinear filtering reaches half a texel past the tile on every side
+					float maxHeight;
+					pyramid.queryHeights(x0 - 1, y0 - 1, x1, y1, minHeights[j * tx + i], maxHeight);
+
+					rects[j * tx + i] = glm::vec4(
+						(float)x0 / sourceWidth * worldWidth - worldWidth / 2.0f,
+						(float)y0 / sourceHeight * worldHeight - worldHeight / 2.0f,
+						(float)x1 / sourceWidth * worldWidth - worldWidth / 2.0f,
+						(float)y1 / sourceHeight * worldHeight - worldHeight / 2.0f);
+				}
+			}
+		}, 16);
+
+		// lowest tiles first, the wet set of every level is a prefix
+		std::vector<int> order(tileCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return minHeights[a] < minHeights[b]; });
+
+		sortedMinHeights.resize(tileCount);
+		prefixBounds.resize(tileCount);
+		vertices.resize((size_t)tileCount * 4 * 5);
+		indices.resize((size_t)tileCount * 6);
+
+		for (int t = 0; t < tileCount; ++t)
+		{
+			const glm::vec4& rect = rects[order[t]];
+			sortedMinHeights[t] = minHeights[order[t]];
+
+			// x0 z0, x1 z0, x1 z1, x0 z1 with the texture coordinates running 0..1 across the map
+			float* v = vertices.data() + (size_t)t * 20;
+			const float corners[4][2] = { { rect.x, rect.y }, { rect.z, rect.y }, { rect.z, rect.w }, { rect.x, rect.w } };
+			for (int c = 0; c < 4; ++c)
+			{
+				v[c * 5 + 0] = corners[c][0];
+				v[c * 5 + 1] = 0.0f;
+				v[c * 5 + 2] = corners[c][1];
+				v[c * 5 + 3] = corners[c][0] / worldWidth + 0.5f;
+				v[c * 5 + 4] = corners[c][1] / worldHeight + 0.5f;
+			}
+
+			GLuint base = (GLuint)t * 4;
+			GLuint* index = indices.data() + (size_t)t * 6;
+			index[0] = base; index[1] = base + 1; index[2] = base + 3;
+			index[3] = base + 1; index[4] = base + 2; index[5] = base + 3;
+
+			// x / z bounds of the first t + 1 tiles, answers the bounds of any wet set directly
+			glm::vec4 bounds(std::min(rect.x, rect.z), std::min(rect.y, rect.w), std::max(rect.x, rect.z), std::max(rect.y, rect.w));
+			if (t > 0)
+			{
+				const glm::vec4& previous = prefixBounds[t - 1];
+				bounds = glm::vec4(std::min(bounds.x, previous.x), std::min(bounds.y, previous.y),
+					std::max(bounds.z, previous.z), std::max(bounds.w, previous.w));
+			}
+			prefixBounds[t] = bounds;
+		}
+
+		wetTiles = -1;
+		buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// uploads the sorted tiles once; attribute 0 is the position, 1 the texture coordinate
+	void createBuffers()
+	{
+		if (!vao)
+		{
+			glGenVertexArrays(1, &vao);
+			glGenBuffers(1, &vbo);
+			glGenBuffers(1, &ebo);
+		}
+
+		glBindVertexArray(vao);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+
+		glBindVertexArray(0);
+
+		// only the draw count is needed from now on
+		vertices.clear();
+		vertices.shrink_to_fit();
+		indices.clear();
+		indices.shrink_to_fit();
+	}
+
+	// returns true when the set of wet tiles changed
+	bool setLevel(float waterHeight)
+	{
+		int count = (int)(std::lower_bound(sortedMinHeights.begin(), sortedMinHeights.end(), waterHeight) - sortedMinHeights.begin());
+		bool changed = count != wetTiles;
+		wetTiles = count;
+		level = waterHeight;
+		return changed;
+	}
+
+	void draw() const
+	{
+		if (wetTiles <= 0)
+			return;
+
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, wetTiles * 6, GL_UNSIGNED_INT, 0);
+	}
+
+	int getWetTileCount() const
+	{
+		return std::max(0, wetTiles);
+	}
+
+	int getTileCount() const
+	{
+		return tilesX * tilesZ;
+	}
+
+	// world space box of the wet tiles at the current level, empty (min > max) without any
+	void getWetBounds(glm::vec3& boxMin, glm::vec3& boxMax) const
+	{
+		if (wetTiles <= 0)
+		{
+			boxMin = glm::vec3(1.0f);
+			boxMax = glm::vec3(-1.0f);
+			return;
+		}
+
+		const glm::vec4& bounds = prefixBounds[wetTiles - 1];
+		boxMin = glm::vec3(bounds.x, level, bounds.y);
+		boxMax = glm::vec3(bounds.z, level, bounds.w);
+	}
+
+	double getBuildMilliseconds() const
+	{
+		return buildMilliseconds;
+	}
+
+private:
+	int tilesX = 0;
+	int tilesZ = 0;
+	std::vector<float> sortedMinHeights;
+	std::vector<glm::vec4> prefixBounds;		// x0, z0, x1, z1
+	std::vector<float> vertices;
+	std::vector<GLuint> indices;
+
+	GLuint vao = 0, vbo = 0, ebo = 0;
+	int wetTiles = -1;
+	float level = 0.0f;
+	double buildMilliseconds = 0.0;
+};
+
+#endif	// WATERMESH_H
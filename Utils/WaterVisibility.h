@@ -0,0 +1,168 @@
+#ifndef WATERVISIBILITY_H
+#define WATERVISIBILITY_H
+
+#include <glad/glad.h>
+
+#include <Frustum.h>
+
+#include <glm/glm.hpp>
+
+// Decides whether the water surface can be seen, so the reflection and refraction passes (and the water draw itself)
+// can be skipped. The water box is frustum tested every frame; the water draw of the main pass is wrapped in a
+// GL_ANY_SAMPLES_PASSED query against the terrain depth and the newest available result is read back without
+// stalling, so the occlusion answer lags a few frames behind. Occluded water is still drawn (and queried) each frame
+// so that it is noticed when it comes back into view.
+class WaterVisibility {
+public:
+	static const int QUERY_FRAMES = 4;
+
+	struct Stats {
+		int outsideFrustumFrames = 0;
+		int occludedFrames = 0;
+	};
+
+	WaterVisibility() {}
+
+	~WaterVisibility()
+	{
+		if (initialized)
+			glDeleteQueries(QUERY_FRAMES, queries);
+	}
+
+	void initialize()
+	{
+		if (initialized)
+			return;
+
+		glGenQueries(QUERY_FRAMES, queries);
+		initialized = true;
+	}
+
+	bool isEnabled() const
+	{
+		return initialized;
+	}
+
+	// the water box, a flat rectangle unless the surface is displaced
+	void setSurface(const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		surfaceMin = boxMin;
+		surfaceMax = boxMax;
+		invalidate();
+	}
+
+	// forces the water to count as visible until a new query result arrives, e.g. after resizing or a water change
+	void invalidate()
+	{
+		for (int q = 0; q < QUERY_FRAMES; ++q)
+			pending[q] = false;
+		occluded = false;
+		newestFrame = frame;
+	}
+
+	// call once per frame before the water passes; returns whether the water is inside the frustum
+	bool update(const glm::mat4& viewProjection)
+	{
+		++frame;
+		readQueries();
+
+		bool wasInFrustum = inFrustum;
+		inFrustum = Frustum(viewProjection).testAABB(surfaceMin, surfaceMax) != Frustum::OUTSIDE;
+
+		// no query ran while the water was outside, the last result says nothing about the new view
+		if (inFrustum && !wasInFrustum)
+			invalidate();
+
+		if (!inFrustum)
+			++stats.outsideFrustumFrames;
+		else if (occluded)
+			++stats.occludedFrames;
+		return inFrustum;
+	}
+
+	// whether the reflection and refraction passes are needed this frame
+	bool needsPasses() const
+	{
+		return !initialized || (inFrustum && !occluded);
+	}
+
+	// whether the water surface has to be drawn, occluded water is drawn to keep the query running
+	bool needsDraw() const
+	{
+		return !initialized || inFrustum;
+	}
+
+	// wrap the water draw of the main pass, after the terrain depth is written
+	void beginQuery()
+	{
+		if (!initialized)
+			return;
+
+		slot = (slot + 1) % QUERY_FRAMES;
+		// a slot still pending is reused, its result is older than the one issued now
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[slot]);
+	}
+
+	void endQuery()
+	{
+		if (!initialized)
+			return;
+
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		pending[slot] = true;
+		queryFrame[slot] = frame;
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void resetStats()
+	{
+		stats = Stats();
+	}
+
+private:
+	GLuint queries[QUERY_FRAMES] = {};
+	bool pending[QUERY_FRAMES] = {};
+	long long queryFrame[QUERY_FRAMES] = {};
+	int slot = 0;
+	bool initialized = false;
+
+	glm::vec3 surfaceMin = glm::vec3(0.0f);
+	glm::vec3 surfaceMax = glm::vec3(0.0f);
+
+	long long frame = 0;
+	long long newestFrame = 0;
+	bool inFrustum = true;
+	bool occluded = false;
+	Stats stats;
+
+	// non blocking: the newest available result decides, older ones arriving later are dropped
+	void readQueries()
+	{
+		for (int q = 0; q < QUERY_FRAMES; ++q)
+		{
+			if (!pending[q])
+				continue;
+
+			GLuint available = 0;
+			glGetQueryObjectuiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint anySamples = 0;
+			glGetQueryObjectuiv(queries[q], GL_QUERY_RESULT, &anySamples);
+			pending[q] = false;
+
+			if (queryFrame[q] > newestFrame)
+			{
+				newestFrame = queryFrame[q];
+				occluded = anySamples == 0;
+			}
+		}
+	}
+};
+
+#endif	// WATERVISIBILITY_H
@@ -9,10 +9,41 @@
 #include <Shader.h>
 #include <Camera.h>
 #include <FrameBufferHandler.h>
+#include <Frustum.h>
+#include <TerrainQuadtree.h>
+#include <Heightmap.h>
+#include <ProceduralHeightmap.h>
+#include <HeightPyramid.h>
+#include <AppOptions.h>
+#include <OffscreenContext.h>
+#include <CameraPath.h>
+#include <PassTimer.h>
+#include <Benchmark.h>
+#include <TextureLoader.h>
+#include <TiledHeightmap.h>
+#include <PassRefresh.h>
+#include <FrameGovernor.h>
+#include <TerrainHeightField.h>
+#include <NormalMap.h>
+#include <TerrainMaterials.h>
+#include <OcclusionCuller.h>
+#include <WaterVisibility.h>
+#include <WaterMesh.h>
+#include <CameraSimulation.h>
+#include <Profiler.h>
+#include <TessellationStats.h>
+#include <TessellationBudget.h>
+#include <PatchRoughness.h>
+#include <CdlodTerrain.h>
+#include <ClipmapTerrain.h>
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <sstream>
 #include <cmath>
+#include <algorithm>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int modifiers);
@@ -27,14 +58,29 @@ const unsigned int NUM_PATCH_PTS = 4;
 int useWireframe = 0;
 int displayGrayscale = 0;
 
+// profiling toggled with P, T writes the recorded trace
+bool profilingEnabled = false;
+bool traceRequested = false;
+
+// patches per side of the terrain grid, changed at runtime with [ and ]
+const unsigned int MIN_PATCH_REZ = 8;
+const unsigned int MAX_PATCH_REZ = 512;
+unsigned int patchGridRez = 20;
+
 // camera settings - start from good spot
 Camera camera(glm::vec3(67.0f, 627.5f, 169.9f),
     glm::vec3(0.0f, 1.0f, 0.0f),
     -128.1f, -42.4f);
+// the interactive camera moves on the simulation thread, the render loop samples it every frame
+CameraSimulation cameraSimulation;
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
+// current backbuffer size, updated by framebuffer_size_callback
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
@@ -43,351 +89,396 @@ float lastFrame = 0.0f;
 float waterHeight = 10.0f;
 float waveSpeed = 0.03f;
 
-int main()
+// camera path recording (toggled with R)
+bool recordingCameraPath = false;
+float cameraPathStart = 0.0f;
+CameraPath recordedCameraPath;
+
+int main(int argc, char** argv)
 {
-    // glfw: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // glfw window creation
-    // --------------------
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Terrain GPU", NULL, NULL);
-    if (window == NULL)
+    AppOptions options;
+    if (!parseArguments(argc, argv, options))
+        return 0;
+
+    patchGridRez = std::max(MIN_PATCH_REZ, std::min((unsigned int)options.patchGridRez, MAX_PATCH_REZ));
+
+    if (options.cdlod && options.clipmap)
     {
-        std::cout << "Failed to create GLFW window!" << std::endl;
-        glfwTerminate();
-        return -1;
+        std::cout << "--cdlod and --clipmap exclude each other, using the clipmap" << std::endl;
+        options.cdlod = false;
     }
 
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
+    // the patch based features need the tessellation path
+    if ((options.cdlod || options.clipmap) && (options.occlusionCulling || options.tessHistogram || options.triangleBudget > 0))
+    {
+        std::cout << (options.cdlod ? "CDLOD" : "Clipmap") << " terrain: occlusion culling, the tessellation histogram and the triangle budget are disabled" << std::endl;
+        options.occlusionCulling = false;
+        options.tessHistogram = false;
+        options.triangleBudget = 0;
+    }
 
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // headless runs try a surfaceless EGL context first
+    // -------------------------------------------------
+    GLFWwindow* window = NULL;
+    OffscreenContext offscreenContext;
+    bool useOffscreenContext = options.benchmark && offscreenContext.create(4, 1);
 
-    // glad: load all OpenGl function pointers
-    // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    if (useOffscreenContext)
+    {
+        if (!gladLoadGLLoader((GLADloadproc)OffscreenContext::getProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD!" << std::endl;
+            return -1;
+        }
+    }
+    else
     {
-        std::cout << "Failed to initialize GLAD!" << std::endl;
-        return -1;
+        // glfw: initialize and configure
+        // ------------------------------
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        // benchmarks without EGL fall back to a hidden window
+        if (options.benchmark)
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+        // glfw window creation
+        // --------------------
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Terrain GPU", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window!" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+
+        glfwMakeContextCurrent(window);
+
+        if (!options.benchmark)
+        {
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+            glfwSetKeyCallback(window, key_callback);
+            glfwSetCursorPosCallback(window, mouse_callback);
+            glfwSetScrollCallback(window, scroll_callback);
+
+            // tell GLFW to capture our mouse
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        }
+
+        // glad: load all OpenGl function pointers
+        // ---------------------------------------
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD!" << std::endl;
+            return -1;
+        }
     }
 
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
 
-    // build and compile shader programs
-    // ---------------------------------
-    Shader heightMapShader("TessellationGPU_Vert.txt", "TessellationGPU_Frag.txt",
-                            "TessellationGPU_TCS.txt", "TessellationGPU_TES.txt");
+    // build and compile shader programs, warm starts load them from the program binary cache
+    // ----------------------------------------------------------------------------------------
+    Shader::setCacheDirectory(options.shaderCacheDirectory);
+
+    // the CDLOD and clipmap vertex shaders displace their grids themselves and feed the same fragment shader
+    bool tessellatedTerrain = !options.cdlod && !options.clipmap;
+    Shader heightMapShader(options.clipmap ? "Clipmap_Vert.txt" : options.cdlod ? "CDLOD_Vert.txt" : "TessellationGPU_Vert.txt", "TessellationGPU_Frag.txt",
+                            tessellatedTerrain ? "TessellationGPU_TCS.txt" : nullptr, tessellatedTerrain ? "TessellationGPU_TES.txt" : nullptr);
 
     Shader waterShader("WaterShader_Vert.txt", "WaterShader_Frag.txt");
 
     Shader debugShader("Debug_Vert.txt", "Debug_Frag.txt");
 
-    // load and create a texture for height map
-    // ----------------------------------------
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // the patch only programs are not built for the CDLOD and clipmap terrain
+    std::unique_ptr<Shader> hiZShader, patchCullShader, tessLevelShader;
+    if (tessellatedTerrain)
+    {
+        // occlusion culling: max depth pyramid reduction and the transform feedback patch test
+        hiZShader.reset(new Shader("HiZ_Vert.txt", "HiZ_Frag.txt"));
 
-    // set the texture wrapping params
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        patchCullShader.reset(new Shader("PatchCull_Vert.txt", "PatchCull_Geom.txt", { "patchVertex" }));
 
-    // set texture filtering params
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // tessellation statistics: the terrain TCS levels of every patch, one point per patch
+        tessLevelShader.reset(new Shader("TessellationGPU_Vert.txt", "TessLevels_Geom.txt", { "patchOuterLevels", "patchInnerLevels" },
+                                "TessellationGPU_TCS.txt", "TessLevels_TES.txt"));
+    }
 
-    // load image, create texture and generate mipmaps
-    //stbi_set_flip_vertically_on_load(true);
-    int width, height, nrChannels;
-    unsigned char* data = stbi_load("iceland_heightmap.png", &width, &height, &nrChannels, 0);
+    std::cout << "Shader programs ready in " << Shader::getBuildMilliseconds() << " ms ("
+        << (Shader::getCompiledProgramCount() > 0 ? "cold start, " : "warm start, ")
+        << Shader::getCachedProgramCount() << " cached, " << Shader::getCompiledProgramCount() << " compiled)" << std::endl;
 
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // load all textures: decoded in parallel, uploaded through pixel buffer objects
+    // -----------------------------------------------------------------------------
+    TextureLoader textureLoader;
 
-        heightMapShader.use();
-        heightMapShader.setInt("heightMap", 0);
-        std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
-    
-    stbi_image_free(data);
-
-    // load and create a texture for the terrain - level 0
-    // ---------------------------------------------------
-    unsigned int terrainTexture0;
-    glGenTextures(1, &terrainTexture0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, terrainTexture0);
-
-    // Set the texture wrapping and filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    int colorWidth, colorHeight, colorChannels;
-    data = stbi_load("dirt1.png", &colorWidth, &colorHeight, &colorChannels, 0);
-
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colorWidth, colorHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // height map, the decoded pixels are kept for the CPU side terrain data;
+    // a tiled heightmap replaces it with tiles streamed through the GPU tile cache,
+    // a procedural one with texels generated from the seed
+    TiledHeightmap tiledHeightmap;
+    bool useTiledHeightmap = !options.tiledHeightmapFile.empty() && tiledHeightmap.open(options.tiledHeightmapFile);
+    bool useProceduralHeightmap = !useTiledHeightmap && options.proceduralWidth > 0;
 
-        heightMapShader.use();
-        heightMapShader.setInt("textureHeight0", 1);
-        //std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
-    }
-    else
+    int heightMapAsset = -1;
+    if (!useTiledHeightmap && !useProceduralHeightmap)
     {
-        std::cout << "Failed to load texture" << std::endl;
+        // single channel at full precision: 16 bit images and raw files as GL_R16, float files as GL_R32F
+        TextureDesc heightMapDesc(options.heightmapFile, 0);
+        heightMapDesc.pixelType = GL_UNSIGNED_SHORT;
+        heightMapDesc.singleChannel = true;
+        heightMapDesc.rawWidth = options.heightmapWidth;
+        heightMapDesc.rawHeight = options.heightmapHeight;
+        heightMapDesc.keepPixels = true;
+        heightMapAsset = textureLoader.add(heightMapDesc);
     }
 
-    stbi_image_free(data);
+    // terrain material layers, decoded here and packed into one texture array below
+    TerrainMaterials terrainMaterials;
+    if (!options.materialsFile.empty())
+        terrainMaterials.load(options.materialsFile);
 
-    // create and load texture for terrain - level 1
-    // ---------------------------------------------
-    unsigned int terrainTexture1;
-    glGenTextures(1, &terrainTexture1);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, terrainTexture1);
+    std::vector<int> materialAssets;
+    for (const MaterialLayer& layer : terrainMaterials.getLayers())
+    {
+        TextureDesc layerDesc(layer.texture, 1);
+        layerDesc.createTexture = false;
+        layerDesc.keepPixels = true;
+        materialAssets.push_back(textureLoader.add(layerDesc));
+    }
 
-    // Set the texture wrapping and filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // dudv map for the water, no mipmaps
+    TextureDesc dudvDesc("waterDUDV.png", 5, 3);
+    dudvDesc.minFilter = GL_LINEAR;
+    dudvDesc.generateMipmaps = false;
+    int dudvAsset = textureLoader.add(dudvDesc);
 
-    //int colorWidth, colorHeight, colorChannels;
-    data = stbi_load("dirt4.png", &colorWidth, &colorHeight, &colorChannels, 0);
+    textureLoader.loadAll();
+    textureLoader.printTimings();
 
-    if (data)
+    int width, height;
+    heightMapShader.use();
+    Heightmap proceduralTexels;
+    unsigned int proceduralTexture = 0;
+    if (useTiledHeightmap)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colorWidth, colorHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        width = (int)tiledHeightmap.getHeader().width;
+        height = (int)tiledHeightmap.getHeader().height;
+    }
+    else if (useProceduralHeightmap)
+    {
+        ProceduralHeightmap proceduralHeightmap;
+        proceduralTexels = proceduralHeightmap.generate(options.proceduralWidth, options.proceduralHeight, options.seed);
+        width = proceduralTexels.width;
+        height = proceduralTexels.height;
 
-        heightMapShader.use();
-        heightMapShader.setInt("textureHeight1", 2);
-        //std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
+        proceduralTexture = ProceduralHeightmap::createTexture(proceduralTexels, 0);
+        heightMapShader.setInt("heightMap", 0);
+        std::cout << "Generated procedural heightmap of size " << height << " x " << width << " from seed " << options.seed
+            << " in " << proceduralHeightmap.getGenerateMilliseconds() << " ms" << std::endl;
     }
     else
     {
-        std::cout << "Failed to load texture" << std::endl;
+        const LoadedTexture& heightMapTexture = textureLoader.get(heightMapAsset);
+        width = heightMapTexture.width;
+        height = heightMapTexture.height;
+
+        if (heightMapTexture.loaded)
+        {
+            heightMapShader.setInt("heightMap", 0);
+            std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
+        }
     }
 
-    stbi_image_free(data);
+    // material layers share one GL_TEXTURE_2D_ARRAY and its mips; a procedural run also renders without the layer assets
+    unsigned int materialTexture = terrainMaterials.createArrayTexture(textureLoader, materialAssets, 1, useProceduralHeightmap ? 4 : 0);
+    for (int asset : materialAssets)
+        textureLoader.releasePixels(asset);
 
-    // create and load texture for terrain - level 2
-    // ---------------------------------------------
-    unsigned int terrainTexture2;
-    glGenTextures(1, &terrainTexture2);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, terrainTexture2);
+    heightMapShader.use();
+    heightMapShader.setInt("materials", 1);
 
-    // Set the texture wrapping and filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // a procedural run does not depend on the dudv asset either
+    unsigned int dudvFallbackTexture = 0;
+    if (!textureLoader.get(dudvAsset).loaded)
+    {
+        if (!useProceduralHeightmap)
+            return -1;
+        dudvFallbackTexture = ProceduralHeightmap::createDudvTexture(128, 5);
+    }
 
-    //int colorWidth, colorHeight, colorChannels;
-    data = stbi_load("grass_mossy.png", &colorWidth, &colorHeight, &colorChannels, 0);
+    waterShader.use();
+    waterShader.setInt("dudvMap", 5);
+
+    // keep a CPU copy of the sampled channel and summarize it in a min/max pyramid
+    // -----------------------------------------------------------------------------
+    Heightmap heightmap;
+    TileCache tileCache;
+    bool useTileCache = useTiledHeightmap && !options.clipmap;
+    if (useTiledHeightmap)
+    {
+        // culling bounds come from a reduced overview, the full resolution tiles stay on disk
+        heightmap = tiledHeightmap.buildOverview(4096);
 
-    if (data)
+        // the clipmap levels are filled from the overview instead of the streamed tiles
+        if (useTileCache)
+        {
+            tileCache.initialize(tiledHeightmap, options.tileCacheSlots, 10, 11);
+            std::cout << "Tile cache: " << tileCache.getSlotCount() << " tiles, " << tileCache.getStats().residentTiles << " pinned" << std::endl;
+
+            heightMapShader.use();
+            heightMapShader.setBool("useTiledHeightmap", true);
+            heightMapShader.setInt("tileCache", 10);
+            heightMapShader.setInt("pageTable", 11);
+            heightMapShader.setVec2("tiledMapSize", glm::vec2((float)width, (float)height));
+            heightMapShader.setFloat("tileSize", (float)tiledHeightmap.getHeader().tileSize);
+            heightMapShader.setFloat("tileBorder", (float)tiledHeightmap.getHeader().border);
+            heightMapShader.setFloat("heightScale", tiledHeightmap.getHeader().heightScale);
+            heightMapShader.setFloat("heightOffset", tiledHeightmap.getHeader().heightOffset);
+        }
+    }
+    else if (useProceduralHeightmap)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colorWidth, colorHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        heightmap = std::move(proceduralTexels);
+        heightmap.heightScale = options.heightScale;
+        heightmap.heightOffset = options.heightOffset;
 
         heightMapShader.use();
-        heightMapShader.setInt("textureHeight2", 3);
-        //std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
+        heightMapShader.setFloat("heightScale", options.heightScale);
+        heightMapShader.setFloat("heightOffset", options.heightOffset);
     }
     else
     {
-        std::cout << "Failed to load texture" << std::endl;
+        const LoadedTexture& heightMapTexture = textureLoader.get(heightMapAsset);
+        if (heightMapTexture.pixelType == GL_FLOAT)
+            heightmap = Heightmap::fromFloat((const float*)heightMapTexture.pixels, width, height, options.heightScale, options.heightOffset);
+        else
+        {
+            heightmap = Heightmap::fromImage16((const uint16_t*)heightMapTexture.pixels, width, height, heightMapTexture.channels);
+            heightmap.heightScale = options.heightScale;
+            heightmap.heightOffset = options.heightOffset;
+        }
+        textureLoader.releasePixels(heightMapAsset);
+
+        heightMapShader.use();
+        heightMapShader.setFloat("heightScale", options.heightScale);
+        heightMapShader.setFloat("heightOffset", options.heightOffset);
     }
 
-    stbi_image_free(data);
+    HeightPyramid heightPyramid;
+    heightPyramid.build(heightmap);
+    std::cout << "Built min/max height pyramid with " << heightPyramid.getLevelCount() << " levels in "
+        << heightPyramid.getBuildMilliseconds() << " ms" << std::endl;
 
-    // create and load texture for terrain - level 3
-    // ---------------------------------------------
-    unsigned int terrainTexture3;
-    glGenTextures(1, &terrainTexture3);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, terrainTexture3);
+    // RG16 copy of the pyramid for GPU side bounds queries, kept on its own texture unit;
+    // the TCS lifts the patch edges to the terrain height with it
+    unsigned int heightPyramidTexture = heightPyramid.createTexture(9);
+    if (tessellatedTerrain)
+    {
+        for (Shader* shader : { &heightMapShader, tessLevelShader.get() })
+        {
+            shader->use();
+            shader->setInt("heightPyramid", 9);
+            shader->setFloat("pyramidHeightScale", heightPyramid.getHeightScale());
+            shader->setFloat("pyramidHeightOffset", heightPyramid.getHeightOffset());
+        }
+    }
 
-    // Set the texture wrapping and filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Sobel normal map for the terrain lighting, next to the heightmap
+    NormalMap normalMap;
+    normalMap.build(heightmap, (float)width, (float)height);
+    std::cout << "Built normal map in " << normalMap.getBuildMilliseconds() << " ms" << std::endl;
 
-    //int colorWidth, colorHeight, colorChannels;
-    data = stbi_load("snow01.png", &colorWidth, &colorHeight, &colorChannels, 0);
+    unsigned int normalMapTexture = normalMap.createTexture(12);
+    heightMapShader.use();
+    heightMapShader.setInt("normalMap", 12);
 
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colorWidth, colorHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // material blend weights from the height and slope ranges of the layers
+    terrainMaterials.buildSplatMap(heightmap, normalMap);
+    std::cout << "Built material splat map in " << terrainMaterials.getBuildMilliseconds() << " ms" << std::endl;
 
-        heightMapShader.use();
-        heightMapShader.setInt("textureHeight3", 4);
-        //std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
-    }
-    else
-    {
-        std::cout << "Failed to load texture" << std::endl;
-    }
+    unsigned int splatTexture = terrainMaterials.createSplatTexture(2);
+    heightMapShader.setInt("splatMap", 2);
 
-    stbi_image_free(data);
+    // CPU height and normal queries matching the displaced terrain
+    TerrainHeightField terrainHeightField;
+    terrainHeightField.build(heightmap, (float)width, (float)height);
 
-    //create and load texture - dudv map
-    //----------------------------------
-    unsigned int dudvTexture;
-    glGenTextures(1, &dudvTexture);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, dudvTexture);
+    // the patch grid is generated in the vertex shader from gl_VertexID, only its resolution is kept here
+    // ----------------------------------------------------------------------------------------------------
+    unsigned int rez = patchGridRez;
 
-    // Set the texture wrapping and filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // how far every patch strays from its corner surface, flat patches are tessellated less
+    // --------------------------------------------------------------------------------------
+    PatchRoughness patchRoughness;
 
-    //int colorWidth, colorHeight, colorChannels;
-    data = stbi_load("waterDUDV.png", &colorWidth, &colorHeight, &colorChannels, 3);
+    // build the patch quadtree used for frustum culling
+    // ------------------------------------------------
+    TerrainQuadtree terrainQuadtree;
 
-    if (data)
+    if (tessellatedTerrain)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, colorWidth, colorHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        //glGenerateMipmap(GL_TEXTURE_2D);
+        std::cout << "Patch grid of " << rez * rez << " patches of 4 control points each ([ and ] change the resolution)" << std::endl;
 
-        waterShader.use();
-        waterShader.setInt("dudvMap", 5);
-        //std::cout << "Loaded heightmap of size " << height << " x " << width << std::endl;
+        patchRoughness.build(heightmap, (int)rez);
+        patchRoughness.upload(3);
+        std::cout << "Built patch roughness in " << patchRoughness.getBuildMilliseconds() << " ms, " << patchRoughness.getFlatPatchCount()
+            << "/" << rez * rez << " nearly flat patches" << std::endl;
+
+        for (Shader* shader : { &heightMapShader, tessLevelShader.get() })
+        {
+            shader->use();
+            shader->setInt("patchRoughness", 3);
+            shader->setFloat("flatDeviation", options.flatDeviation);
+        }
+
+        terrainQuadtree.build(rez, width, height, heightPyramid, NUM_PATCH_PTS);
     }
-    else
+
+    // CDLOD: a quadtree of instanced grids replaces the patches
+    CdlodTerrain cdlodTerrain;
+    CdlodDrawList cdlodQuadrants;
+    if (options.cdlod)
     {
-        std::cout << "Failed to load texture" << std::endl;
-        return -1;
+        cdlodTerrain.build(width, height, heightPyramid, options.cdlodRange);
+        cdlodTerrain.createBuffers();
+        cdlodTerrain.setUniforms(heightMapShader);
+        std::cout << "Built CDLOD quadtree with " << cdlodTerrain.getLevelCount() << " levels in " << cdlodTerrain.getBuildMilliseconds() << " ms" << std::endl;
     }
 
-    stbi_image_free(data);
-
-    // set up vertex data (and buffers) and configure vertex attributes
-    // ----------------------------------------------------------------
-    std::vector<float> vertices;
-    unsigned int rez = 20;
-       
-    for (int i = 0; i <= rez - 1; ++i)
+    // geometry clipmap: camera centred level grids, their height textures on units 16 and 17
+    ClipmapTerrain clipmapTerrain;
+    long long reportedClipmapTexels = 0;
+    if (options.clipmap)
     {
-        for (int j = 0; j <= rez - 1; ++j)
-        {
-            vertices.push_back(-width / 2.0f + width * i / (float)rez);     // v.x
-            vertices.push_back(0.0f);                                       // v.y
-            vertices.push_back(-height / 2.0f + height * j / (float)rez);   // v.z
-            vertices.push_back(i / (float)rez);                             // u
-            vertices.push_back(j / (float)rez);                             // v
-
-            vertices.push_back(-width / 2.0f + width * (i + 1) / (float)rez); // v.x
-            vertices.push_back(0.0f); // v.y
-            vertices.push_back(-height / 2.0f + height * j / (float)rez); // v.z
-            vertices.push_back((i + 1) / (float)rez); // u
-            vertices.push_back(j / (float)rez); // v
-
-            vertices.push_back(-width / 2.0f + width * i / (float)rez); // v.x
-            vertices.push_back(0.0f); // v.y
-            vertices.push_back(-height / 2.0f + height * (j + 1) / (float)rez); // v.z
-            vertices.push_back(i / (float)rez); // u
-            vertices.push_back((j + 1) / (float)rez); // v
-
-            vertices.push_back(-width / 2.0f + width * (i + 1) / (float)rez); // v.x
-            vertices.push_back(0.0f); // v.y
-            vertices.push_back(-height / 2.0f + height * (j + 1) / (float)rez); // v.z
-            vertices.push_back((i + 1) / (float)rez); // u
-            vertices.push_back((j + 1) / (float)rez); // v
-        }
+        clipmapTerrain.build(heightmap, width, height, options.clipmapLevels);
+        clipmapTerrain.createResources(heightMapShader, 16, 17);
+        std::cout << "Built geometry clipmap with " << clipmapTerrain.getLevelCount() << " levels in " << clipmapTerrain.getBuildMilliseconds() << " ms" << std::endl;
     }
 
-    std::cout << "Loaded " << rez * rez << " patches of 4 control points each" << std::endl;
-    std::cout << "Processing " << rez * rez * 4 << " vertices in vertex shader" << std::endl;
+    PatchDrawList reflectionPatches, refractionPatches, mainPatches;
+    PatchCullStats reflectionCullStats, refractionCullStats, mainCullStats;
+    float lastCullReport = 0.0f;
+    unsigned int frameIndex = 0;
 
-    // VAO configuration
-    unsigned int terrainVAO, terrainVBO;
+    // the core profile still needs a bound VAO, it stays empty
+    unsigned int terrainVAO;
     glGenVertexArrays(1, &terrainVAO);
     glBindVertexArray(terrainVAO);
 
-    glGenBuffers(1, &terrainVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, terrainVBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // texCoord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(sizeof(float) * 3));
-    glEnableVertexAttribArray(1);
-
     glPatchParameteri(GL_PATCH_VERTICES, NUM_PATCH_PTS);
 
-    // set up vertex data and buffers for the water surface
-    // ----------------------------------------------------
-    float waterVertices[] =
-    {
-        // positions                                // texture coords
-        -width / 2.0f, waterHeight, -height / 2.0f, 0.0f, 0.0f,     // bottom left
-         width / 2.0f, waterHeight, -height / 2.0f, 1.0f, 0.0f,     // bottom right
-         width / 2.0f, waterHeight,  height / 2.0f, 1.0f, 1.0f,     // top right
-        -width / 2.0f, waterHeight,  height / 2.0f, 0.0f, 1.0f,     // top left
-    };
-
-    // water indices
-    unsigned int waterIndices[] =
-    {
-        0, 1, 2,
-        0, 2, 3
-    };
-
-    // VAO configuration
-    unsigned int waterVAO, waterVBO, waterEBO;
-
-    glGenVertexArrays(1, &waterVAO);
-    glBindVertexArray(waterVAO);
-
-    glGenBuffers(1, &waterVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, waterVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(waterVertices), waterVertices, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &waterEBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, waterEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(waterIndices), waterIndices, GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // texture coordinate attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // unbind water VAO
-    glBindVertexArray(0);
+    // water surface: only the tiles where the terrain dips below the water level
+    // ---------------------------------------------------------------------------
+    WaterMesh waterMesh;
+    waterMesh.build(heightPyramid, (float)width, (float)height);
+    waterMesh.createBuffers();
+    waterMesh.setLevel(waterHeight);
+    std::cout << "Built water mesh in " << waterMesh.getBuildMilliseconds() << " ms, " << waterMesh.getWetTileCount() << "/"
+        << waterMesh.getTileCount() << " tiles below the water level (- and = change it)" << std::endl;
 
     // sending data to water fragment shader
     // -------------------------------------
@@ -435,7 +526,20 @@ int main()
 
     // set up the FBO handler
     // ----------------------
-    FrameBufferHandler fbHandler(6);    // start from texture slot 5
+    FrameBufferHandler fbHandler(6, framebufferWidth, framebufferHeight);    // start from texture slot 6
+
+    // benchmarks always render into an offscreen target of the window size
+    if (options.benchmark)
+        fbHandler.initializeOffscreenFrameBuffer(SCR_WIDTH, SCR_HEIGHT);
+
+    // occlusion culling reads the main pass depth, which then always goes to the scene target
+    OcclusionCuller occlusionCuller;
+    if (options.occlusionCulling)
+    {
+        fbHandler.setSceneDepthReadable(true, 15);
+        occlusionCuller.initialize(*hiZShader, *patchCullShader, 13, 14);
+        occlusionCuller.setPatchGrid(terrainQuadtree, width, height);
+    }
 
     // declaring the clipping planes
     glm::vec4 reflectionClippingPlane = glm::vec4(0.0f, 1.0f, 0.0f, -waterHeight);
@@ -444,24 +548,250 @@ int main()
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
 
+    // reflection and refraction can be refreshed at a reduced rate, reusing the old textures in between
+    PassRefresh reflectionRefresh(options.waterRefreshFrames, options.waterRefreshDistance);
+    PassRefresh refractionRefresh(options.waterRefreshFrames, options.waterRefreshDistance);
+
+    // both passes are skipped while the water quad is off screen or hidden behind the terrain
+    WaterVisibility waterVisibility;
+    if (options.waterCulling)
+    {
+        glm::vec3 waterMin, waterMax;
+        waterMesh.getWetBounds(waterMin, waterMax);
+        waterVisibility.initialize();
+        waterVisibility.setSurface(waterMin, waterMax);
+    }
+    float meshWaterHeight = waterHeight;
+    bool waterPassesNeeded = true;
+
+    // dynamic resolution, holds the target frame time when one is given
+    FrameGovernor frameGovernor;
+    frameGovernor.initialize(options.targetFrameMs);
+    float waterScale = 1.0f;
+
     // the move factor for the waves
     float moveFactor = 0.0f;
 
+    // resolve the uniforms used every frame once
+    // ------------------------------------------
+    UniformHandle<glm::vec4> terrainClippingPlane = heightMapShader.getUniform<glm::vec4>("clippingPlane");
+    UniformHandle<glm::mat4> terrainProjection = heightMapShader.getUniform<glm::mat4>("projection");
+    UniformHandle<glm::mat4> terrainView = heightMapShader.getUniform<glm::mat4>("view");
+    UniformHandle<glm::mat4> terrainModel = heightMapShader.getUniform<glm::mat4>("model");
+    UniformHandle<glm::vec3> terrainCameraPosition;
+    if (options.cdlod)
+        terrainCameraPosition = heightMapShader.getUniform<glm::vec3>("cameraPosition");
+
+    // the patch grid and TCS uniforms only exist in the tessellation path
+    UniformHandle<float> terrainTessScale, terrainPixelsPerEdge, terrainViewportHeight;
+    UniformHandle<int> terrainGridRez;
+    UniformHandle<glm::vec2> terrainGridOrigin, terrainGridSpacing;
+    UniformHandle<bool> terrainFeedbackVertices;
+    UniformHandle<glm::mat4> tessLevelProjection, tessLevelView, tessLevelModel;
+    UniformHandle<float> tessLevelTessScale, tessLevelPixelsPerEdge, tessLevelViewportHeight;
+    UniformHandle<int> tessLevelGridRez;
+    UniformHandle<glm::vec2> tessLevelGridSpacing;
+    if (tessellatedTerrain)
+    {
+        terrainTessScale = heightMapShader.getUniform<float>("tessScale");
+        terrainGridRez = heightMapShader.getUniform<int>("gridRez");
+        terrainGridOrigin = heightMapShader.getUniform<glm::vec2>("gridOrigin");
+        terrainGridSpacing = heightMapShader.getUniform<glm::vec2>("gridSpacing");
+        terrainFeedbackVertices = heightMapShader.getUniform<bool>("useFeedbackVertices");
+        terrainPixelsPerEdge = heightMapShader.getUniform<float>("pixelsPerEdge");
+        terrainViewportHeight = heightMapShader.getUniform<float>("viewportHeight");
+
+        heightMapShader.use();
+        terrainGridRez.set((int)rez);
+        terrainGridOrigin.set(glm::vec2(-width / 2.0f, -height / 2.0f));
+        terrainGridSpacing.set(glm::vec2(width / (float)rez, height / (float)rez));
+
+        tessLevelProjection = tessLevelShader->getUniform<glm::mat4>("projection");
+        tessLevelView = tessLevelShader->getUniform<glm::mat4>("view");
+        tessLevelModel = tessLevelShader->getUniform<glm::mat4>("model");
+        tessLevelTessScale = tessLevelShader->getUniform<float>("tessScale");
+        tessLevelPixelsPerEdge = tessLevelShader->getUniform<float>("pixelsPerEdge");
+        tessLevelViewportHeight = tessLevelShader->getUniform<float>("viewportHeight");
+        tessLevelGridRez = tessLevelShader->getUniform<int>("gridRez");
+        tessLevelGridSpacing = tessLevelShader->getUniform<glm::vec2>("gridSpacing");
+
+        tessLevelShader->use();
+        tessLevelGridRez.set((int)rez);
+        tessLevelShader->setVec2("gridOrigin", glm::vec2(-width / 2.0f, -height / 2.0f));
+        tessLevelGridSpacing.set(glm::vec2(width / (float)rez, height / (float)rez));
+    }
+
+    UniformHandle<int> waterReflectionTexture = waterShader.getUniform<int>("reflectionTexture");
+    UniformHandle<int> waterRefractionTexture = waterShader.getUniform<int>("refractionTexture");
+    UniformHandle<glm::mat4> waterProjection = waterShader.getUniform<glm::mat4>("projection");
+    UniformHandle<glm::mat4> waterView = waterShader.getUniform<glm::mat4>("view");
+    UniformHandle<glm::mat4> waterModel = waterShader.getUniform<glm::mat4>("model");
+    UniformHandle<float> waterMoveFactor = waterShader.getUniform<float>("moveFactor");
+    UniformHandle<glm::vec3> waterCameraPosition = waterShader.getUniform<glm::vec3>("cameraPosition");
+    UniformHandle<glm::vec2> waterReflectionUVScale = waterShader.getUniform<glm::vec2>("reflectionUVScale");
+    UniformHandle<glm::vec2> waterRefractionUVScale = waterShader.getUniform<glm::vec2>("refractionUVScale");
+
+    // set up the benchmark run
+    // ------------------------
+    profilingEnabled = options.profile;
+    Profiler::instance().setEnabled(profilingEnabled);
+    int traceIndex = 0;
+
+    PassTimer passTimer;
+    passTimer.initialize(options.benchmark || profilingEnabled);
+    passTimer.setRecordSamples(options.benchmark);
+
+    // pixels per triangle edge of the TCS, held to the triangle budget from the measured primitives
+    TessellationBudget tessellationBudget;
+    tessellationBudget.initialize((uint64_t)options.triangleBudget, options.pixelsPerEdge);
+
+    // primitives and TES invocations per terrain pass, measured along with the pass timings and for the budget
+    TessellationStats tessellationStats;
+    tessellationStats.initialize(options.benchmark || profilingEnabled || tessellationBudget.isEnabled());
+    tessellationStats.setRecordSamples(options.benchmark);
+    if (options.tessHistogram)
+        tessellationStats.enableLevelCapture(*tessLevelShader, (int)(rez * rez));
+
+    Benchmark benchmark;
+    if (options.benchmark)
+    {
+        CameraPath benchmarkPath;
+        if (options.cameraPathFile.empty() || !benchmarkPath.load(options.cameraPathFile))
+            benchmarkPath.buildFlyover((float)width, (float)height);
+
+        benchmark.initialize(benchmarkPath, options.benchmarkFrames, options.benchmarkWarmupFrames);
+
+        std::string heightmapSource = useTiledHeightmap ? options.tiledHeightmapFile : options.heightmapFile;
+        if (useProceduralHeightmap)
+            heightmapSource = "procedural " + std::to_string(width) + "x" + std::to_string(height) + " seed " + std::to_string(options.seed);
+        benchmark.setHeightmap(heightmapSource, heightmap.checksum());
+    }
+
+    // the camera steps at a fixed rate on its own thread, kept above the terrain surface
+    if (!options.benchmark)
+    {
+        cameraSimulation.start(camera, [&terrainHeightField](float x, float z) {
+            return terrainHeightField.getHeight(x, z) + 2.0f;
+        }, options.simulationRate);
+    }
+
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    while (options.benchmark ? benchmark.isRunning() : !glfwWindowShouldClose(window))
     {
+        PROFILE_SCOPE("frame");
+
         // per-frame time logic
         // --------------------
-        float currentFrame = glfwGetTime();
+        float currentFrame;
+        if (options.benchmark)
+        {
+            deltaTime = benchmark.beginFrame(camera);
+            currentFrame = lastFrame + deltaTime;
+        }
+        else
+            currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        //std::cout << deltaTime << std::endl;
+        // profiling is switched between frames, never with a pass open
+        if (!options.benchmark && profilingEnabled != passTimer.isEnabled())
+        {
+            passTimer.setEnabled(profilingEnabled);
+            tessellationStats.setEnabled(profilingEnabled || tessellationBudget.isEnabled());
+            Profiler::instance().setEnabled(profilingEnabled);
+            std::cout << "Profiling " << (profilingEnabled ? "on" : "off") << std::endl;
+            if (!profilingEnabled)
+                glfwSetWindowTitle(window, "Terrain GPU");
+        }
+        if (traceRequested)
+        {
+            traceRequested = false;
+            Profiler::instance().writeTrace("trace_" + std::to_string(traceIndex++) + ".json", tessellationStats.buildHistogramJson());
+        }
+
+        passTimer.beginFrame();
+        tessellationStats.beginFrame();
+        frameGovernor.beginFrame();
+
+        uint64_t framePrimitives;
+        if (tessellationStats.takeFramePrimitives(framePrimitives))
+            tessellationBudget.addSample(framePrimitives);
+        ++frameIndex;
+
+        // follow window resizes and the dynamic resolution; new or rescaled water targets have to be re-rendered
+        bool targetsChanged = fbHandler.resize(framebufferWidth, framebufferHeight);
+        fbHandler.setDynamicScale(frameGovernor.getWaterScale(), frameGovernor.getRenderScale());
+        if (targetsChanged)
+        {
+            occlusionCuller.invalidate();
+            waterVisibility.invalidate();
+        }
+        if (targetsChanged || frameGovernor.getWaterScale() != waterScale)
+        {
+            waterScale = frameGovernor.getWaterScale();
+            reflectionRefresh.invalidate();
+            refractionRefresh.invalidate();
+        }
 
         // input
         // -----
-        processInput(window);
+        if (!options.benchmark)
+        {
+            PROFILE_SCOPE("input");
+            processInput(window);
+            cameraSimulation.sample(camera);
+        }
+
+        // a new patch grid resolution only needs a new quadtree and the grid uniforms
+        if (tessellatedTerrain && patchGridRez != rez)
+        {
+            rez = patchGridRez;
+            terrainQuadtree.build(rez, width, height, heightPyramid, NUM_PATCH_PTS);
+
+            heightMapShader.use();
+            terrainGridRez.set((int)rez);
+            terrainGridSpacing.set(glm::vec2(width / (float)rez, height / (float)rez));
+            if (options.occlusionCulling)
+                occlusionCuller.setPatchGrid(terrainQuadtree, width, height);
+
+            patchRoughness.build(heightmap, (int)rez);
+            patchRoughness.upload(3);
+
+            tessLevelShader->use();
+            tessLevelGridRez.set((int)rez);
+            tessLevelGridSpacing.set(glm::vec2(width / (float)rez, height / (float)rez));
+            if (options.tessHistogram)
+                tessellationStats.enableLevelCapture(*tessLevelShader, (int)(rez * rez));
+            std::cout << "Patch grid of " << rez * rez << " patches" << std::endl;
+        }
+
+        // a new water level only moves the wet tile count of the water mesh; the water textures are re-rendered
+        if (waterHeight != meshWaterHeight)
+        {
+            meshWaterHeight = waterHeight;
+            waterMesh.setLevel(waterHeight);
+            reflectionClippingPlane = glm::vec4(0.0f, 1.0f, 0.0f, -waterHeight);
+            refractionClippingPlane = glm::vec4(0.0f, -1.0f, 0.0f, waterHeight);
+
+            glm::vec3 waterMin, waterMax;
+            waterMesh.getWetBounds(waterMin, waterMax);
+            waterVisibility.setSurface(waterMin, waterMax);
+            reflectionRefresh.invalidate();
+            refractionRefresh.invalidate();
+            std::cout << "Water level " << waterHeight << ", " << waterMesh.getWetTileCount() << " water tiles" << std::endl;
+        }
+
+        if (recordingCameraPath)
+            recordedCameraPath.addKeyframe(currentFrame - cameraPathStart, camera.Position, camera.Yaw, camera.Pitch);
+
+        // stream the heightmap tiles around the camera
+        if (useTileCache)
+            tileCache.update(glm::vec2(camera.Position.x + width / 2.0f, camera.Position.z + height / 2.0f), frameIndex);
+
+        // recentre the clipmap levels, all passes draw them around the camera's x, z
+        if (options.clipmap)
+            clipmapTerrain.update(camera.Position);
 
         // Toggle wireframe mode
         if (useWireframe)
@@ -469,67 +799,151 @@ int main()
         else
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-        // render Reflection
-        // -----------------
-        glEnable(GL_CLIP_DISTANCE0);
-        fbHandler.bindReflectionFrameBuffer();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        heightMapShader.use();
-        heightMapShader.setVec4("clippingPlane", reflectionClippingPlane);
-
-        // moving the camera 
-        glm::vec3 originalCameraPosition = camera.Position;
-        float originalCameraPitch = camera.Pitch;
-        
-        camera.Position.y = 2 * waterHeight - camera.Position.y;
-        camera.Pitch = -camera.Pitch;
-        camera.updateCameraVectors();
-        glm::mat4 view = camera.GetViewMatrix();
-
         // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100000.0f);
-        heightMapShader.setMat4("projection", projection);
-        heightMapShader.setMat4("view", view);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)fbHandler.getScreenWidth() / (float)fbHandler.getScreenHeight(), 0.1f, 100000.0f);
+        glm::mat4 view;
 
         // world transformation
         glm::mat4 model = glm::mat4(1.0f);
-        heightMapShader.setMat4("model", model);
 
-        glBindVertexArray(terrainVAO);
-        glDrawArrays(GL_PATCHES, 0, NUM_PATCH_PTS* rez* rez);
+        // screen space error target of the TCS, the same for every pass
+        if (tessellatedTerrain)
+        {
+            heightMapShader.use();
+            terrainPixelsPerEdge.set(tessellationBudget.getPixelsPerEdge());
+            terrainViewportHeight.set((float)fbHandler.getScreenHeight());
+        }
 
-        fbHandler.unbindCurrentFrameBuffer(SCR_WIDTH, SCR_HEIGHT);
+        // water visibility; textures skipped while the water was hidden are stale once it shows up again
+        waterVisibility.update(projection * camera.GetViewMatrix());
+        bool waterVisible = waterVisibility.needsPasses() && waterMesh.getWetTileCount() > 0;
+        if (waterVisible && !waterPassesNeeded)
+        {
+            reflectionRefresh.invalidate();
+            refractionRefresh.invalidate();
+        }
+        waterPassesNeeded = waterVisible;
 
-        // render Refraction
+        // render Reflection
         // -----------------
-        fbHandler.bindRefractionFrameBuffer();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        heightMapShader.use();
-        heightMapShader.setVec4("clippingPlane", refractionClippingPlane);
-
-        // moving the camera
-        camera.Pitch = originalCameraPitch;
-        camera.Position = originalCameraPosition;
-        camera.updateCameraVectors();
+        if (waterPassesNeeded && reflectionRefresh.update(camera))
+        {
+            passTimer.beginPass(PASS_REFLECTION);
+            glEnable(GL_CLIP_DISTANCE0);
+            fbHandler.bindReflectionFrameBuffer();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            heightMapShader.use();
+            terrainClippingPlane.set(reflectionClippingPlane);
+            if (tessellatedTerrain)
+                terrainTessScale.set(fbHandler.getReflectionTessScale());
+
+            // moving the camera 
+            glm::vec3 originalCameraPosition = camera.Position;
+            float originalCameraPitch = camera.Pitch;
+
+            camera.Position.y = 2 * waterHeight - camera.Position.y;
+            camera.Pitch = -camera.Pitch;
+            camera.updateCameraVectors();
+            view = camera.GetViewMatrix();
+
+            terrainProjection.set(projection);
+            terrainView.set(view);
+            terrainModel.set(model);
+
+            // cull against the mirrored camera and the clipping plane
+            if (options.cdlod)
+            {
+                terrainCameraPosition.set(camera.Position);
+                reflectionCullStats = cdlodTerrain.select(Frustum(projection * view), camera.Position, reflectionClippingPlane, cdlodQuadrants);
+
+                tessellationStats.beginPass(PASS_REFLECTION);
+                cdlodTerrain.draw(cdlodQuadrants);
+                tessellationStats.endPass(PASS_REFLECTION);
+            }
+            else if (options.clipmap)
+            {
+                reflectionCullStats = { clipmapTerrain.getLevelCount(), 0 };
+
+                tessellationStats.beginPass(PASS_REFLECTION);
+                clipmapTerrain.draw();
+                tessellationStats.endPass(PASS_REFLECTION);
+            }
+            else
+            {
+                reflectionCullStats = terrainQuadtree.cull(Frustum(projection * view), reflectionClippingPlane, reflectionPatches);
+
+                glBindVertexArray(terrainVAO);
+                tessellationStats.beginPass(PASS_REFLECTION);
+                reflectionPatches.draw();
+                tessellationStats.endPass(PASS_REFLECTION);
+            }
+
+            // moving the camera back
+            camera.Pitch = originalCameraPitch;
+            camera.Position = originalCameraPosition;
+            camera.updateCameraVectors();
+
+            fbHandler.unbindCurrentFrameBuffer();
+            passTimer.endPass(PASS_REFLECTION);
+        }
 
-        // view/projection transformations
         view = camera.GetViewMatrix();
-        heightMapShader.setMat4("projection", projection);
-        heightMapShader.setMat4("view", view);
-
-        // world transformation
-        heightMapShader.setMat4("model", model);
-
-        glBindVertexArray(terrainVAO);
-        glDrawArrays(GL_PATCHES, 0, NUM_PATCH_PTS* rez* rez);
 
-        fbHandler.unbindCurrentFrameBuffer(SCR_WIDTH, SCR_HEIGHT);
+        // render Refraction
+        // -----------------
+        if (waterPassesNeeded && refractionRefresh.update(camera))
+        {
+            passTimer.beginPass(PASS_REFRACTION);
+            glEnable(GL_CLIP_DISTANCE0);
+            fbHandler.bindRefractionFrameBuffer();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            heightMapShader.use();
+            terrainClippingPlane.set(refractionClippingPlane);
+            if (tessellatedTerrain)
+                terrainTessScale.set(fbHandler.getRefractionTessScale());
+
+            terrainProjection.set(projection);
+            terrainView.set(view);
+            terrainModel.set(model);
+
+            if (options.cdlod)
+            {
+                terrainCameraPosition.set(camera.Position);
+                refractionCullStats = cdlodTerrain.select(Frustum(projection * view), camera.Position, refractionClippingPlane, cdlodQuadrants);
+
+                tessellationStats.beginPass(PASS_REFRACTION);
+                cdlodTerrain.draw(cdlodQuadrants);
+                tessellationStats.endPass(PASS_REFRACTION);
+            }
+            else if (options.clipmap)
+            {
+                refractionCullStats = { clipmapTerrain.getLevelCount(), 0 };
+
+                tessellationStats.beginPass(PASS_REFRACTION);
+                clipmapTerrain.draw();
+                tessellationStats.endPass(PASS_REFRACTION);
+            }
+            else
+            {
+                refractionCullStats = terrainQuadtree.cull(Frustum(projection * view), refractionClippingPlane, refractionPatches);
+
+                glBindVertexArray(terrainVAO);
+                tessellationStats.beginPass(PASS_REFRACTION);
+                refractionPatches.draw();
+                tessellationStats.endPass(PASS_REFRACTION);
+            }
+
+            fbHandler.unbindCurrentFrameBuffer();
+            passTimer.endPass(PASS_REFRACTION);
+        }
 
         // render scene normally
         // ---------------------
+        passTimer.beginPass(PASS_TERRAIN);
         glDisable(GL_CLIP_DISTANCE0);
+        fbHandler.bindSceneFrameBuffer();
         //glClearColor(0.529, 0.808, 0.922, 1.0);
         glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -538,48 +952,117 @@ int main()
         heightMapShader.use();
 
         // view/projection transformations
-        //view = camera.GetViewMatrix();
-        heightMapShader.setVec4("clippingPlane", glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
-        heightMapShader.setMat4("projection", projection);
-        heightMapShader.setMat4("view", view);
+        terrainClippingPlane.set(glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+        if (tessellatedTerrain)
+            terrainTessScale.set(fbHandler.getSceneTessScale());
+        terrainProjection.set(projection);
+        terrainView.set(view);
 
         // world transformation
-        heightMapShader.setMat4("model", model);
+        terrainModel.set(model);
 
-        // render the terrain
-        glBindVertexArray(terrainVAO);
-        glDrawArrays(GL_PATCHES, 0, NUM_PATCH_PTS * rez * rez);
+        // render the terrain, the frustum visible patches are tested against last frame's depth pyramid
+        if (options.cdlod)
+        {
+            terrainCameraPosition.set(camera.Position);
+            mainCullStats = cdlodTerrain.select(Frustum(projection * view), camera.Position, glm::vec4(0.0f), cdlodQuadrants);
+
+            tessellationStats.beginPass(PASS_TERRAIN);
+            cdlodTerrain.draw(cdlodQuadrants);
+            tessellationStats.endPass(PASS_TERRAIN);
+        }
+        else if (options.clipmap)
+        {
+            mainCullStats = { clipmapTerrain.getLevelCount(), 0 };
+
+            tessellationStats.beginPass(PASS_TERRAIN);
+            clipmapTerrain.draw();
+            tessellationStats.endPass(PASS_TERRAIN);
+        }
+        else
+        {
+            mainCullStats = terrainQuadtree.cull(Frustum(projection * view), glm::vec4(0.0f), mainPatches);
+
+            bool occlusionCulled = options.occlusionCulling && occlusionCuller.cull(mainPatches, camera);
+            heightMapShader.use();
+            terrainFeedbackVertices.set(occlusionCulled);
+
+            tessellationStats.beginPass(PASS_TERRAIN);
+            if (occlusionCulled)
+                occlusionCuller.draw();
+            else
+            {
+                glBindVertexArray(terrainVAO);
+                mainPatches.draw();
+            }
+            tessellationStats.endPass(PASS_TERRAIN);
+            terrainFeedbackVertices.set(false);
+        }
+
+        // the terrain depth becomes next frame's occlusion pyramid
+        if (options.occlusionCulling)
+        {
+            occlusionCuller.buildPyramid(fbHandler.getSceneDepthTexture(), fbHandler.getSceneWidth(), fbHandler.getSceneHeight(),
+                projection * view, camera);
+            fbHandler.bindSceneFrameBuffer();
+        }
+        passTimer.endPass(PASS_TERRAIN);
+
+        // the levels the TCS chose for the frustum visible main pass patches, outside the pass timings
+        if (tessellationStats.isCapturingLevels())
+        {
+            tessLevelShader->use();
+            tessLevelProjection.set(projection);
+            tessLevelView.set(view);
+            tessLevelModel.set(model);
+            tessLevelTessScale.set(fbHandler.getSceneTessScale());
+            tessLevelPixelsPerEdge.set(tessellationBudget.getPixelsPerEdge());
+            tessLevelViewportHeight.set((float)fbHandler.getScreenHeight());
+            glBindVertexArray(terrainVAO);
+            tessellationStats.captureLevels(mainPatches);
+        }
 
         // render water surface
         // --------------------
+        passTimer.beginPass(PASS_WATER);
         waterShader.use();
 
         // binding reflection and refraction textures
         glActiveTexture(GL_TEXTURE6);
         glBindTexture(GL_TEXTURE_2D, fbHandler.getReflectionTexture());
-        waterShader.setInt("reflectionTexture", 6);
+        waterReflectionTexture.set(6);
 
         glActiveTexture(GL_TEXTURE7);
         glBindTexture(GL_TEXTURE_2D, fbHandler.getRefractionTexture());
-        waterShader.setInt("refractionTexture", 7);
+        waterRefractionTexture.set(7);
+        waterReflectionUVScale.set(fbHandler.getReflectionUVScale());
+        waterRefractionUVScale.set(fbHandler.getRefractionUVScale());
 
         // setting the matrices
-        waterShader.setMat4("projection", projection);
-        waterShader.setMat4("view", view);
-        waterShader.setMat4("model", model);
+        waterProjection.set(projection);
+        waterView.set(view);
+        waterModel.set(glm::translate(model, glm::vec3(0.0f, waterHeight, 0.0f)));
 
         // setting the move factor
         moveFactor += waveSpeed * deltaTime;
         moveFactor = fmod(moveFactor, 1);
-        waterShader.setFloat("moveFactor", moveFactor);
+        waterMoveFactor.set(moveFactor);
 
         // setting the camera position
         camera.updateCameraVectors();
-        waterShader.setVec3("cameraPosition", camera.Position);
+        waterCameraPosition.set(camera.Position);
 
-        // render water surface
-        glBindVertexArray(waterVAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        // render water surface, the query tells the next frames whether any of it passed the depth test
+        if (waterVisibility.needsDraw() && waterMesh.getWetTileCount() > 0)
+        {
+            waterVisibility.beginQuery();
+            waterMesh.draw();
+            waterVisibility.endQuery();
+        }
+
+        // upscale the scene when it was rendered at a reduced resolution
+        fbHandler.presentScene();
+        passTimer.endPass(PASS_WATER);
 
         //// render debug textures
         //// ---------------------
@@ -601,19 +1084,122 @@ int main()
         //glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
         // Reset the viewport for the main window
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        glViewport(0, 0, fbHandler.getScreenWidth(), fbHandler.getScreenHeight());
+
+        frameGovernor.endFrame();
+
+        // report the culling results once per second
+        if (currentFrame - lastCullReport >= 1.0f)
+        {
+            lastCullReport = currentFrame;
+            std::cout << "Patches visible/culled - reflection: " << reflectionCullStats.visiblePatches << "/" << reflectionCullStats.culledPatches
+                << ", refraction: " << refractionCullStats.visiblePatches << "/" << refractionCullStats.culledPatches
+                << ", main: " << mainCullStats.visiblePatches << "/" << mainCullStats.culledPatches << std::endl;
+
+            if (options.occlusionCulling)
+            {
+                const OcclusionCuller::Stats& occlusionStats = occlusionCuller.getStats();
+                std::cout << "Occlusion culling - occluded: " << occlusionStats.occludedPatches << "/" << occlusionStats.testedPatches
+                    << " patches, frustum only frames: " << occlusionStats.fallbackFrames << std::endl;
+                occlusionCuller.resetFallbackCount();
+            }
+
+            if (waterVisibility.isEnabled())
+            {
+                const WaterVisibility::Stats& waterStats = waterVisibility.getStats();
+                std::cout << "Water passes skipped - off screen: " << waterStats.outsideFrustumFrames
+                    << " frames, occluded: " << waterStats.occludedFrames << " frames" << std::endl;
+                waterVisibility.resetStats();
+            }
+
+            if (useTileCache)
+            {
+                const TileCache::Stats& tileStats = tileCache.getStats();
+                std::cout << "Tile cache - resident: " << tileStats.residentTiles << "/" << tileCache.getSlotCount()
+                    << ", pending: " << tileStats.pendingTiles << ", evictions: " << tileStats.evictions << std::endl;
+            }
+
+            if (options.clipmap)
+            {
+                std::cout << "Clipmap - texels uploaded: " << clipmapTerrain.getTotalUploadedTexels() - reportedClipmapTexels
+                    << ", triangles per pass: " << clipmapTerrain.getTriangleCount() << std::endl;
+                reportedClipmapTexels = clipmapTerrain.getTotalUploadedTexels();
+            }
+
+            // rolling CPU / GPU averages of every pass in the window title
+            if (passTimer.isEnabled() && window)
+            {
+                std::ostringstream title;
+                title.setf(std::ios::fixed);
+                title.precision(2);
+                title << "Terrain GPU - ms cpu/gpu";
+                for (int p = 0; p < PASS_COUNT; ++p)
+                    title << " | " << RENDER_PASS_NAMES[p] << " " << passTimer.getAverageCpuMs((RenderPass)p) << "/" << passTimer.getAverageGpuMs((RenderPass)p);
+                glfwSetWindowTitle(window, title.str().c_str());
+            }
+
+            if (tessellationStats.isEnabled() && !options.benchmark)
+            {
+                std::cout << "Tessellation primitives - reflection: " << (long long)tessellationStats.getAveragePrimitives(PASS_REFLECTION)
+                    << ", refraction: " << (long long)tessellationStats.getAveragePrimitives(PASS_REFRACTION)
+                    << ", terrain: " << (long long)tessellationStats.getAveragePrimitives(PASS_TERRAIN);
+                if (tessellationStats.hasInvocationCounts())
+                    std::cout << ", terrain TES invocations: " << (long long)tessellationStats.getAverageInvocations(PASS_TERRAIN);
+                if (tessellationStats.isCapturingLevels())
+                    std::cout << ", average level: " << tessellationStats.getAverageLevel();
+                std::cout << std::endl;
+            }
+
+            if (tessellationBudget.isEnabled())
+                std::cout << "Triangle budget - primitives: " << (long long)tessellationBudget.getAveragePrimitives() << "/" << tessellationBudget.getBudget()
+                    << ", pixels per edge: " << tessellationBudget.getPixelsPerEdge() << std::endl;
+
+            if (frameGovernor.isEnabled())
+                std::cout << "Dynamic resolution - GPU frame: " << frameGovernor.getAverageGpuMs() << "/" << frameGovernor.getTargetMs()
+                    << " ms, render scale: " << frameGovernor.getRenderScale() << ", water scale: " << frameGovernor.getWaterScale() << std::endl;
+        }
+
+        if (options.benchmark)
+        {
+            benchmark.endFrame(passTimer, tessellationStats);
+            continue;
+        }
 
         // glfw: swap buffers and poll IO events
         // -------------------------------------
+        passTimer.beginPass(PASS_SWAP);
         glfwSwapBuffers(window);
         glfwPollEvents();
+        passTimer.endPass(PASS_SWAP);
     }
 
+    // report the benchmark results
+    // ----------------------------
+    if (options.benchmark)
+    {
+        passTimer.flush();
+        tessellationStats.flush();
+        benchmark.writeReport(benchmark.buildReport(passTimer, tessellationStats, SCR_WIDTH, SCR_HEIGHT, (int)rez), options.benchmarkOutput);
+        if (options.profile)
+            Profiler::instance().writeTrace("benchmark_trace.json", tessellationStats.buildHistogramJson());
+    }
+
+    cameraSimulation.stop();
+
     // de-allocate all resources once we're done
     glDeleteVertexArrays(1, &terrainVAO);
-    glDeleteBuffers(1, &terrainVBO);
-
-    glfwTerminate();
+    glDeleteTextures(1, &heightPyramidTexture);
+    glDeleteTextures(1, &normalMapTexture);
+    if (proceduralTexture)
+        glDeleteTextures(1, &proceduralTexture);
+    if (dudvFallbackTexture)
+        glDeleteTextures(1, &dudvFallbackTexture);
+    glDeleteTextures(1, &materialTexture);
+    glDeleteTextures(1, &splatTexture);
+    tileCache.shutdown();
+
+    if (window)
+        glfwTerminate();
     return 0;
 }
 
@@ -622,23 +1208,26 @@ void processInput(GLFWwindow* window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
+    // the held movement keys are applied by the simulation thread at its own rate
+    unsigned int movementKeys = 0;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-    {
-        //std::cout << "Moving Forward" << std::endl;
-        camera.ProcessKeyboard(FORWARD, deltaTime);
-    }
+        movementKeys |= CameraSimulation::KEY_FORWARD;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        camera.ProcessKeyboard(BACKWARD, deltaTime);
+        movementKeys |= CameraSimulation::KEY_BACKWARD;
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        camera.ProcessKeyboard(LEFT, deltaTime);
+        movementKeys |= CameraSimulation::KEY_LEFT;
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        camera.ProcessKeyboard(RIGHT, deltaTime);
+        movementKeys |= CameraSimulation::KEY_RIGHT;
+    cameraSimulation.setMovementKeys(movementKeys);
 }
 
 // glfw: whenever the window size changed (OS or user resize) this callback function executes
 // ------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+    // the render targets follow at the start of the next frame
+    framebufferWidth = width;
+    framebufferHeight = height;
     glViewport(0, 0, width, height);
 }
 
@@ -656,6 +1245,38 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         case GLFW_KEY_G:
             displayGrayscale = 1 - displayGrayscale;
             break;
+        case GLFW_KEY_P:
+            profilingEnabled = !profilingEnabled;
+            break;
+        case GLFW_KEY_T:
+            traceRequested = true;
+            break;
+        case GLFW_KEY_LEFT_BRACKET:
+            // halve / double the patch grid resolution, the terrain picks it up next frame
+            patchGridRez = std::max(MIN_PATCH_REZ, patchGridRez / 2);
+            break;
+        case GLFW_KEY_RIGHT_BRACKET:
+            patchGridRez = std::min(MAX_PATCH_REZ, patchGridRez * 2);
+            break;
+        case GLFW_KEY_MINUS:
+            // lower / raise the water level, the water mesh follows next frame
+            waterHeight -= 1.0f;
+            break;
+        case GLFW_KEY_EQUAL:
+            waterHeight += 1.0f;
+            break;
+        case GLFW_KEY_R:
+            // record the camera flight for later benchmark runs
+            recordingCameraPath = !recordingCameraPath;
+            if (recordingCameraPath)
+            {
+                recordedCameraPath.clear();
+                cameraPathStart = (float)glfwGetTime();
+                std::cout << "Recording camera path..." << std::endl;
+            }
+            else
+                recordedCameraPath.save("camera_path.txt");
+            break;
         default:
             break;
         }
@@ -679,12 +1300,12 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     lastX = xpos;
     lastY = ypos;
 
-    camera.ProcessMouseMovement(xoffset, yoffset);
+    cameraSimulation.addMouseMovement(xoffset, yoffset);
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-    camera.ProcessMouseScroll(yoffset);
+    cameraSimulation.addScroll((float)yoffset);
 }